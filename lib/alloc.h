@@ -0,0 +1,79 @@
+#ifndef ALLOC_H
+#define ALLOC_H
+
+#include "../lib/filesystem.h"
+
+#define GROUP_BLOCKS BLOCK_SIZE //blocks (and inodes) per allocation group, one block of the free list
+
+/*
+ * The filesystem is split into allocation groups of GROUP_BLOCKS consecutive
+ * blocks. Group g owns the data blocks and the inodes [g*GROUP_BLOCKS, (g+1)*GROUP_BLOCKS),
+ * its slice of the free list is its bitmap. Every group has its own lock, free
+ * count and allocation cursors for blocks and inodes, so threads allocating in
+ * different groups don't contend and runs of creates don't rescan the group. The groups only exist in memory, the image format is unchanged.
+ * The free counts of the groups are the only ones kept up to date while blocks are
+ * taken and released, superblock.free_blocks is summed up from them by fs_free_blocks.
+ */
+
+/*
+ * (Re)builds the allocation groups from the free list.
+ * Has to be called after the free list was changed without the functions below
+ * (e.g. by fsck or resize).
+ */
+void fs_groups_init(file_system* fs);
+
+/*
+ * frees the allocation groups
+ */
+void fs_groups_free(file_system* fs);
+
+/*
+ * @return the allocation group of a block or inode number
+ */
+int fs_group_of(int num);
+
+/*
+ * Takes a free data block and marks it as used. The search starts in the group of goal
+ * (a block or inode number the new block should be close to); contended groups are skipped
+ * on the first pass.
+ * @return the block number or -1 if there is no free block
+ */
+int alloc_block_near(file_system* fs, int goal);
+
+/*
+ * Gives count data blocks back to the free list, blocks that are already free are skipped.
+ */
+void release_blocks(file_system* fs, const int* blocks, int count);
+
+/*
+ * Exchanges the contents, checksum state and free flags of the used block a and the block b
+ * under the locks of their groups, the free counts and cursors follow the free block.
+ * b_free is the free flag b is expected to have, nothing is changed if a was released or
+ * b was taken or released meanwhile.
+ * @return 0 on success, -1 if a or b changed
+ */
+int swap_blocks(file_system* fs, int a, int b, int b_free);
+
+/*
+ * Sums the free counts of the groups up and stores the sum in superblock.free_blocks,
+ * e.g. before the superblock is written. Blocks taken or released meanwhile may or may
+ * not be counted.
+ * @return the number of free data blocks
+ */
+uint32_t fs_free_blocks(file_system* fs);
+
+/*
+ * Finds a free inode for a new entry of the directory parent_num. Files are placed
+ * in the group of their parent, directories below the root are spread to the group
+ * with the most free blocks. The search starts at the inode cursor of the group.
+ * The inode is not taken.
+ * @return the inode number or -1 if there is no free inode
+ */
+int find_free_inode_near(file_system* fs, int parent_num, enum node_type type);
+
+/*
+ * Moves the inode cursor of the group of a freed inode back to it, called by inode_release
+ */
+void inode_freed(file_system* fs, int inode_num);
+
+#endif //ALLOC_H
@@ -0,0 +1,45 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define ARENA_STACK_SIZE 512 //stack space of the arena of one operation, covers paths of usual length
+
+/*
+ * Bump allocator for the temporaries of one operation. It starts out in a buffer
+ * of the caller (usually on the stack), so the common case doesn't touch the heap.
+ * Requests that don't fit anymore get a heap chunk, all of them are freed at once
+ * by arena_release. Single threaded.
+ */
+
+typedef struct _arena_chunk arena_chunk;
+
+typedef struct _arena{
+	uint8_t* buf;
+	size_t size;
+	size_t used;
+	arena_chunk* chunks; //heap chunks, the newest first
+} arena;
+
+/*
+ * starts an arena in the size bytes at buf
+ */
+void arena_init(arena* a, void* buf, size_t size);
+
+/*
+ * @return n bytes aligned for any type, valid until arena_release
+ */
+void* arena_alloc(arena* a, size_t n);
+
+/*
+ * @return a copy of s in the arena
+ */
+char* arena_strdup(arena* a, const char* s);
+
+/*
+ * frees the heap chunks, the arena can't be used afterwards
+ */
+void arena_release(arena* a);
+
+#endif //ARENA_H
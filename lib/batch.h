@@ -0,0 +1,34 @@
+#ifndef BATCH_H
+
+#include <stddef.h>
+
+#include "../lib/filesystem.h"
+
+enum fs_op_type{
+	op_mkdir=1,
+	op_mkfile=2,
+	op_write=3,
+	op_rm=4
+};
+
+typedef struct _fs_op{
+	enum fs_op_type type;
+	const char* path; //absolute path of the directory or file
+	const char* text; //text to append, only used by op_write
+	int result; //set by fs_batch, same codes as fs_mkdir, fs_mkfile, fs_writef and fs_rm
+} fs_op;
+
+/**
+ * Applies a batch of operations.
+ * The operations are grouped by their parent directory, which is resolved only once
+ * per group (and again after an rm), and free inodes and blocks are taken from the allocation group of the
+ * directory, which keeps its own block and inode cursors (see alloc.h). Groups are applied in path order, so a directory is created before
+ * anything inside it; operations within one directory keep their relative order.
+ * Each group runs in a read side section of the epoch reclamation, see epoch.h.
+ *
+ * @Returns: number of operations that failed, every op's result field is set
+ */
+int fs_batch(file_system *fs, fs_op *ops, size_t count);
+
+#define BATCH_H
+#endif /* BATCH_H */
@@ -0,0 +1,39 @@
+#ifndef BULKIO_H
+#define BULKIO_H
+
+#include "../lib/filesystem.h"
+
+/**
+ * Recursively imports the contents of a directory of the host into the directory int_path.
+ * Host directories are walked and files are read on a work-stealing thread pool; data blocks
+ * come from the allocation group of the target directory, workers fall back to another group
+ * while it is locked so they don't contend on allocation.
+ * Existing directories are merged, existing files are not overwritten.
+ *
+ * @Param: char* int_path existing directory in the internal file system
+ * @Param: char* ext_path directory of the host to import
+ * @Param: int num_threads worker threads, 0 for one per online cpu
+ *
+ * @Returns:
+ * number of files and directories that could not be imported (0 on full success)
+ * -1 if int_path or ext_path is not a directory
+ */
+int fs_import_tree(file_system *fs, char *int_path, char *ext_path, int num_threads);
+
+/**
+ * Recursively exports the directory int_path to the host directory ext_path.
+ * Directories are traversed on a work-stealing thread pool; every file is written
+ * straight from its data blocks with a single writev.
+ * Host directories that already exist are reused, existing files are not overwritten.
+ *
+ * @Param: char* int_path directory in the internal file system
+ * @Param: char* ext_path host directory to export to, created if missing
+ * @Param: int num_threads worker threads, 0 for one per online cpu
+ *
+ * @Returns:
+ * number of files and directories that could not be exported (0 on full success)
+ * -1 if int_path is not a directory or ext_path can't be created
+ */
+int fs_export_tree(file_system *fs, char *int_path, char *ext_path, int num_threads);
+
+#endif //BULKIO_H
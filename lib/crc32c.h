@@ -0,0 +1,23 @@
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Computes the CRC32C (Castagnoli) checksum of a buffer.
+ * Uses the SSE4.2 crc32 instruction when the cpu supports it and a
+ * slicing-by-8 table implementation otherwise.
+ * @param uint32_t crc checksum of the preceding data, 0 for a fresh checksum
+ * @param const void* buf data to checksum
+ * @param size_t len length of buf in bytes
+ * @return the updated checksum
+ */
+uint32_t crc32c(uint32_t crc, const void* buf, size_t len);
+
+/*
+ * @return 1 if crc32c() runs on the hardware implementation, 0 else
+ */
+int crc32c_hw_available(void);
+
+#endif //CRC32C_H
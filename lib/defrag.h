@@ -0,0 +1,50 @@
+#ifndef DEFRAG_H
+#define DEFRAG_H
+
+#include <stdint.h>
+
+#include "../lib/filesystem.h"
+
+/*
+ * Progress of a defragmentation pass. Files are visited in inode order and
+ * their blocks are laid out back to back from block 0 onward, which also
+ * compacts all used blocks to the front of the filesystem.
+ */
+typedef struct _defrag_state{
+	uint32_t next_inode; //next inode to lay out
+	uint32_t next_block; //where the blocks of the next file go
+	uint32_t moved; //number of blocks relocated so far
+	int done; //1 once every file was visited
+} defrag_state;
+
+/*
+ * Starts a new defragmentation pass
+ */
+void fs_defrag_init(defrag_state* st);
+
+/*
+ * Continues a defragmentation pass, relocating at most max_moves blocks.
+ * Other operations may run meanwhile: every swap holds the seqlocks of both
+ * owners and the group locks of both blocks and checks again that the owners
+ * recorded at the start of the step still hold the blocks, a position that
+ * changed hands is skipped. fs_readf repeats a read whose blocks moved.
+ * Exports and delta saves read the blocks without the seqlocks and must not
+ * run during a step.
+ * @return 1 if there is work left, 0 when the pass is complete
+ */
+int fs_defrag_step(file_system* fs, defrag_state* st, int max_moves);
+
+/*
+ * Runs a whole defragmentation pass
+ * @return number of relocated blocks
+ */
+int fs_defrag(file_system* fs);
+
+/*
+ * Fills owner_inode[b] and owner_slot[b] with the file inode and the index into its
+ * direct_blocks for every data block b, -1 if the block belongs to no file.
+ * Both arrays must hold fs->s_block->num_blocks entries.
+ */
+void block_owners(file_system* fs, int* owner_inode, int* owner_slot);
+
+#endif //DEFRAG_H
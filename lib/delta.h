@@ -0,0 +1,75 @@
+#ifndef DELTA_H
+#define DELTA_H
+
+#include <stdint.h>
+
+#include "../lib/filesystem.h"
+
+/*
+ * Changed block tracking and delta images for replication.
+ * The write paths mark the data blocks and the inode table chunks (INODE_CHUNK inodes,
+ * the unit of the inode checksums) they change in two bitmaps of the filesystem.
+ * fs_delta_export writes the marked regions into a patch and clears the marks,
+ * fs_delta_apply copies a patch into another filesystem. A replica that starts as a copy
+ * of the image and gets every patch in order stays identical to the source, so
+ * replication moves data in proportion to the changes instead of whole dumps.
+ *
+ * A patch is, with the records and byte order of an image (see image.h):
+ *	delta_header, disk_superblock, free list (num_blocks bytes),
+ *	inode_chunks x (uint32_t chunk, the disk_inodes of the chunk),
+ *	data_blocks x (uint32_t block, disk_block),
+ *	uint32_t CRC32C of everything before
+ */
+
+#define DELTA_MAGIC "FSDELTA2"
+
+typedef struct _delta_header{
+	char magic[8];
+	uint32_t num_blocks; //size of the filesystem, patches only apply to one of the same size
+	uint32_t inode_chunks; //number of inode chunks in the patch
+	uint32_t data_blocks; //number of data blocks in the patch
+	uint32_t reserved;
+} delta_header;
+
+/*
+ * allocates the bitmaps of fs, nothing is marked
+ */
+void fs_delta_init(file_system* fs);
+
+/*
+ * frees the bitmaps of fs
+ */
+void fs_delta_free(file_system* fs);
+
+/*
+ * Reallocates the bitmaps for fs->s_block->num_blocks blocks and marks everything,
+ * e.g. after a resize or a repair changed the filesystem outside of the write paths
+ */
+void fs_delta_mark_all(file_system* fs);
+
+/*
+ * Writes the regions marked since the last export (or since loading) into a new patch
+ * file and clears their marks. Free blocks are only sent as part of the free list.
+ * Like fs_dump it must not run concurrently with writers.
+ * @return the number of inode chunks and data blocks in the patch, -1 if the file can't be
+ * written or a marked block is corrupt
+ */
+int fs_delta_export(file_system* fs, const char* patch_path);
+
+/*
+ * Copies a patch into fs and marks the regions it changed. No other operation may run meanwhile.
+ * @return 0 on success, -1 if the patch can't be read, is damaged or was made for a
+ * filesystem of another size. fs is unchanged then.
+ */
+int fs_delta_apply(file_system* fs, const char* patch_path);
+
+static inline void delta_mark_block(file_system* fs, int block_num){
+	__atomic_fetch_or(&fs->dirty_blocks[block_num / 64], (uint64_t)1 << (block_num % 64), __ATOMIC_RELAXED);
+}
+
+static inline void delta_mark_inode(file_system* fs, int inode_num){
+	int chunk = inode_num / INODE_CHUNK;
+	__atomic_fetch_or(&fs->dirty_inodes[chunk / 64], (uint64_t)1 << (chunk % 64), __ATOMIC_RELAXED);
+}
+
+#endif //DELTA_H
@@ -0,0 +1,55 @@
+#ifndef EPOCH_H
+#define EPOCH_H
+
+#include "../lib/filesystem.h"
+
+#define EPOCH_SLOTS 64 //reader slots, threads beyond that share them
+
+/*
+ * Epoch based reclamation of inodes and data blocks.
+ * Readers bracket every operation that follows inode numbers or block numbers
+ * with fs_epoch_enter/fs_epoch_exit, which takes no lock. Removed inodes and blocks
+ * are retired instead of freed: they stay untouched until every reader that
+ * entered before the removal has left, so a reader never sees a recycled slot.
+ * Without active readers they are freed right away.
+ */
+
+/*
+ * allocates the reclamation state of fs
+ */
+void fs_epoch_init(file_system* fs);
+
+/*
+ * reclaims everything that is retired and frees the reclamation state of fs
+ */
+void fs_epoch_free(file_system* fs);
+
+/*
+ * Starts a read side section of the calling thread. Sections can be nested.
+ */
+void fs_epoch_enter(file_system* fs);
+
+/*
+ * Ends a read side section, the last reader to leave reclaims what became safe to free
+ */
+void fs_epoch_exit(file_system* fs);
+
+/*
+ * Frees count data blocks and, if inode_num isn't -1, an inode once no reader can see them
+ * anymore. The caller must have detached them before, so that new readers can't find them.
+ */
+void fs_epoch_retire(file_system* fs, const int* blocks, int count, int inode_num);
+
+/*
+ * Retires the removed regular file inode_num together with its data blocks. The blocks are
+ * taken by inode_detach, so a writer that found the file before can't add one nobody frees.
+ */
+void fs_epoch_retire_file(file_system* fs, int inode_num);
+
+/*
+ * Waits for the readers that may see retired inodes or blocks and frees all of them.
+ * Must not be called from inside a read side section.
+ */
+void fs_epoch_barrier(file_system* fs);
+
+#endif //EPOCH_H
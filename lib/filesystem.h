@@ -9,6 +9,8 @@
 #define BLOCK_SIZE 1024
 #define NAME_MAX_LENGTH 32
 #define DIRECT_BLOCKS_COUNT 12
+#define MAX_FILE_SIZE (DIRECT_BLOCKS_COUNT * BLOCK_SIZE) //a file only has direct blocks
+#define INODE_CHUNK 64 //number of inodes covered by one inode table checksum
 
 enum node_type{
 	reg_file=1,
@@ -31,11 +33,15 @@ typedef struct _inode {
 	char name[NAME_MAX_LENGTH];
 	int direct_blocks[DIRECT_BLOCKS_COUNT]; //Block numbers. -1 if there is no block
 	int parent; //inode number of parent
+	uint64_t mtime; //ns since the epoch of the last change of the content (entries of a directory)
+	uint64_t ctime; //ns since the epoch of the last change of the inode, including relocations
+	uint64_t change_seq; //value of the change counter of the filesystem at the last content change
 } inode;
 
 typedef struct _superblock{
 	uint32_t num_blocks;
 	uint32_t free_blocks;
+	int32_t root_node; //inode number of the root directory, kept up to date by fs_dump
 } superblock;
 
 typedef struct _fs{
@@ -44,15 +50,37 @@ typedef struct _fs{
 	inode * inodes;	
 	data_block* data_blocks;
 	int root_node; //inode-number of root node
+	uint32_t* block_crc; //CRC32C of every data block, as stored in the image
+	uint32_t* inode_crc; //CRC32C of every INODE_CHUNK inodes, as stored in the image
+	uint8_t* verified; //1 if the data block matched its checksum or was rewritten since loading
+	struct _sweeper* sweeper; //background reclamation of removed subtrees, NULL if not running
+	struct _alloc_group* groups; //allocation groups, see alloc.h
+	uint32_t num_groups;
+	uint32_t* inode_seq; //seqlock counter of every inode, odd while a writer changes the inode
+	struct _epoch* epoch; //deferred reclamation of removed inodes and blocks, see epoch.h
+	uint64_t change_seq; //last change_seq handed to an inode, continues from the highest one on load
+	uint64_t* dirty_blocks; //bitmap of the data blocks changed since the last delta export, see delta.h
+	uint64_t* dirty_inodes; //bitmap of the inode chunks changed since the last delta export
 }file_system ;
 
 /**
 	* Allocates memory for a filesystem and loads an existing filesystem from a .fs-file.
+	* The inode table and the used data blocks are verified against their checksums.
+	* A corrupt inode table fails the load, corrupt data blocks fail on access
+	* (see verify_block) and keep their stored checksum in later dumps
 	* @param const char* path to the fs-file
-	* @return pointer to a fs-struct 
+	* Images of older formats are converted, see image.h
+	* @return pointer to a fs-struct or NULL if the file is missing, of an unknown format or
+	* a newer version, or the inode table is corrupt
 **/
 file_system* fs_load(const char* fs_file_path);
 
+/**
+	* Same as fs_load with the number of threads that read and verify the image in parallel,
+	* 0 for one per online cpu (but only one for every 4096 blocks)
+**/
+file_system* fs_load_threads(const char* fs_file_path, int num_threads);
+
 
 /**
 	* creates a new file system file
@@ -64,7 +92,9 @@ file_system* fs_load(const char* fs_file_path);
 file_system* fs_create(const char* fs_file_path, uint32_t size);
 
 /*
- * dumps the filesystem to harddrive
+ * dumps the filesystem to harddrive.
+ * The image is sparse: free data blocks are not written, blocks freed since
+ * the last dump to the same file are punched out as holes.
  * @param file_system* fs the filesystem to dump
  * @param const char* file_path where to put the file on the harddrive
  * @return 0 on success, -1 else
@@ -72,15 +102,83 @@ file_system* fs_create(const char* fs_file_path, uint32_t size);
 int fs_dump(file_system* fs, const char* file_path);
 
 
+/*
+ * Checks a data block against its checksum, unless that already happened since loading
+ * @return 0 if the block is intact, -1 else
+ */
+int verify_block(file_system* fs, int block_num);
+
+/*
+ * Verifies every used data block that was not yet verified against its checksum.
+ * (The inode table is already verified by fs_load.)
+ * @return number of corrupt data blocks, 0 if the filesystem is intact
+ */
+int fs_verify(file_system* fs);
+
+/*
+	* Searches the inode table for the root directory, for images that don't name it
+	* in their superblock
+	* @return its inode number or -1 if there is none
+*/
+int fs_find_root(file_system* fs);
+
 /*
 	* Initialize an empty inode
 */
 void inode_init(inode* i);
+/*
+	* Seqlock of the inode metadata. Every change of an inode that may run concurrently
+	* with readers is bracketed by inode_write_begin/inode_write_end. Writers of the same
+	* inode exclude each other, when two inodes are changed together the parent directory
+	* is taken first.
+*/
+void inode_write_begin(file_system* fs, int inode_num);
+void inode_write_end(file_system* fs, int inode_num);
+
+/*
+	* Stamps the ctime of an inode and, if content is set, its mtime and a new change_seq.
+	* The seqlock of the inode must be held.
+*/
+void inode_touch(file_system* fs, int inode_num, int content);
+
+/*
+	* Copies an inode without taking a lock. The copy is retried until no writer
+	* changed the inode while it was taken, so it is always consistent.
+	* @return the sequence count the copy belongs to, for inode_changed
+*/
+uint32_t inode_read(file_system* fs, int inode_num, inode* out);
+
+/*
+	* Tells whether a writer took the inode since inode_read returned seq, e.g. to
+	* repeat a read of data blocks that defrag may have moved meanwhile.
+	* @return 1 if the inode changed, 0 otherwise
+*/
+int inode_changed(file_system* fs, int inode_num, uint32_t seq);
+
+/*
+	* Marks a removed inode as detached by setting its parent to -1, under its seqlock, and
+	* copies its used direct_blocks (data blocks of a file, entries of a directory) to out.
+	* Appends to a detached file and creates in a detached directory fail, so nothing is
+	* added after the copy was taken.
+	* @return the number of entries copied to out, which holds DIRECT_BLOCKS_COUNT
+*/
+int inode_detach(file_system* fs, int inode_num, int* out);
+
+/*
+	* Clears an inode and marks it free, under its seqlock
+*/
+void inode_release(file_system* fs, int inode_num);
+
 /*
 	* find free inode and return its number or -1 if there is no free inode
 */
 int find_free_inode(file_system* fs);
 
+/*
+	* same as find_free_inode, but only looks at inodes from start onward
+*/
+int find_free_inode_from(file_system* fs, int start);
+
 /*
 	* frees up memory
 */
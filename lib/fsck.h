@@ -0,0 +1,37 @@
+#ifndef FSCK_H
+#define FSCK_H
+
+#include <stdint.h>
+
+#include "../lib/filesystem.h"
+
+typedef struct _fsck_report{
+	uint32_t bad_inodes; //inodes with an unknown n_type
+	uint32_t bad_entries; //directory entries or file block pointers that are out of range or point to free inodes
+	uint32_t multi_linked; //extra directory entries for inodes that are listed in more than one directory
+	uint32_t unreachable; //used inodes that can't be reached from the root node
+	uint32_t bad_parents; //inodes whose parent doesn't match the directory listing them
+	uint32_t leaked_blocks; //blocks marked as used in the free list but owned by no file
+	uint32_t unmarked_blocks; //blocks owned by a file but marked as free in the free list
+	uint32_t shared_blocks; //extra owners of blocks that belong to more than one file
+	uint32_t free_count; //1 if the free counts of the allocation groups don't match the free list
+} fsck_report;
+
+/*
+ * Checks the consistency of the inode tree and the free list:
+ *	- every used inode is reachable from the root node
+ *	- parent pointers match the directory that lists an inode
+ *	- every data block is owned by at most one file and the free list matches ownership
+ *	- the free counts of the allocation groups match the free list
+ * The checks are sharded over the inodes/blocks and run on several threads.
+ * @param int repair if nonzero the found problems are fixed: unreachable inodes are freed,
+ * invalid and duplicate entries dropped (the size of a file follows its remaining blocks),
+ * parents and the free list rebuilt. A repair must run offline: it rebuilds the free list
+ * and the allocation groups, so no other thread may use fs meanwhile.
+ * @param int num_threads worker threads to use, 0 for one per online cpu
+ * @param fsck_report* report filled with the problem counts found (before repairing), may be NULL
+ * @return number of problems found, 0 if the filesystem is consistent
+ */
+int fs_fsck(file_system* fs, int repair, int num_threads, fsck_report* report);
+
+#endif //FSCK_H
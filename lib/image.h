@@ -0,0 +1,124 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "../lib/filesystem.h"
+
+/*
+ * On-disk format of an image. Every field has a fixed width and is little-endian,
+ * every record is free of padding, so an image reads the same with any compiler and
+ * on any architecture. The in-memory structures of filesystem.h are converted on
+ * load and dump. Where they happen to have the same layout as the records (little-endian
+ * LP64 hosts), the regions are read and written without a copy.
+ *
+ * An image is:
+ *	disk_superblock, at offset 0
+ *	free list, num_blocks bytes (1 == free)
+ *	num_blocks x disk_inode
+ *	num_blocks x disk_block, free blocks are holes
+ *	num_blocks x uint32_t CRC32C of the data block records
+ *	num_inode_chunks x uint32_t CRC32C of INODE_CHUNK inode records
+ * The superblock holds the offset of every region, readers must take the regions from
+ * there. A reader refuses record sizes other than the ones of its version.
+ * Images written before the superblock had a magic number were raw copies of the x86-64
+ * structures of that time. fs_load still reads them, see old_formats in filesystem.c.
+ */
+
+#define IMAGE_MAGIC "HA2FSIMG"
+#define IMAGE_VERSION 1 //images of a higher version are refused
+#define IMAGE_BATCH 16 //records converted on the stack at a time where the layouts differ
+
+typedef struct _disk_superblock{
+	char magic[8]; //IMAGE_MAGIC, without terminator
+	uint32_t version;
+	uint32_t header_size; //bytes of the superblock
+	uint32_t num_blocks;
+	uint32_t free_blocks;
+	int32_t root_node; //inode number of the root directory
+	uint32_t block_size; //BLOCK_SIZE
+	uint32_t inode_size; //bytes of a disk_inode
+	uint32_t block_record_size; //bytes of a disk_block
+	uint64_t free_list; //offsets of the regions
+	uint64_t inodes;
+	uint64_t data_blocks;
+	uint64_t checksums;
+	uint64_t inode_checksums;
+	uint64_t image_size; //end of the last region
+	uint32_t reserved;
+	uint32_t crc; //CRC32C of the superblock up to this field
+} disk_superblock;
+
+typedef struct _disk_inode{
+	uint32_t n_type; //enum node_type
+	uint16_t size;
+	char name[NAME_MAX_LENGTH];
+	uint16_t reserved;
+	int32_t direct_blocks[DIRECT_BLOCKS_COUNT];
+	int32_t parent;
+	uint32_t reserved2;
+	uint64_t mtime;
+	uint64_t ctime;
+	uint64_t change_seq;
+} disk_inode;
+
+typedef struct _disk_block{
+	uint64_t size;
+	uint8_t block[BLOCK_SIZE];
+} disk_block;
+
+//1 if the in-memory structures have the layout of the records, then no conversion is needed
+#define IMAGE_LITTLE_ENDIAN (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+#define IMAGE_NATIVE_INODES (IMAGE_LITTLE_ENDIAN && sizeof(inode) == sizeof(disk_inode) && \
+	sizeof(enum node_type) == sizeof(uint32_t) && offsetof(inode, size) == offsetof(disk_inode, size) && \
+	offsetof(inode, direct_blocks) == offsetof(disk_inode, direct_blocks) && \
+	offsetof(inode, parent) == offsetof(disk_inode, parent) && offsetof(inode, mtime) == offsetof(disk_inode, mtime))
+#define IMAGE_NATIVE_BLOCKS (IMAGE_LITTLE_ENDIAN && sizeof(data_block) == sizeof(disk_block) && \
+	sizeof(size_t) == sizeof(uint64_t))
+
+static inline uint16_t le16(uint16_t v){
+	return IMAGE_LITTLE_ENDIAN ? v : __builtin_bswap16(v);
+}
+
+static inline uint32_t le32(uint32_t v){
+	return IMAGE_LITTLE_ENDIAN ? v : __builtin_bswap32(v);
+}
+
+static inline uint64_t le64(uint64_t v){
+	return IMAGE_LITTLE_ENDIAN ? v : __builtin_bswap64(v);
+}
+
+/*
+ * Fills in a superblock for an image of fs with the regions at their usual offsets
+ */
+void image_superblock_encode(file_system* fs, disk_superblock* out);
+
+/*
+ * Checks the magic number, version, checksum and region offsets of a superblock and
+ * converts it to host order
+ * @return 0 if the image can be read, -1 else
+ */
+int image_superblock_decode(const disk_superblock* in, disk_superblock* out);
+
+/*
+ * converts count inodes to records and back. Records shorter than a disk_inode (of an
+ * older format) are a prefix of one, the missing fields are read as zero.
+ */
+void image_inodes_encode(const inode* in, disk_inode* out, uint32_t count);
+void image_inodes_decode(const uint8_t* in, size_t record_size, inode* out, uint32_t count);
+
+void image_block_encode(const data_block* in, disk_block* out);
+void image_block_decode(const disk_block* in, data_block* out);
+
+/*
+ * @return CRC32C of the records of count inodes, as the image stores them
+ */
+uint32_t image_inodes_crc(const inode* inodes, uint32_t count);
+
+/*
+ * @return CRC32C of the record of a data block
+ */
+uint32_t image_block_crc(const data_block* block);
+
+#endif //IMAGE_H
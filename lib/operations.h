@@ -6,6 +6,8 @@
 #include "../lib/filesystem.h"
 
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+#define LIST_MAX_LENGTH (DIRECT_BLOCKS_COUNT * (NAME_MAX_LENGTH + 5)) //longest output of fs_list
 
 /**
  * Creates a new directory under the given path
@@ -43,6 +45,61 @@ int fs_mkfile(file_system *fs, char *path_and_name);
  */
 char *fs_list(file_system *fs, char *path);
 
+/**
+ * Like fs_list, but prints the listing into the size bytes at buf like snprintf does,
+ * without allocating. A buf of LIST_MAX_LENGTH + 1 bytes always fits.
+ *
+ * @Returns: the length of the whole listing, even if it was cut off, or -1 if the path
+ * was not found
+ */
+int fs_list_into(file_system *fs, char *path, char *buf, size_t size);
+
+typedef struct _fs_dirent{
+	int inode_num;
+	enum node_type type;
+	uint32_t size; //bytes of a file, 0 for a directory
+	char name[NAME_MAX_LENGTH + 1];
+} fs_dirent;
+
+/* Cursor of fs_readdir, owned by the caller. Needs no closing */
+typedef struct _fs_dir{
+	file_system* fs;
+	int dir_num;
+	int next; //directory slot the next batch starts at
+} fs_dir;
+
+/**
+ * Opens a cursor over the entries of the directory pointed to by path
+ *
+ * @Returns: 0 on success, -1 if the path was not found
+ */
+int fs_opendir(file_system *fs, char *path, fs_dir *dir);
+
+/**
+ * Copies up to max entries of the directory into entries, in the order fs_list prints
+ * them, and moves the cursor past them. Nothing is allocated. Each batch is read
+ * without locking and is consistent in itself; entries added or removed between two
+ * batches may or may not show up.
+ *
+ * @Returns: the number of entries copied, 0 once the directory is exhausted, -1 if the
+ * directory was removed meanwhile
+ */
+int fs_readdir(fs_dir *dir, fs_dirent *entries, int max);
+
+typedef struct _fs_dirent_plus{
+	int inode_num;
+	int blocks; //data blocks of a file, 0 for a directory
+	inode info; //what fs_stat of the entry would return
+} fs_dirent_plus;
+
+/**
+ * Like fs_readdir, but hands out the whole inode of every entry, so listing a
+ * directory and stating its children takes one pass instead of a path walk per child.
+ *
+ * @Returns: like fs_readdir
+ */
+int fs_readdir_plus(fs_dir *dir, fs_dirent_plus *entries, int max);
+
 /**
  * Write (append, not overwrite) @param text to a file pointed to by @param
  * filename The file must exist before it can be written to
@@ -63,8 +120,18 @@ int fs_writef(file_system *fs, char *filename, char *text);
  */
 uint8_t *fs_readf(file_system *fs, char *filename, int *file_size);
 
+/**
+ * Like fs_readf, but copies at most size bytes of the file into buf instead of
+ * allocating. A buf of MAX_FILE_SIZE bytes always fits. buf is not terminated.
+ *
+ * @Returns: the size of the file, even if it was cut off, or -1 if the file does not exist
+ */
+int fs_readf_into(file_system *fs, char *filename, uint8_t *buf, size_t size);
+
 /**
  * Deletes a file or a directory recursively.
+ * If a sweeper runs (see sweeper.h) the entry is only detached from its parent here
+ * and its inodes and blocks are reclaimed in the background.
  *
  * @Returns:
  * 0 on success
@@ -97,5 +164,104 @@ int fs_import(file_system *fs, char *int_path, char *ext_path);
  */
 int fs_export(file_system *fs, char *int_path, char *ext_path);
 
+/**
+ * Copies the inode path points to into *out. Like the path walks of the other
+ * operations this takes no lock: the inodes are read optimistically and the copy is
+ * only retried if a writer changed an inode meanwhile.
+ *
+ * @Returns: the inode number or -1 if the path wasn't found
+ */
+int fs_stat(file_system *fs, char *path, inode *out);
+
+/* Cursor of fs_changes_next, owned by the caller */
+typedef struct _fs_changes{
+	file_system* fs;
+	uint64_t since;
+	uint32_t next; //inode the next batch starts at
+} fs_changes;
+
+/**
+ * @Returns: the change sequence of the latest change. Every content change of an inode
+ * (a write, an entry added to or removed from a directory) stamps the inode with a new,
+ * higher sequence and its mtime.
+ */
+uint64_t fs_change_seq(file_system *fs);
+
+/**
+ * Starts a scan for the inodes whose content changed after the sequence since.
+ * For an incremental sync take fs_change_seq first, scan from the sequence of the last
+ * sync and keep the taken value for the next one. Removed inodes aren't reported, but
+ * their directory is.
+ */
+void fs_changes_begin(file_system *fs, uint64_t since, fs_changes *changes);
+
+/**
+ * Copies up to max of the changed inodes into entries, in inode order.
+ *
+ * @Returns: the number of entries copied, 0 once the scan is done
+ */
+int fs_changes_next(fs_changes *changes, fs_dirent_plus *entries, int max);
+
+/**
+ * Writes the absolute path of inode_num into buf, if it fits into size bytes
+ *
+ * @Returns: the length of the path, -1 if the inode was removed
+ */
+int fs_inode_path(file_system *fs, int inode_num, char *buf, size_t size);
+
+/* Inode level helpers shared by the operations above and the bulk operations */
+
+/**
+ * Finds the entry called name in the directory dir_num
+ * @Param: enum node_type type only match entries of this type, 0 for any type
+ *
+ * @Returns: the inode number of the entry or -1 if there is none
+ */
+int lookup_child(file_system *fs, int dir_num, const char *name, enum node_type type);
+
+/**
+ * Creates an empty inode of the given type and adds it to the directory parent_num.
+ * The check for an existing entry runs under the seqlock of the directory, so of two
+ * concurrent creates of one name exactly one succeeds.
+ * The inode is taken near the directory, see find_free_inode_near.
+ *
+ * @Returns:
+ * the new inode number
+ * -1 if the name is invalid, the directory is full or being removed, or there are no free inodes
+ * -2 if the directory already has an entry of that name and type
+ */
+int create_inode(file_system *fs, int parent_num, const char *name, enum node_type type);
+
+/**
+ * Appends len bytes of text to the regular file inode_num.
+ * New data blocks are taken from the allocation group of the inode.
+ *
+ * @Returns:
+ * number of written chars on success
+ * -1 if a data block of the file is corrupt or the file was removed since it was looked up
+ * -2 if the file or the filesystem is full
+ */
+int append_inode(file_system *fs, int inode_num, const char *text, int len);
+
+/**
+ * Finds the directory inode a path points to. The path is modified (tokenized).
+ *
+ * @Returns: the inode number or -1 if a component is missing or not a directory
+ */
+int find_parent_directory(file_system *fs, char *path);
+
+/**
+ * Detaches inode_num from the directory parent_inode_num
+ *
+ * @Returns: 1 if the entry was removed, 0 if the directory had no entry for inode_num
+ * (a concurrent removal came first). Only the caller that got 1 may free the inode.
+ */
+int remove_inode_from_parent_directory(file_system *fs, int parent_inode_num, int inode_num);
+
+/**
+ * Frees inode_num, its data blocks and, for a directory, everything below it
+ */
+void remove_inode(file_system *fs, int inode_num);
+
 #define OPERATIONS_H
 #endif /* OPERATIONS_H */
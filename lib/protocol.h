@@ -0,0 +1,51 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <stdint.h>
+
+/*
+ * Binary request protocol of the fsd daemon, spoken over a Unix domain stream socket.
+ * All integers are little endian. A client may send any number of requests without
+ * waiting for the responses (pipelining); the responses come back in request order
+ * and carry the id of their request.
+ *
+ * Request:  proto_request, then path_length bytes of path (not NUL terminated),
+ *           then length - path_length bytes of data (only used by proto_writef)
+ * Response: proto_response, then length bytes of payload
+ *
+ * The payload of proto_stat is a disk_inode record of image.h, the same 120 bytes an
+ * image stores per inode, independent of the struct layout of the daemon's host:
+ *	uint32_t n_type, uint16_t size, char name[32] (NUL padded), uint16_t reserved,
+ *	int32_t direct_blocks[12], int32_t parent, uint32_t reserved2,
+ *	uint64_t mtime, uint64_t ctime, uint64_t change_seq
+ */
+
+#define PROTO_MAX_PATH 4096
+#define PROTO_MAX_LENGTH (64 * 1024) //largest request body
+
+enum proto_op{
+	proto_mkdir=1, //status: result of fs_mkdir
+	proto_mkfile=2, //status: result of fs_mkfile
+	proto_list=3, //status: 0 or -1, payload: the listing of fs_list
+	proto_writef=4, //status: result of fs_writef. The data is text, it ends at the first NUL
+	proto_readf=5, //status: 0 or -1 (missing file), payload: the contents
+	proto_rm=6, //status: result of fs_rm
+	proto_stat=7, //status: inode number or -1, payload: the inode as a disk_inode, see above
+	proto_dump=8 //status: result of fs_dump to the image the daemon was started with
+};
+
+typedef struct __attribute__((packed)) _proto_request{
+	uint32_t length; //bytes following the header: path and data
+	uint32_t id; //chosen by the client, echoed in the response
+	uint8_t op; //enum proto_op
+	uint8_t reserved;
+	uint16_t path_length;
+} proto_request;
+
+typedef struct __attribute__((packed)) _proto_response{
+	uint32_t length; //bytes of payload following the header
+	uint32_t id;
+	int32_t status;
+} proto_response;
+
+#endif //PROTOCOL_H
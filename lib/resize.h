@@ -0,0 +1,23 @@
+#ifndef RESIZE_H
+#define RESIZE_H
+
+#include <stdint.h>
+
+#include "../lib/filesystem.h"
+
+/*
+ * Grows or shrinks a filesystem to num_blocks blocks (and inodes).
+ * When shrinking, used inodes and data blocks in the cut off tail are moved
+ * to free slots in front of num_blocks first, so no data is lost.
+ * The new size is written to disk with the next fs_dump.
+ * This is not safe under live load: no other operation may use the filesystem while it is
+ * resized. The inode table, the data blocks and every per-block array (checksums, seqlocks,
+ * allocation groups, the delta bitmaps) are reallocated, and the lock-free readers and the
+ * writers hold plain pointers into them that nothing would wait for. Only the removals
+ * in flight are finished first (sweeper and epoch), callers must stop their own threads.
+ * @param uint32_t num_blocks the new amount of 1024-Byte-Blocks
+ * @return 0 on success, -1 if the used inodes or blocks don't fit into the new size
+ */
+int fs_resize(file_system* fs, uint32_t num_blocks);
+
+#endif //RESIZE_H
@@ -0,0 +1,70 @@
+#ifndef SPAN_H
+#define SPAN_H
+
+#include <stdint.h>
+#include <time.h>
+
+/*
+ * Timed spans around the slow paths (dump, load, import, recursive removal, ...).
+ * Every span fires a USDT probe (provider fs, probes span_begin and span_end with
+ * the span name as argument) if <sys/sdt.h> is available, so perf and bpftrace can
+ * attach to a running binary. The probes are single nops while nobody listens.
+ * While fs_spans_start is active, finished spans are also put into a ring buffer of
+ * the thread that ran them and a background thread writes them out as Chrome
+ * trace-event JSON (chrome://tracing, Perfetto). Spans that don't fit into a full
+ * ring are dropped and counted. Otherwise a span costs a flag check.
+ */
+
+#if !defined(NO_USDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define SPAN_PROBE(probe, name) DTRACE_PROBE1(fs, probe, name)
+#endif
+#endif
+#ifndef SPAN_PROBE
+#define SPAN_PROBE(probe, name)
+#endif
+
+#define SPAN_RING_SIZE 4096 //spans per thread that wait for the writer
+#define SPAN_FLUSH_MS 100 //interval of the writer
+
+typedef struct _span{
+	const char* name; //must be a string literal, only the pointer is kept
+	uint64_t start; //0 if the span isn't recorded
+} span;
+
+extern int spans_on;
+
+/*
+ * Starts writing spans to json_path, which is overwritten
+ * @return 0 on success, -1 if the file can't be opened
+ */
+int fs_spans_start(const char* json_path);
+
+/*
+ * Writes the remaining spans, finishes the JSON document and closes the file
+ */
+void fs_spans_stop(void);
+
+void span_record(const span* s, uint64_t end);
+
+static inline uint64_t span_now(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static inline void span_begin(span* s, const char* name){
+	SPAN_PROBE(span_begin, name);
+	s->name = name;
+	s->start = __atomic_load_n(&spans_on, __ATOMIC_RELAXED) ? span_now() : 0;
+}
+
+static inline void span_end(span* s){
+	SPAN_PROBE(span_end, s->name);
+	if(s->start != 0){
+		span_record(s, span_now());
+	}
+}
+
+#endif //SPAN_H
@@ -0,0 +1,133 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+#include <time.h>
+
+/*
+ * Counters and latency histograms of the filesystem operations.
+ * Every thread records into its own shard, so recording takes no lock and no
+ * atomic read-modify-write; fs_stats_snapshot sums the shards up. The statistics
+ * are process wide, not per filesystem.
+ * Recording is off until fs_stats_enable(1) is called, then an operation only costs
+ * a flag check. Building with -D NO_STATS removes the recording completely.
+ */
+
+#define STATS_SUB_BITS 4 //histogram buckets per power of two are 2^STATS_SUB_BITS, values are kept to ~6%
+#define STATS_MAX_EXPONENT 40 //values from 2^41 on (about 36 minutes in ns) go into the last bucket
+#define STATS_BUCKETS ((STATS_MAX_EXPONENT - STATS_SUB_BITS + 2) << STATS_SUB_BITS)
+
+enum stats_hist{
+	stats_mkdir, //latencies of the operations in ns
+	stats_mkfile,
+	stats_list,
+	stats_writef,
+	stats_readf,
+	stats_rm,
+	stats_stat,
+	stats_dump,
+	stats_walk_depth, //path components per path walk
+	STATS_HISTOGRAMS
+};
+
+enum stats_counter{
+	stats_bytes_written,
+	stats_bytes_read,
+	stats_blocks_allocated,
+	stats_blocks_freed,
+	STATS_COUNTERS
+};
+
+typedef struct _stats_histogram{
+	uint64_t count;
+	uint64_t sum;
+	uint64_t max;
+	uint64_t buckets[STATS_BUCKETS]; //log-linear: exact below 2^STATS_SUB_BITS, then 2^STATS_SUB_BITS per power of two
+} stats_histogram;
+
+typedef struct _fs_stats{
+	stats_histogram hist[STATS_HISTOGRAMS];
+	uint64_t counters[STATS_COUNTERS];
+} fs_stats;
+
+extern int stats_on;
+
+/*
+ * turns recording on or off
+ */
+void fs_stats_enable(int enabled);
+
+/*
+ * Sums the shards of all threads up into *out. Operations running meanwhile may or may
+ * not be included.
+ */
+void fs_stats_snapshot(fs_stats* out);
+
+/*
+ * clears all histograms and counters
+ */
+void fs_stats_reset(void);
+
+/*
+ * @return the value below which the fraction p (0 to 1) of the recorded values lie,
+ * rounded up to the end of its bucket. 0 for an empty histogram
+ */
+uint64_t fs_stats_percentile(const stats_histogram* h, double p);
+
+/*
+ * adds value to a histogram that only the calling thread uses, e.g. one of a private report
+ */
+void stats_histogram_add(stats_histogram* h, uint64_t value);
+
+/*
+ * Formats a snapshot as text, one `name key=value ...` line per histogram and counter.
+ * @return a string that has to be freed by the caller
+ */
+char* fs_stats_format(void);
+
+void stats_record(enum stats_hist hist, uint64_t value);
+void stats_count(enum stats_counter counter, uint64_t n);
+
+#ifndef NO_STATS
+
+static inline uint64_t stats_start(void){
+	if(!__atomic_load_n(&stats_on, __ATOMIC_RELAXED)){
+		return 0;
+	}
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+//records the time since start, which was returned by stats_start
+static inline void stats_finish(enum stats_hist hist, uint64_t start){
+	if(start == 0){
+		return; //recording was off when the operation started
+	}
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	stats_record(hist, (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec - start);
+}
+
+static inline void stats_value(enum stats_hist hist, uint64_t value){
+	if(__atomic_load_n(&stats_on, __ATOMIC_RELAXED)){
+		stats_record(hist, value);
+	}
+}
+
+static inline void stats_add(enum stats_counter counter, uint64_t n){
+	if(__atomic_load_n(&stats_on, __ATOMIC_RELAXED)){
+		stats_count(counter, n);
+	}
+}
+
+#else
+
+static inline uint64_t stats_start(void){ return 0; }
+static inline void stats_finish(enum stats_hist hist, uint64_t start){}
+static inline void stats_value(enum stats_hist hist, uint64_t value){}
+static inline void stats_add(enum stats_counter counter, uint64_t n){}
+
+#endif //NO_STATS
+
+#endif //STATS_H
@@ -0,0 +1,31 @@
+#ifndef SWEEPER_H
+#define SWEEPER_H
+
+#include "../lib/filesystem.h"
+
+/*
+ * Starts background reclamation for fs. While it runs, fs_rm only detaches
+ * the removed inode from its parent and returns; the inodes and data blocks
+ * of the subtree are freed by a pool of sweeper threads, directories in
+ * parallel, with the free list updated once per file.
+ * @param int num_threads sweeper threads, 0 for one per online cpu
+ * @return 0 on success, -1 if no thread could be started
+ */
+int fs_sweeper_start(file_system* fs, int num_threads);
+
+/*
+ * Hands a detached inode and everything below it to the sweeper
+ */
+void fs_sweeper_submit(file_system* fs, int inode_num);
+
+/*
+ * Waits until every submitted subtree has been reclaimed. Does nothing if no sweeper runs.
+ */
+void fs_sweeper_drain(file_system* fs);
+
+/*
+ * Drains and stops the sweeper, fs_rm reclaims synchronously again afterwards
+ */
+void fs_sweeper_stop(file_system* fs);
+
+#endif //SWEEPER_H
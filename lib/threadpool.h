@@ -0,0 +1,42 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+typedef void (*task_fn)(void* arg);
+
+typedef struct _threadpool threadpool;
+
+/*
+ * Starts a pool of worker threads. Every worker has its own task queue;
+ * tasks submitted by a worker go to its own queue and idle workers steal
+ * from the queues of the others.
+ * @param int num_threads number of workers, 0 for one per online cpu
+ * @return the pool or NULL if no thread could be started
+ */
+threadpool* threadpool_create(int num_threads);
+
+/*
+ * Queues fn(arg). Can be called from inside a task.
+ */
+void threadpool_submit(threadpool* pool, task_fn fn, void* arg);
+
+/*
+ * Blocks until every submitted task, including the ones they submitted, has finished
+ */
+void threadpool_wait(threadpool* pool);
+
+/*
+ * @return the number of workers in the pool
+ */
+int threadpool_size(threadpool* pool);
+
+/*
+ * @return index of the worker running the calling task, -1 outside of a pool
+ */
+int threadpool_worker_id(void);
+
+/*
+ * Waits for all tasks and stops the workers
+ */
+void threadpool_destroy(threadpool* pool);
+
+#endif //THREADPOOL_H
@@ -0,0 +1,108 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../lib/filesystem.h"
+#include "../lib/stats.h"
+
+/*
+ * Recording and replay of the operations of lib/operations.h.
+ * While a trace is recorded every call is appended to the trace file as one tab
+ * separated line:
+ *	start_ns op duration_ns result size path arg
+ * start_ns counts from the start of the recording, size is the length of the text
+ * written or read (0 for the other operations) and arg is the external path of import
+ * and export. Lines starting with # are comments. Calls made by other operations
+ * (e.g. the fs_writef of fs_import) are not recorded on their own.
+ * The contents of writes aren't recorded, a replay writes as many placeholder bytes.
+ */
+
+enum trace_op{
+	trace_mkdir,
+	trace_mkfile,
+	trace_list,
+	trace_writef,
+	trace_readf,
+	trace_rm,
+	trace_import,
+	trace_export,
+	trace_stat,
+	TRACE_OPS
+};
+
+typedef struct _trace_report{
+	uint64_t ops; //replayed operations
+	uint64_t mismatches; //operations whose result differs from the recorded one
+	uint64_t skipped; //lines that couldn't be parsed
+	uint64_t duration_ns;
+	stats_histogram latency[TRACE_OPS]; //ns per operation
+} trace_report;
+
+/*
+ * Starts recording into the file at trace_path, which is overwritten
+ * @return 0 on success, -1 if the file can't be opened
+ */
+int fs_trace_start(const char* trace_path);
+
+/*
+ * stops the recording and closes the trace file
+ */
+void fs_trace_stop(void);
+
+/*
+ * Runs the operations of a trace against fs, in the order they started.
+ * @param speed 1 keeps the recorded pace, 2 replays twice as fast, 0 runs the operations back to back
+ * @return 0 on success, -1 if the trace can't be opened
+ */
+int fs_trace_replay(file_system* fs, const char* trace_path, double speed, trace_report* report);
+
+/*
+ * Formats a report, one `op count=... mean=... p50=... p99=... max=...` line per operation
+ * that was replayed and a summary line.
+ * @return a string that has to be freed by the caller
+ */
+char* fs_trace_format(const trace_report* report);
+
+/* Hooks of the operations */
+
+typedef struct _trace_call{
+	uint64_t start;
+	char* path; //copy of the path argument, the operations cut it up. NULL if the call isn't recorded
+	int counted; //the call is counted in trace_depth
+} trace_call;
+
+extern int trace_on;
+extern __thread int trace_depth;
+
+void trace_record(trace_call* call, enum trace_op op, const char* arg, int64_t size, int64_t result);
+
+static inline void trace_begin(trace_call* call, const char* path){
+	call->path = NULL;
+	call->counted = 0;
+	if(!__atomic_load_n(&trace_on, __ATOMIC_RELAXED)){
+		return;
+	}
+	call->counted = 1;
+	if(trace_depth++ > 0 || path == NULL){
+		return; //called by another operation, that one is recorded
+	}
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	call->start = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+	call->path = strdup(path);
+}
+
+static inline void trace_end(trace_call* call, enum trace_op op, const char* arg, int64_t size, int64_t result){
+	if(call->counted){
+		trace_depth--;
+	}
+	if(call->path != NULL){
+		trace_record(call, op, arg, size, result);
+	}
+}
+
+#endif //TRACE_H
@@ -0,0 +1,248 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../lib/alloc.h"
+#include "../lib/delta.h"
+#include "../lib/filesystem.h"
+#include "../lib/operations.h"
+#include "../lib/stats.h"
+
+struct _alloc_group{
+	pthread_mutex_t lock;
+	uint32_t begin;
+	uint32_t end;
+	uint32_t cursor; //all blocks in [begin, cursor) are used, moved back when one of them is freed
+	uint32_t inode_cursor; //where the search for a free inode starts, only a hint: read and moved without the lock
+	uint32_t free; //free blocks in the group, read without the lock to skip full groups
+};
+
+static uint32_t count_free(file_system* fs, struct _alloc_group* g){
+	uint32_t count = 0;
+	for (uint32_t b=g->begin; b<g->end; b++) {
+		count += fs->free_list[b] != 0;
+	}
+	return count;
+}
+
+void fs_groups_init(file_system* fs){
+	uint32_t n = fs->s_block->num_blocks;
+	fs_groups_free(fs);
+
+	fs->num_groups = (n + GROUP_BLOCKS - 1) / GROUP_BLOCKS;
+	fs->groups = calloc(fs->num_groups, sizeof(struct _alloc_group));
+	if(fs->groups == NULL && fs->num_groups > 0){
+		exit(1);
+	}
+	for (uint32_t i=0; i<fs->num_groups; i++) {
+		struct _alloc_group* g = &fs->groups[i];
+		pthread_mutex_init(&g->lock, NULL);
+		g->begin = i * GROUP_BLOCKS;
+		g->end = MIN(g->begin + GROUP_BLOCKS, n);
+		g->cursor = g->begin;
+		g->inode_cursor = g->begin;
+		g->free = count_free(fs, g);
+	}
+}
+
+void fs_groups_free(file_system* fs){
+	if(fs->groups == NULL){
+		return;
+	}
+	for (uint32_t i=0; i<fs->num_groups; i++) {
+		pthread_mutex_destroy(&fs->groups[i].lock);
+	}
+	free(fs->groups);
+	fs->groups = NULL;
+	fs->num_groups = 0;
+}
+
+int fs_group_of(int num){
+	return num / GROUP_BLOCKS;
+}
+
+//takes the first free block from the cursor on, the group lock is held
+static int take_block(file_system* fs, struct _alloc_group* g){
+	uint32_t size = g->end - g->begin;
+	for (uint32_t k=0; k<size; k++) {
+		uint32_t b = g->begin + (g->cursor - g->begin + k) % size;
+		if(fs->free_list[b]){
+			fs->free_list[b] = 0;
+			//handed out empty, nothing of the previous file survives behind the new size
+			memset(&fs->data_blocks[b], 0, sizeof(data_block));
+			fs->verified[b] = 1;
+			g->cursor = b + 1;
+			if(g->free > 0){
+				__atomic_fetch_sub(&g->free, 1, __ATOMIC_RELAXED);
+			}
+			return b;
+		}
+	}
+	//the free count was stale, e.g. the free list was written directly
+	__atomic_store_n(&g->free, 0, __ATOMIC_RELAXED);
+	return -1;
+}
+
+int alloc_block_near(file_system* fs, int goal){
+	uint32_t num_groups = fs->num_groups;
+	if(num_groups == 0){
+		return -1;
+	}
+	uint32_t first = goal < 0 ? 0 : MIN((uint32_t)fs_group_of(goal), num_groups - 1);
+
+	//pass 0 skips groups that are full or locked by another thread, pass 1 waits
+	//for the lock and pass 2 recounts the groups in case a free count went stale
+	for (int pass=0; pass<3; pass++) {
+		for (uint32_t k=0; k<num_groups; k++) {
+			struct _alloc_group* g = &fs->groups[(first + k) % num_groups];
+			if(pass < 2 && __atomic_load_n(&g->free, __ATOMIC_RELAXED) == 0){
+				continue;
+			}
+			if(pass == 0){
+				if(pthread_mutex_trylock(&g->lock) != 0){
+					continue;
+				}
+			}else{
+				pthread_mutex_lock(&g->lock);
+			}
+			if(pass == 2){
+				__atomic_store_n(&g->free, count_free(fs, g), __ATOMIC_RELAXED);
+				g->cursor = g->begin;
+			}
+			int b = take_block(fs, g);
+			pthread_mutex_unlock(&g->lock);
+			if(b != -1){
+				stats_add(stats_blocks_allocated, 1);
+				return b;
+			}
+		}
+	}
+	return -1;
+}
+
+void release_blocks(file_system* fs, const int* blocks, int count){
+	struct _alloc_group* locked = NULL;
+	uint32_t released = 0;
+
+	//freed blocks usually come in runs from the same group, its lock is kept across them
+	for (int i=0; i<count; i++) {
+		uint32_t b = blocks[i];
+		struct _alloc_group* g = &fs->groups[fs_group_of(b)];
+		if(g != locked){
+			if(locked != NULL){
+				pthread_mutex_unlock(&locked->lock);
+			}
+			pthread_mutex_lock(&g->lock);
+			locked = g;
+		}
+		if(fs->free_list[b]){
+			continue;
+		}
+		__atomic_store_n(&fs->free_list[b], 1, __ATOMIC_RELEASE);
+		__atomic_fetch_add(&g->free, 1, __ATOMIC_RELAXED);
+		g->cursor = MIN(g->cursor, b);
+		released++;
+	}
+	if(locked != NULL){
+		pthread_mutex_unlock(&locked->lock);
+	}
+	stats_add(stats_blocks_freed, released);
+}
+
+int swap_blocks(file_system* fs, int a, int b, int b_free){
+	struct _alloc_group* ga = &fs->groups[fs_group_of(a)];
+	struct _alloc_group* gb = &fs->groups[fs_group_of(b)];
+	//two group locks are taken in group order
+	struct _alloc_group* first = ga < gb ? ga : gb;
+	struct _alloc_group* second = ga < gb ? gb : ga;
+	pthread_mutex_lock(&first->lock);
+	if(second != first){
+		pthread_mutex_lock(&second->lock);
+	}
+	int result = -1;
+	if(!fs->free_list[a] && fs->free_list[b] == b_free){
+		data_block tmp = fs->data_blocks[a];
+		fs->data_blocks[a] = fs->data_blocks[b];
+		fs->data_blocks[b] = tmp;
+
+		uint32_t crc = fs->block_crc[a];
+		fs->block_crc[a] = fs->block_crc[b];
+		fs->block_crc[b] = crc;
+
+		uint8_t verified = fs->verified[a];
+		fs->verified[a] = fs->verified[b];
+		fs->verified[b] = verified;
+
+		if(b_free){
+			__atomic_store_n(&fs->free_list[a], 1, __ATOMIC_RELEASE);
+			__atomic_store_n(&fs->free_list[b], 0, __ATOMIC_RELEASE);
+			__atomic_fetch_add(&ga->free, 1, __ATOMIC_RELAXED);
+			__atomic_fetch_sub(&gb->free, 1, __ATOMIC_RELAXED);
+			ga->cursor = MIN(ga->cursor, (uint32_t)a);
+		}
+		delta_mark_block(fs, a);
+		delta_mark_block(fs, b);
+		result = 0;
+	}
+	if(second != first){
+		pthread_mutex_unlock(&second->lock);
+	}
+	pthread_mutex_unlock(&first->lock);
+	return result;
+}
+
+uint32_t fs_free_blocks(file_system* fs){
+	uint32_t count = 0;
+	for (uint32_t i=0; i<fs->num_groups; i++) {
+		count += __atomic_load_n(&fs->groups[i].free, __ATOMIC_RELAXED);
+	}
+	fs->s_block->free_blocks = count;
+	return count;
+}
+
+int find_free_inode_near(file_system* fs, int parent_num, enum node_type type){
+	uint32_t num_groups = fs->num_groups;
+	if(num_groups == 0){
+		return -1;
+	}
+	uint32_t first = MIN((uint32_t)fs_group_of(parent_num), num_groups - 1);
+
+	//top level directories start new subtrees, they go to the group with the most room
+	if(type == directory && parent_num == fs->root_node){
+		uint32_t most_free = __atomic_load_n(&fs->groups[first].free, __ATOMIC_RELAXED);
+		for (uint32_t i=0; i<num_groups; i++) {
+			uint32_t group_free = __atomic_load_n(&fs->groups[i].free, __ATOMIC_RELAXED);
+			if(group_free > most_free){
+				most_free = group_free;
+				first = i;
+			}
+		}
+	}
+
+	//like blocks, the search starts at the cursor of the group and wraps around, so
+	//consecutive creates don't rescan the inodes they just took
+	for (uint32_t k=0; k<num_groups; k++) {
+		struct _alloc_group* g = &fs->groups[(first + k) % num_groups];
+		uint32_t size = g->end - g->begin;
+		uint32_t cursor = __atomic_load_n(&g->inode_cursor, __ATOMIC_RELAXED);
+		for (uint32_t j=0; j<size; j++) {
+			uint32_t i = g->begin + (cursor - g->begin + j) % size;
+			//the sweeper publishes freed inodes with a release store
+			if(__atomic_load_n(&fs->inodes[i].n_type, __ATOMIC_ACQUIRE) == free_block){
+				__atomic_store_n(&g->inode_cursor, i + 1 < g->end ? i + 1 : g->begin, __ATOMIC_RELAXED);
+				return i;
+			}
+		}
+	}
+	return -1;
+}
+
+void inode_freed(file_system* fs, int inode_num){
+	if(fs->groups == NULL || (uint32_t)fs_group_of(inode_num) >= fs->num_groups){
+		return;
+	}
+	struct _alloc_group* g = &fs->groups[fs_group_of(inode_num)];
+	uint32_t cursor = __atomic_load_n(&g->inode_cursor, __ATOMIC_RELAXED);
+	while((uint32_t)inode_num < cursor &&
+	      !__atomic_compare_exchange_n(&g->inode_cursor, &cursor, inode_num, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
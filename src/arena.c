@@ -0,0 +1,54 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../lib/arena.h"
+
+#define ARENA_ALIGN 16
+
+struct _arena_chunk{
+	arena_chunk* next;
+	size_t padding; //keeps data aligned
+	uint8_t data[];
+};
+
+void arena_init(arena* a, void* buf, size_t size){
+	a->buf = buf;
+	a->size = size;
+	a->used = 0;
+	a->chunks = NULL;
+}
+
+void* arena_alloc(arena* a, size_t n){
+	uintptr_t next = (uintptr_t)(a->buf + a->used);
+	size_t start = a->used + ((ARENA_ALIGN - next % ARENA_ALIGN) % ARENA_ALIGN);
+	if(start + n > a->size){
+		//the rest of the current buffer is given up, the next chunk is at least as big
+		size_t size = n > a->size ? n : a->size;
+		arena_chunk* chunk = malloc(sizeof(arena_chunk) + size);
+		if(chunk == NULL){
+			exit(1);
+		}
+		chunk->next = a->chunks;
+		a->chunks = chunk;
+		a->buf = chunk->data;
+		a->size = size;
+		start = 0;
+	}
+	a->used = start + n;
+	return a->buf + start;
+}
+
+char* arena_strdup(arena* a, const char* s){
+	size_t len = strlen(s) + 1;
+	char* copy = arena_alloc(a, len);
+	memcpy(copy, s, len);
+	return copy;
+}
+
+void arena_release(arena* a){
+	while(a->chunks != NULL){
+		arena_chunk* next = a->chunks->next;
+		free(a->chunks);
+		a->chunks = next;
+	}
+}
@@ -0,0 +1,144 @@
+#include "../lib/batch.h"
+#include "../lib/epoch.h"
+#include "../lib/operations.h"
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct _batch_entry {
+    fs_op* op;
+    size_t index;      // Position in the caller's array, keeps the order within a directory
+    size_t parent_len; // Length of the parent path, the name starts after the following '/'
+} batch_entry;
+
+/* ***** ***** ***** *****  HELPER  ***** ***** ***** ***** */
+// Orders entries by parent path, then by their original position
+static int
+compare_entries(const void* a, const void* b) {
+    const batch_entry* x = a;
+    const batch_entry* y = b;
+    int cmp = memcmp(x->op->path, y->op->path, MIN(x->parent_len, y->parent_len));
+    if (cmp != 0) {
+        return cmp;
+    }
+    if (x->parent_len != y->parent_len) {
+        return x->parent_len < y->parent_len ? -1 : 1;
+    }
+    return x->index < y->index ? -1 : 1;
+}
+
+static int
+same_parent(const batch_entry* x, const batch_entry* y) {
+    return x->parent_len == y->parent_len && memcmp(x->op->path, y->op->path, x->parent_len) == 0;
+}
+
+// Applies one operation to the already resolved parent directory, inside a read side section
+static int
+apply_op(file_system* fs, fs_op* op, int dir, const char* name) {
+    if (dir == -1 || name[0] == '\0') {
+        return -1;
+    }
+
+    int inode_num;
+    switch (op->type) {
+    case op_mkdir:
+        return create_inode(fs, dir, name, directory) < 0 ? -1 : 0;
+    case op_mkfile:
+        inode_num = create_inode(fs, dir, name, reg_file);
+        return inode_num < 0 ? inode_num : 0;
+    case op_write:
+        inode_num = lookup_child(fs, dir, name, reg_file);
+        if (inode_num == -1 || op->text == NULL) {
+            return -1;
+        }
+        return append_inode(fs, inode_num, op->text, strlen(op->text));
+    case op_rm:
+        inode_num = lookup_child(fs, dir, name, 0);
+        if (inode_num == -1) {
+            return -1;
+        }
+        if (!remove_inode_from_parent_directory(fs, dir, inode_num)) {
+            return -1;
+        }
+        // Freed outside the read side section, so later operations of the batch can reuse
+        // the inode and its blocks. The caller resolves the directory again afterwards.
+        fs_epoch_exit(fs);
+        remove_inode(fs, inode_num);
+        fs_epoch_enter(fs);
+        return 0;
+    }
+    return -1;
+}
+
+/**********************************************************************************************************************************************/
+
+/* ***** ***** ***** *****  OPERATIONS  ***** ***** ***** ***** */
+int
+fs_batch(file_system* fs, fs_op* ops, size_t count) {
+    batch_entry* entries = malloc(count * sizeof(batch_entry));
+    if (entries == NULL) {
+        return -1;
+    }
+
+    // Split every path into parent and name, invalid paths fail right away
+    size_t valid = 0;
+    size_t max_parent_len = 0;
+    int failed = 0;
+    for (size_t i = 0; i < count; i++) {
+        const char* last_slash = ops[i].path != NULL ? strrchr(ops[i].path, '/') : NULL;
+        if (last_slash == NULL || ops[i].path[0] != '/') {
+            ops[i].result = -1;
+            failed++;
+            continue;
+        }
+        entries[valid].op = &ops[i];
+        entries[valid].index = i;
+        entries[valid].parent_len = last_slash - ops[i].path;
+        max_parent_len = MAX(max_parent_len, entries[valid].parent_len);
+        valid++;
+    }
+    qsort(entries, valid, sizeof(batch_entry), compare_entries);
+
+    char* parent_path = malloc(max_parent_len + 1);
+    if (parent_path == NULL) {
+        free(entries);
+        return -1;
+    }
+
+    int dir = -1;
+    for (size_t i = 0; i < valid; i++) {
+        batch_entry* entry = &entries[i];
+        int new_group = i == 0 || !same_parent(entry, &entries[i - 1]);
+        if (new_group) {
+            // Each group is one read side section, like fs_writef: the directory and the
+            // inodes and blocks found in it are not reused while the group is applied
+            if (i > 0) {
+                fs_epoch_exit(fs);
+            }
+            fs_epoch_enter(fs);
+        }
+        if (new_group || (entries[i - 1].op->type == op_rm && entries[i - 1].op->result == 0)) {
+            // Resolve the parent directory once per group and after an rm left the section
+            if (entry->parent_len == 0) {
+                dir = fs->root_node;
+            } else {
+                memcpy(parent_path, entry->op->path, entry->parent_len);
+                parent_path[entry->parent_len] = '\0';
+                dir = find_parent_directory(fs, parent_path);
+            }
+        }
+
+        const char* name = entry->op->path + entry->parent_len + 1;
+        entry->op->result = apply_op(fs, entry->op, dir, name);
+        if (entry->op->result < 0) {
+            failed++;
+        }
+    }
+    if (valid > 0) {
+        fs_epoch_exit(fs);
+    }
+
+    free(parent_path);
+    free(entries);
+    return failed;
+}
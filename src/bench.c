@@ -0,0 +1,324 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../lib/alloc.h"
+#include "../lib/filesystem.h"
+#include "../lib/operations.h"
+#include "../lib/sweeper.h"
+
+/*
+ * Microbenchmarks of the filesystem operations. Every result is printed as one JSON
+ * object per line: {"bench": name, "param": value the benchmark was run with,
+ * "value": measurement, "unit": unit of the measurement}
+ * Usage: bench [--quick] [name...]
+ *	--quick runs small sizes only (a smoke test), names select benchmarks
+ */
+
+#define FANOUT DIRECT_BLOCKS_COUNT //entries per directory, a directory can't hold more
+#define MAX_PATH 1024
+
+typedef struct _bench_config{
+	int quick;
+	const char* image; //scratch image, removed at the end
+} bench_config;
+
+static uint64_t now_ns(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void report(const char* bench, const char* param, double value, const char* unit){
+	printf("{\"bench\": \"%s\", \"param\": \"%s\", \"value\": %.3f, \"unit\": \"%s\"}\n", bench, param, value, unit);
+	fflush(stdout);
+}
+
+static int power(int base, int exponent){
+	int result = 1;
+	for (int i=0; i<exponent; i++) {
+		result *= base;
+	}
+	return result;
+}
+
+//path of entry index in a tree with FANOUT entries per directory, cut after level components
+static void tree_path(char* buf, int index, int depth, int level){
+	int len = 0;
+	for (int l=0; l<level; l++) {
+		int digit = index / power(FANOUT, depth - 1 - l) % FANOUT;
+		len += snprintf(buf + len, MAX_PATH - len, "/%c%d", l == depth - 1 ? 'f' : 'd', digit);
+	}
+}
+
+//runs op on a copy of path, the operations cut their path argument up
+static int with_path(int (*op)(file_system*, char*), file_system* fs, const char* path){
+	char buf[MAX_PATH];
+	strcpy(buf, path);
+	return op(fs, buf);
+}
+
+//creates the directories of a full tree of depth levels, the leaves are left out
+static void make_dirs(file_system* fs, int depth){
+	char path[MAX_PATH];
+	for (int level=1; level<depth; level++) {
+		int count = power(FANOUT, level);
+		for (int i=0; i<count; i++) {
+			tree_path(path, i * power(FANOUT, depth - level), depth, level);
+			with_path(fs_mkdir, fs, path);
+		}
+	}
+}
+
+static file_system* fresh_fs(const bench_config* cfg, uint32_t size){
+	file_system* fs = fs_create(cfg->image, size);
+	if(fs == NULL){
+		fprintf(stderr, "Could not create %s\n", cfg->image);
+		exit(1);
+	}
+	return fs;
+}
+
+//mkdir and mkfile rates while building a full tree
+static void bench_create(const bench_config* cfg){
+	int depth = cfg->quick ? 2 : 4;
+	int leaves = power(FANOUT, depth);
+	file_system* fs = fresh_fs(cfg, leaves * 2);
+	char param[64];
+	snprintf(param, sizeof(param), "depth=%d", depth);
+
+	uint64_t start = now_ns();
+	make_dirs(fs, depth);
+	uint64_t dirs_done = now_ns();
+	char path[MAX_PATH];
+	for (int i=0; i<leaves; i++) {
+		tree_path(path, i, depth, depth);
+		with_path(fs_mkfile, fs, path);
+	}
+	uint64_t files_done = now_ns();
+
+	int dirs = (leaves - 1) / (FANOUT - 1) - 1;
+	report("mkdir", param, dirs / ((dirs_done - start) / 1e9), "ops/s");
+	report("mkfile", param, leaves / ((files_done - dirs_done) / 1e9), "ops/s");
+	cleanup(fs);
+}
+
+//fs_stat of a path at varying depth, and of the first and last entry of a full directory
+static void bench_lookup(const bench_config* cfg){
+	int iterations = cfg->quick ? 1000 : 200000;
+	file_system* fs = fresh_fs(cfg, 256);
+	char path[MAX_PATH] = "";
+	int depths[] = {1, 4, 16, 64};
+	int made = 0;
+	inode info;
+	char buf[MAX_PATH];
+	char param[64];
+
+	for (int d=0; d<4; d++) {
+		for (; made<depths[d]; made++) {
+			strcat(path, "/d");
+			with_path(fs_mkdir, fs, path);
+		}
+		uint64_t start = now_ns();
+		for (int i=0; i<iterations; i++) {
+			strcpy(buf, path);
+			fs_stat(fs, buf, &info);
+		}
+		snprintf(param, sizeof(param), "depth=%d", depths[d]);
+		report("lookup_depth", param, (double)(now_ns() - start) / iterations, "ns/op");
+	}
+
+	for (int i=0; i<FANOUT - 1; i++) {
+		snprintf(path, sizeof(path), "/e%d", i);
+		with_path(fs_mkfile, fs, path);
+	}
+	int positions[] = {0, FANOUT - 2};
+	for (int p=0; p<2; p++) {
+		snprintf(path, sizeof(path), "/e%d", positions[p]);
+		uint64_t start = now_ns();
+		for (int i=0; i<iterations; i++) {
+			strcpy(buf, path);
+			fs_stat(fs, buf, &info);
+		}
+		snprintf(param, sizeof(param), "fanout=%d,entry=%d", FANOUT, positions[p] + 1);
+		report("lookup_fanout", param, (double)(now_ns() - start) / iterations, "ns/op");
+	}
+	cleanup(fs);
+}
+
+//writef of one block per call until the files are full, then readf of the whole files
+static void bench_append_read(const bench_config* cfg){
+	int depth = cfg->quick ? 2 : 3;
+	int files = power(FANOUT, depth);
+	file_system* fs = fresh_fs(cfg, files * (DIRECT_BLOCKS_COUNT + 2));
+	make_dirs(fs, depth);
+	char text[BLOCK_SIZE + 1];
+	memset(text, 'x', BLOCK_SIZE);
+	text[BLOCK_SIZE] = '\0';
+	char path[MAX_PATH];
+	char buf[MAX_PATH];
+	char param[64];
+	snprintf(param, sizeof(param), "files=%d,chunk=%d", files, BLOCK_SIZE);
+
+	for (int i=0; i<files; i++) {
+		tree_path(path, i, depth, depth);
+		with_path(fs_mkfile, fs, path);
+	}
+	uint64_t start = now_ns();
+	for (int c=0; c<DIRECT_BLOCKS_COUNT; c++) {
+		for (int i=0; i<files; i++) {
+			tree_path(buf, i, depth, depth);
+			fs_writef(fs, buf, text);
+		}
+	}
+	double seconds = (now_ns() - start) / 1e9;
+	double megabytes = (double)files * DIRECT_BLOCKS_COUNT * BLOCK_SIZE / (1024 * 1024);
+	report("append", param, megabytes / seconds, "MB/s");
+
+	start = now_ns();
+	for (int i=0; i<files; i++) {
+		int size = 0;
+		tree_path(buf, i, depth, depth);
+		free(fs_readf(fs, buf, &size));
+	}
+	report("read", param, megabytes / ((now_ns() - start) / 1e9), "MB/s");
+	cleanup(fs);
+}
+
+//rm of every top level directory of a full tree, in the foreground and with the sweeper
+static void bench_rm(const bench_config* cfg){
+	int depth = cfg->quick ? 2 : 4;
+	int leaves = power(FANOUT, depth);
+	char path[MAX_PATH];
+	char param[64];
+
+	for (int sweeper=0; sweeper<2; sweeper++) {
+		file_system* fs = fresh_fs(cfg, leaves * 2);
+		make_dirs(fs, depth);
+		for (int i=0; i<leaves; i++) {
+			tree_path(path, i, depth, depth);
+			with_path(fs_mkfile, fs, path);
+		}
+		if(sweeper){
+			fs_sweeper_start(fs, 0);
+		}
+		uint64_t start = now_ns();
+		for (int i=0; i<FANOUT; i++) {
+			snprintf(path, sizeof(path), "/d%d", i);
+			with_path(fs_rm, fs, path);
+		}
+		uint64_t detached = now_ns();
+		if(sweeper){
+			fs_sweeper_drain(fs);
+		}
+		uint64_t done = now_ns();
+
+		snprintf(param, sizeof(param), "depth=%d,inodes=%d,sweeper=%d", depth, leaves + (leaves - 1) / (FANOUT - 1) - 1, sweeper);
+		report("rm_tree", param, (detached - start) / 1e6, "ms");
+		if(sweeper){
+			report("rm_tree_reclaim", param, (done - start) / 1e6, "ms");
+		}
+		cleanup(fs);
+	}
+}
+
+//dump, load and checksum verification of images of growing size, half of the blocks hold data
+static void bench_image(const bench_config* cfg){
+	uint32_t full_sizes[] = {4096, 32768, 131072};
+	uint32_t quick_sizes[] = {1024, 4096};
+	uint32_t* sizes = cfg->quick ? quick_sizes : full_sizes;
+	int num_sizes = cfg->quick ? 2 : 3;
+	int depth = 4;
+	char text[BLOCK_SIZE + 1];
+	memset(text, 'x', BLOCK_SIZE);
+	text[BLOCK_SIZE] = '\0';
+	char path[MAX_PATH];
+	char param[64];
+
+	for (int s=0; s<num_sizes; s++) {
+		file_system* fs = fresh_fs(cfg, sizes[s]);
+		int files = sizes[s] / 2 / DIRECT_BLOCKS_COUNT;
+		for (int i=0; i<files; i++) {
+			for (int level=1; level<depth; level++) {
+				tree_path(path, i, depth, level);
+				with_path(fs_mkdir, fs, path); //fails once the directory exists
+			}
+			tree_path(path, i, depth, depth);
+			with_path(fs_mkfile, fs, path);
+			for (int c=0; c<DIRECT_BLOCKS_COUNT; c++) {
+				tree_path(path, i, depth, depth);
+				fs_writef(fs, path, text);
+			}
+		}
+		snprintf(param, sizeof(param), "blocks=%u", sizes[s]);
+
+		uint64_t start = now_ns();
+		fs_dump(fs, cfg->image);
+		report("dump", param, (now_ns() - start) / 1e6, "ms");
+		cleanup(fs);
+
+		//single threaded for comparison, then with the default number of threads
+		start = now_ns();
+		fs = fs_load_threads(cfg->image, 1);
+		report("load_single", param, (now_ns() - start) / 1e6, "ms");
+		cleanup(fs);
+
+		start = now_ns();
+		fs = fs_load(cfg->image);
+		report("load", param, (now_ns() - start) / 1e6, "ms");
+
+		//the load already verified the blocks, they are checked once more for the throughput
+		uint32_t used = fs->s_block->num_blocks - fs_free_blocks(fs);
+		memset(fs->verified, 0, fs->s_block->num_blocks);
+		start = now_ns();
+		fs_verify(fs);
+		double megabytes = (double)used * sizeof(data_block) / (1024 * 1024);
+		report("verify", param, megabytes / ((now_ns() - start) / 1e9), "MB/s");
+		cleanup(fs);
+	}
+}
+
+typedef struct _benchmark{
+	const char* name;
+	void (*run)(const bench_config* cfg);
+} benchmark;
+
+static const benchmark benchmarks[] = {
+	{"create", bench_create},
+	{"lookup", bench_lookup},
+	{"append_read", bench_append_read},
+	{"rm", bench_rm},
+	{"image", bench_image},
+};
+
+int
+main(int argc, const char *argv[])
+{
+	bench_config cfg = {0, NULL};
+	char image[64];
+	const char *tmp = getenv("TMPDIR");
+	snprintf(image, sizeof(image), "%s/fsbench-%d.fs", tmp != NULL ? tmp : "/tmp", (int)getpid());
+	cfg.image = image;
+
+	int first_name = 1;
+	if (argc > 1 && strcmp(argv[1], "--quick") == 0) {
+		cfg.quick = 1;
+		first_name = 2;
+	}
+
+	int num_benchmarks = sizeof(benchmarks) / sizeof(benchmarks[0]);
+	for (int b = 0; b < num_benchmarks; b++) {
+		int selected = first_name == argc;
+		for (int i = first_name; i < argc; i++) {
+			selected |= strcmp(argv[i], benchmarks[b].name) == 0;
+		}
+		if (selected) {
+			benchmarks[b].run(&cfg);
+		}
+	}
+	unlink(image);
+	return 0;
+}
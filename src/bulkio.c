@@ -0,0 +1,362 @@
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include "../lib/alloc.h"
+#include "../lib/bulkio.h"
+#include "../lib/delta.h"
+#include "../lib/epoch.h"
+#include "../lib/filesystem.h"
+#include "../lib/operations.h"
+#include "../lib/span.h"
+#include "../lib/threadpool.h"
+
+typedef struct _import_ctx{
+	file_system* fs;
+	threadpool* pool;
+	int failed; //updated atomically
+} import_ctx;
+
+typedef struct _import_task{
+	import_ctx* ctx;
+	int dir; //directory inode to import into
+	char* name; //name of the new entry in dir
+	char* ext_path;
+} import_task;
+
+typedef struct _export_ctx{
+	file_system* fs;
+	threadpool* pool;
+	int failed; //updated atomically
+} export_ctx;
+
+typedef struct _export_task{
+	export_ctx* ctx;
+	int inode_num;
+	char* ext_path;
+} export_task;
+
+static void import_dir(void* arg);
+static void import_file(void* arg);
+static void export_dir(void* arg);
+static void export_file(void* arg);
+
+static void fail(import_ctx* ctx){
+	__atomic_fetch_add(&ctx->failed, 1, __ATOMIC_RELAXED);
+}
+
+static void submit(import_ctx* ctx, task_fn fn, int dir, const char* name, const char* ext_path){
+	import_task* task = malloc(sizeof(import_task));
+	if(task == NULL){
+		exit(1);
+	}
+	task->ctx = ctx;
+	task->dir = dir;
+	task->name = name != NULL ? strdup(name) : NULL;
+	task->ext_path = strdup(ext_path);
+	threadpool_submit(ctx->pool, fn, task);
+}
+
+static void free_task(import_task* task){
+	free(task->name);
+	free(task->ext_path);
+	free(task);
+}
+
+static void import_dir(void* arg){
+	import_task* task = arg;
+	import_ctx* ctx = task->ctx;
+
+	DIR* dir = opendir(task->ext_path);
+	if(dir == NULL){
+		fail(ctx);
+		free_task(task);
+		return;
+	}
+	size_t path_len = strlen(task->ext_path);
+	char* child_path = malloc(path_len + NAME_MAX + 2);
+	if(child_path == NULL){
+		exit(1);
+	}
+	memcpy(child_path, task->ext_path, path_len);
+	child_path[path_len] = '/';
+
+	struct dirent* entry;
+	while((entry = readdir(dir)) != NULL){
+		if(!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, "..")){
+			continue;
+		}
+		strcpy(child_path + path_len + 1, entry->d_name);
+		struct stat st;
+		if(lstat(child_path, &st) != 0){
+			fail(ctx);
+			continue;
+		}
+
+		if(S_ISDIR(st.st_mode)){
+			//directories are created right away, so the files below them have a parent
+			//an existing directory is merged into
+			int sub_dir = create_inode(ctx->fs, task->dir, entry->d_name, directory);
+			if(sub_dir == -2){
+				sub_dir = lookup_child(ctx->fs, task->dir, entry->d_name, directory);
+			}
+			if(sub_dir == -1){
+				fail(ctx);
+			}else{
+				submit(ctx, import_dir, sub_dir, NULL, child_path);
+			}
+		}else if(S_ISREG(st.st_mode)){
+			submit(ctx, import_file, task->dir, entry->d_name, child_path);
+		}
+	}
+
+	closedir(dir);
+	free(child_path);
+	free_task(task);
+}
+
+static void import_file(void* arg){
+	import_task* task = arg;
+	import_ctx* ctx = task->ctx;
+	file_system* fs = ctx->fs;
+	uint8_t buffer[MAX_FILE_SIZE];
+	int blocks[DIRECT_BLOCKS_COUNT];
+	int num_blocks = 0;
+	ssize_t size = 0;
+
+	//read the whole file, without holding any lock
+	int fd = open(task->ext_path, O_RDONLY);
+	if(fd == -1){
+		fail(ctx);
+		free_task(task);
+		return;
+	}
+	while(size < MAX_FILE_SIZE){
+		ssize_t r = read(fd, buffer + size, MAX_FILE_SIZE - size);
+		if(r <= 0){
+			break;
+		}
+		size += r;
+	}
+	//files that don't fit into the direct blocks are rejected
+	uint8_t extra;
+	int too_big = size == MAX_FILE_SIZE && read(fd, &extra, 1) == 1;
+	close(fd);
+	if(too_big || strlen(task->name) >= NAME_MAX_LENGTH){
+		fail(ctx);
+		free_task(task);
+		return;
+	}
+
+	//the blocks belong to this task alone, so they are filled before the inode exists.
+	//They are taken near the directory, the file inode goes to the same group.
+	for (ssize_t offset=0; offset<size; offset+=BLOCK_SIZE) {
+		int b = alloc_block_near(fs, task->dir);
+		if(b == -1){
+			break;
+		}
+		blocks[num_blocks++] = b;
+		data_block* block = &fs->data_blocks[b];
+		block->size = MIN(size - offset, BLOCK_SIZE);
+		memcpy(block->block, buffer + offset, block->size);
+		delta_mark_block(fs, b);
+	}
+
+	int file = -1;
+	if((ssize_t)num_blocks * BLOCK_SIZE >= size){
+		//an existing file is not overwritten
+		file = create_inode(fs, task->dir, task->name, reg_file);
+		if(file >= 0){
+			inode_write_begin(fs, file);
+			memcpy(fs->inodes[file].direct_blocks, blocks, num_blocks * sizeof(int));
+			fs->inodes[file].size = size;
+			inode_touch(fs, file, 1);
+			inode_write_end(fs, file);
+		}
+	}
+	if(file < 0){
+		release_blocks(fs, blocks, num_blocks);
+		fail(ctx);
+	}
+	free_task(task);
+}
+
+int fs_import_tree(file_system* fs, char* int_path, char* ext_path, int num_threads){
+	struct stat st;
+	if(stat(ext_path, &st) != 0 || !S_ISDIR(st.st_mode)){
+		return -1;
+	}
+	char* path = strdup(int_path);
+	int dir = find_parent_directory(fs, path);
+	free(path);
+	if(dir == -1){
+		return -1;
+	}
+
+	import_ctx ctx;
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.fs = fs;
+	ctx.pool = threadpool_create(num_threads);
+	if(ctx.pool == NULL){
+		return -1;
+	}
+
+	span s;
+	span_begin(&s, "fs_import_tree");
+	submit(&ctx, import_dir, dir, NULL, ext_path);
+	threadpool_wait(ctx.pool);
+	span_end(&s);
+	threadpool_destroy(ctx.pool);
+
+	return ctx.failed;
+}
+
+static void submit_export(export_ctx* ctx, task_fn fn, int inode_num, char* ext_path){
+	export_task* task = malloc(sizeof(export_task));
+	if(task == NULL){
+		exit(1);
+	}
+	task->ctx = ctx;
+	task->inode_num = inode_num;
+	task->ext_path = ext_path;
+	threadpool_submit(ctx->pool, fn, task);
+}
+
+//the filesystem is only read during an export, so the workers need no locks. The whole
+//export is one read side section of the calling thread, see fs_export_tree.
+static void export_dir(void* arg){
+	export_task* task = arg;
+	export_ctx* ctx = task->ctx;
+	inode* dir = &ctx->fs->inodes[task->inode_num];
+
+	if(mkdir(task->ext_path, 0755) != 0){
+		struct stat st;
+		if(stat(task->ext_path, &st) != 0 || !S_ISDIR(st.st_mode)){
+			__atomic_fetch_add(&ctx->failed, 1, __ATOMIC_RELAXED);
+			free(task->ext_path);
+			free(task);
+			return;
+		}
+	}
+
+	size_t path_len = strlen(task->ext_path);
+	for (int i=0; i<DIRECT_BLOCKS_COUNT; i++) {
+		int child = dir->direct_blocks[i];
+		if(child == -1){
+			continue;
+		}
+		inode* child_inode = &ctx->fs->inodes[child];
+		char* child_path = malloc(path_len + NAME_MAX_LENGTH + 2);
+		if(child_path == NULL){
+			exit(1);
+		}
+		snprintf(child_path, path_len + NAME_MAX_LENGTH + 2, "%s/%.*s", task->ext_path, NAME_MAX_LENGTH, child_inode->name);
+		if(child_inode->n_type == directory){
+			submit_export(ctx, export_dir, child, child_path);
+		}else{
+			submit_export(ctx, export_file, child, child_path);
+		}
+	}
+
+	free(task->ext_path);
+	free(task);
+}
+
+static void export_file(void* arg){
+	export_task* task = arg;
+	export_ctx* ctx = task->ctx;
+	file_system* fs = ctx->fs;
+	inode* file = &fs->inodes[task->inode_num];
+
+	//one iovec per data block, the data goes to the kernel without an intermediate copy
+	struct iovec iov[DIRECT_BLOCKS_COUNT];
+	int iov_count = 0;
+	ssize_t total = 0;
+	int ok = 1;
+	for (int i=0; i<DIRECT_BLOCKS_COUNT; i++) {
+		int block_num = file->direct_blocks[i];
+		if(block_num == -1){
+			continue;
+		}
+		if(verify_block(fs, block_num) != 0){
+			ok = 0;
+			break;
+		}
+		iov[iov_count].iov_base = fs->data_blocks[block_num].block;
+		iov[iov_count].iov_len = fs->data_blocks[block_num].size;
+		total += iov[iov_count].iov_len;
+		iov_count++;
+	}
+
+	int fd = ok ? open(task->ext_path, O_WRONLY | O_CREAT | O_EXCL, 0644) : -1;
+	if(fd != -1){
+		//writev may write less than asked for, continue where it stopped
+		struct iovec* next = iov;
+		while(total > 0){
+			ssize_t w = writev(fd, next, iov_count);
+			if(w <= 0){
+				ok = 0;
+				break;
+			}
+			total -= w;
+			while(iov_count > 0 && (size_t)w >= next->iov_len){
+				w -= next->iov_len;
+				next++;
+				iov_count--;
+			}
+			if(iov_count > 0){
+				next->iov_base = (uint8_t*)next->iov_base + w;
+				next->iov_len -= w;
+			}
+		}
+		close(fd);
+	}
+	if(fd == -1 || !ok){
+		__atomic_fetch_add(&ctx->failed, 1, __ATOMIC_RELAXED);
+	}
+	free(task->ext_path);
+	free(task);
+}
+
+int fs_export_tree(file_system* fs, char* int_path, char* ext_path, int num_threads){
+	//inodes and blocks removed meanwhile are not reused before every task is done
+	fs_epoch_enter(fs);
+	char* path = strdup(int_path);
+	int dir = find_parent_directory(fs, path);
+	free(path);
+	if(dir == -1){
+		fs_epoch_exit(fs);
+		return -1;
+	}
+	if(mkdir(ext_path, 0755) != 0){
+		struct stat st;
+		if(stat(ext_path, &st) != 0 || !S_ISDIR(st.st_mode)){
+			fs_epoch_exit(fs);
+			return -1;
+		}
+	}
+
+	export_ctx ctx;
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.fs = fs;
+	ctx.pool = threadpool_create(num_threads);
+	if(ctx.pool == NULL){
+		fs_epoch_exit(fs);
+		return -1;
+	}
+
+	span s;
+	span_begin(&s, "fs_export_tree");
+	submit_export(&ctx, export_dir, dir, strdup(ext_path));
+	threadpool_destroy(ctx.pool);
+	span_end(&s);
+	fs_epoch_exit(fs);
+	return ctx.failed;
+}
@@ -0,0 +1,101 @@
+#include <stdint.h>
+#include <string.h>
+#include "../lib/crc32c.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+	#include <nmmintrin.h>
+	#define CRC32C_X86
+#endif
+
+#define CRC32C_POLY 0x82f63b78 //reflected Castagnoli polynomial
+
+static uint32_t crc32c_table[8][256];
+static uint32_t (*crc32c_impl)(uint32_t crc, const uint8_t* buf, size_t len);
+
+static uint32_t crc32c_sw(uint32_t crc, const uint8_t* buf, size_t len){
+	//align to 8 bytes, then consume one 64 bit word per round
+	while(len > 0 && ((uintptr_t)buf & 7) != 0){
+		crc = crc32c_table[0][(crc ^ *buf++) & 0xff] ^ (crc >> 8);
+		len--;
+	}
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	while(len >= 8){
+		uint64_t word;
+		memcpy(&word, buf, 8);
+		uint32_t lo = (uint32_t)word ^ crc;
+		uint32_t hi = (uint32_t)(word >> 32);
+		crc = crc32c_table[7][lo & 0xff] ^ crc32c_table[6][(lo >> 8) & 0xff] ^
+			crc32c_table[5][(lo >> 16) & 0xff] ^ crc32c_table[4][lo >> 24] ^
+			crc32c_table[3][hi & 0xff] ^ crc32c_table[2][(hi >> 8) & 0xff] ^
+			crc32c_table[1][(hi >> 16) & 0xff] ^ crc32c_table[0][hi >> 24];
+		buf += 8;
+		len -= 8;
+	}
+#endif
+	while(len > 0){
+		crc = crc32c_table[0][(crc ^ *buf++) & 0xff] ^ (crc >> 8);
+		len--;
+	}
+	return crc;
+}
+
+#ifdef CRC32C_X86
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_hw(uint32_t crc, const uint8_t* buf, size_t len){
+	while(len > 0 && ((uintptr_t)buf & 7) != 0){
+		crc = _mm_crc32_u8(crc, *buf++);
+		len--;
+	}
+#ifdef __x86_64__
+	uint64_t crc64 = crc;
+	while(len >= 8){
+		uint64_t word;
+		memcpy(&word, buf, 8);
+		crc64 = _mm_crc32_u64(crc64, word);
+		buf += 8;
+		len -= 8;
+	}
+	crc = (uint32_t)crc64;
+#endif
+	while(len > 0){
+		crc = _mm_crc32_u8(crc, *buf++);
+		len--;
+	}
+	return crc;
+}
+#endif
+
+//builds the lookup tables and picks the implementation before main() runs,
+//so crc32c() can be called from several threads without further setup
+__attribute__((constructor))
+static void crc32c_init(void){
+	for (int i=0; i<256; i++) {
+		uint32_t crc = i;
+		for (int bit=0; bit<8; bit++) {
+			crc = (crc & 1) ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+		}
+		crc32c_table[0][i] = crc;
+	}
+	for (int i=0; i<256; i++) {
+		for (int k=1; k<8; k++) {
+			uint32_t prev = crc32c_table[k-1][i];
+			crc32c_table[k][i] = (prev >> 8) ^ crc32c_table[0][prev & 0xff];
+		}
+	}
+
+	crc32c_impl = crc32c_sw;
+#ifdef CRC32C_X86
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("sse4.2")){
+		crc32c_impl = crc32c_hw;
+	}
+#endif
+}
+
+uint32_t crc32c(uint32_t crc, const void* buf, size_t len){
+	return ~crc32c_impl(~crc, buf, len);
+}
+
+int crc32c_hw_available(void){
+	return crc32c_impl != crc32c_sw;
+}
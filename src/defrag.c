@@ -0,0 +1,179 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../lib/alloc.h"
+#include "../lib/defrag.h"
+#include "../lib/epoch.h"
+#include "../lib/filesystem.h"
+#include "../lib/sweeper.h"
+#include "../lib/utils.h"
+
+void block_owners(file_system* fs, int* owner_inode, int* owner_slot){
+	uint32_t n = fs->s_block->num_blocks;
+	memset(owner_inode, -1, n * sizeof(int));
+	memset(owner_slot, -1, n * sizeof(int));
+
+	for (uint32_t i=0; i<n; i++) {
+		if(fs->inodes[i].n_type != reg_file){
+			continue;
+		}
+		for (int j=0; j<DIRECT_BLOCKS_COUNT; j++) {
+			int block = fs->inodes[i].direct_blocks[j];
+			if(block >= 0 && (uint32_t)block < n){
+				owner_inode[block] = i;
+				owner_slot[block] = j;
+			}
+		}
+	}
+}
+
+//moves slot of file from current to target and whatever occupies target to current. Both owners
+//are held while the ownership seen by block_owners is checked again and the blocks are swapped
+static int move_block(file_system* fs, int file_num, int slot, int current, int target, int other_inode, int other_slot){
+	int first = file_num;
+	int second = other_inode;
+	if(second != -1 && second < first){
+		first = other_inode;
+		second = file_num;
+	}
+	inode_write_begin(fs, first);
+	if(second != -1 && second != first){
+		inode_write_begin(fs, second);
+	}
+
+	inode* file = &fs->inodes[file_num];
+	//removed files keep their blocks until the sweeper or the epoch frees them
+	int valid = file->n_type == reg_file && file->parent != -1 && file->direct_blocks[slot] == current;
+	if(other_inode != -1){
+		inode* other = &fs->inodes[other_inode];
+		valid = valid && other->n_type == reg_file && other->parent != -1 &&
+		        other->direct_blocks[other_slot] == target;
+	}
+	if(valid && swap_blocks(fs, current, target, other_inode == -1) != 0){
+		valid = 0;
+	}
+	if(valid){
+		file->direct_blocks[slot] = target;
+		inode_touch(fs, file_num, 0);
+		if(other_inode != -1){
+			fs->inodes[other_inode].direct_blocks[other_slot] = current;
+			inode_touch(fs, other_inode, 0);
+		}
+	}
+
+	if(second != -1 && second != first){
+		inode_write_end(fs, second);
+	}
+	inode_write_end(fs, first);
+	return valid ? 0 : -1;
+}
+
+//a position can take a block if it is free or owned by a file, leaked blocks are left alone
+static int movable(file_system* fs, int* owner_inode, uint32_t block){
+	return fs->free_list[block] || owner_inode[block] != -1;
+}
+
+void fs_defrag_init(defrag_state* st){
+	memset(st, 0, sizeof(defrag_state));
+}
+
+int fs_defrag_step(file_system* fs, defrag_state* st, int max_moves){
+	uint32_t n = fs->s_block->num_blocks;
+	if(st->done){
+		return 0;
+	}
+	//blocks of removed files are freed first, their positions can be used then
+	fs_sweeper_drain(fs);
+	fs_epoch_barrier(fs);
+
+	int* owner_inode = malloc(n * sizeof(int));
+	int* owner_slot = malloc(n * sizeof(int));
+	if(owner_inode == NULL || owner_slot == NULL){
+		exit(1);
+	}
+	block_owners(fs, owner_inode, owner_slot);
+
+	int moves = 0;
+	while(st->next_inode < n && moves < max_moves){
+		inode file;
+		inode_read(fs, st->next_inode, &file);
+		if(file.n_type != reg_file || file.parent == -1){
+			st->next_inode++;
+			continue;
+		}
+
+		int count = 0;
+		while(count < DIRECT_BLOCKS_COUNT && file.direct_blocks[count] != -1){
+			count++;
+		}
+		//skip leaked blocks, the run for this file has to consist of usable positions
+		int fits = 1;
+		for (int j=0; j<count; j++) {
+			if(st->next_block + j >= n){
+				fits = 0;
+				break;
+			}
+			if(!movable(fs, owner_inode, st->next_block + j)){
+				st->next_block += j + 1;
+				j = -1;
+			}
+		}
+		if(!fits){
+			//no room left in front of the file, it stays where it is
+			st->next_inode++;
+			continue;
+		}
+		//the file is only finished once all of its blocks are in place
+		if(moves + count > max_moves && moves > 0){
+			break;
+		}
+
+		int placed = 1;
+		for (int j=0; j<count; j++) {
+			int target = st->next_block + j;
+			int current = file.direct_blocks[j];
+			if(current == target){
+				continue;
+			}
+			//whatever occupies the target moves to the old position of this block
+			int other_inode = owner_inode[target];
+			int other_slot = owner_slot[target];
+			if(move_block(fs, st->next_inode, j, current, target, other_inode, other_slot) != 0){
+				//the file or the target changed since the owners were collected, the run
+				//starts behind the target and the file is read again
+				st->next_block = target + 1;
+				placed = 0;
+				break;
+			}
+			owner_inode[target] = st->next_inode;
+			owner_slot[target] = j;
+			owner_inode[current] = other_inode;
+			owner_slot[current] = other_slot;
+			if(other_inode == (int)st->next_inode){
+				file.direct_blocks[other_slot] = current;
+			}
+			moves++;
+		}
+		if(placed){
+			st->next_block += count;
+			st->next_inode++;
+		}
+	}
+
+	free(owner_inode);
+	free(owner_slot);
+	st->moved += moves;
+	if(st->next_inode >= n){
+		st->done = 1;
+		LOG("Defragmentation pass complete\n");
+	}
+	return !st->done;
+}
+
+int fs_defrag(file_system* fs){
+	defrag_state st;
+	fs_defrag_init(&st);
+	while(fs_defrag_step(fs, &st, 4096)){
+	}
+	return st.moved;
+}
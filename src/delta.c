@@ -0,0 +1,283 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "../lib/alloc.h"
+#include "../lib/crc32c.h"
+#include "../lib/delta.h"
+#include "../lib/epoch.h"
+#include "../lib/image.h"
+#include "../lib/sweeper.h"
+
+static uint32_t num_chunks(uint32_t num_blocks){
+	return (num_blocks + INODE_CHUNK - 1) / INODE_CHUNK;
+}
+
+static uint32_t num_words(uint32_t bits){
+	return (bits + 63) / 64;
+}
+
+//inodes in the chunk, the last one may be short
+static uint32_t chunk_length(uint32_t num_blocks, uint32_t chunk){
+	uint32_t first = chunk * INODE_CHUNK;
+	return num_blocks - first < INODE_CHUNK ? num_blocks - first : INODE_CHUNK;
+}
+
+void fs_delta_init(file_system* fs){
+	uint32_t n = fs->s_block->num_blocks;
+	fs->dirty_blocks = calloc(num_words(n), sizeof(uint64_t));
+	fs->dirty_inodes = calloc(num_words(num_chunks(n)), sizeof(uint64_t));
+	if(fs->dirty_blocks == NULL || fs->dirty_inodes == NULL){
+		exit(1);
+	}
+}
+
+void fs_delta_free(file_system* fs){
+	free(fs->dirty_blocks);
+	free(fs->dirty_inodes);
+	fs->dirty_blocks = NULL;
+	fs->dirty_inodes = NULL;
+}
+
+void fs_delta_mark_all(file_system* fs){
+	fs_delta_free(fs);
+	fs_delta_init(fs);
+	uint32_t n = fs->s_block->num_blocks;
+	memset(fs->dirty_blocks, 0xff, num_words(n) * sizeof(uint64_t));
+	memset(fs->dirty_inodes, 0xff, num_words(num_chunks(n)) * sizeof(uint64_t));
+}
+
+//takes the marks of a bitmap of bits entries, the bitmap is cleared
+static uint64_t* take_marks(uint64_t* bitmap, uint32_t bits){
+	uint64_t* taken = malloc(num_words(bits) * sizeof(uint64_t));
+	if(taken == NULL){
+		exit(1);
+	}
+	for (uint32_t w=0; w<num_words(bits); w++) {
+		taken[w] = __atomic_exchange_n(&bitmap[w], 0, __ATOMIC_RELAXED);
+	}
+	//the bits past the end may be set by fs_delta_mark_all
+	if(bits % 64 != 0){
+		taken[bits / 64] &= ((uint64_t)1 << (bits % 64)) - 1;
+	}
+	return taken;
+}
+
+static int marked(const uint64_t* bits, uint32_t i){
+	return (bits[i / 64] >> (i % 64)) & 1;
+}
+
+//gives the marks back after a failed export
+static void restore_marks(uint64_t* bitmap, const uint64_t* taken, uint32_t bits){
+	for (uint32_t w=0; w<num_words(bits); w++) {
+		__atomic_fetch_or(&bitmap[w], taken[w], __ATOMIC_RELAXED);
+	}
+}
+
+//writes len bytes to the patch and extends its checksum, @return 0 on success
+static int put(FILE* file, uint32_t* crc, const void* buf, size_t len){
+	*crc = crc32c(*crc, buf, len);
+	return fwrite(buf, 1, len, file) == len ? 0 : -1;
+}
+
+int fs_delta_export(file_system* fs, const char* patch_path){
+	uint32_t n = fs->s_block->num_blocks;
+	uint32_t chunks = num_chunks(n);
+
+	//removed subtrees must be reclaimed before the free list is sent
+	fs_sweeper_drain(fs);
+	fs_epoch_barrier(fs);
+
+	FILE* file = fopen(patch_path, "w");
+	if(file == NULL){
+		return -1;
+	}
+	uint64_t* blocks = take_marks(fs->dirty_blocks, n);
+	uint64_t* inodes = take_marks(fs->dirty_inodes, chunks);
+
+	fs->s_block->root_node = fs->root_node;
+	fs_free_blocks(fs);
+	uint32_t inode_chunks = 0;
+	uint32_t data_blocks = 0;
+	for (uint32_t c=0; c<chunks; c++) {
+		inode_chunks += marked(inodes, c);
+	}
+	//blocks that were freed again are covered by the free list
+	int failed = 0;
+	for (uint32_t b=0; b<n; b++) {
+		if(marked(blocks, b) && !fs->free_list[b]){
+			data_blocks++;
+			failed |= verify_block(fs, b) != 0;
+		}
+	}
+	delta_header header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, DELTA_MAGIC, sizeof(header.magic));
+	header.num_blocks = le32(n);
+	header.inode_chunks = le32(inode_chunks);
+	header.data_blocks = le32(data_blocks);
+	disk_superblock sb;
+	image_superblock_encode(fs, &sb);
+
+	uint32_t crc = 0;
+	failed |= put(file, &crc, &header, sizeof(header));
+	failed |= put(file, &crc, &sb, sizeof(sb));
+	failed |= put(file, &crc, fs->free_list, n);
+	disk_inode records[INODE_CHUNK];
+	for (uint32_t c=0; c<chunks && !failed; c++) {
+		if(marked(inodes, c)){
+			uint32_t index = le32(c);
+			image_inodes_encode(&fs->inodes[c * INODE_CHUNK], records, chunk_length(n, c));
+			failed |= put(file, &crc, &index, sizeof(index));
+			failed |= put(file, &crc, records, chunk_length(n, c) * sizeof(disk_inode));
+		}
+	}
+	disk_block record;
+	for (uint32_t b=0; b<n && !failed; b++) {
+		if(marked(blocks, b) && !fs->free_list[b]){
+			uint32_t index = le32(b);
+			image_block_encode(&fs->data_blocks[b], &record);
+			failed |= put(file, &crc, &index, sizeof(index));
+			failed |= put(file, &crc, &record, sizeof(record));
+		}
+	}
+	crc = le32(crc);
+	failed |= fwrite(&crc, sizeof(crc), 1, file) != 1;
+	failed |= fclose(file) != 0;
+
+	if(failed){
+		restore_marks(fs->dirty_blocks, blocks, n);
+		restore_marks(fs->dirty_inodes, inodes, chunks);
+		unlink(patch_path);
+	}
+	free(blocks);
+	free(inodes);
+	return failed ? -1 : (int)(inode_chunks + data_blocks);
+}
+
+//reads a little-endian uint32_t at pos of the patch
+static uint32_t get32(const uint8_t* patch, size_t pos){
+	uint32_t v;
+	memcpy(&v, patch + pos, sizeof(v));
+	return le32(v);
+}
+
+//checks that the patch is complete and intact, @return 0 if it can be applied to fs
+static int check_patch(file_system* fs, const uint8_t* patch, size_t size){
+	uint32_t n = fs->s_block->num_blocks;
+	delta_header header;
+	if(size < sizeof(header) + sizeof(disk_superblock) + sizeof(uint32_t)){
+		return -1;
+	}
+	memcpy(&header, patch, sizeof(header));
+	uint32_t inode_chunks = le32(header.inode_chunks);
+	uint32_t data_blocks = le32(header.data_blocks);
+	if(memcmp(header.magic, DELTA_MAGIC, sizeof(header.magic)) != 0 || le32(header.num_blocks) != n ||
+	   inode_chunks > num_chunks(n) || data_blocks > n){
+		return -1;
+	}
+	disk_superblock raw, sb;
+	memcpy(&raw, patch + sizeof(header), sizeof(raw));
+	if(image_superblock_decode(&raw, &sb) != 0 || sb.num_blocks != n || sb.root_node < 0 || (uint32_t)sb.root_node >= n){
+		return -1;
+	}
+	if(crc32c(0, patch, size - sizeof(uint32_t)) != get32(patch, size - sizeof(uint32_t))){
+		return -1;
+	}
+
+	//the chunks and blocks must be in range, which also fixes the length of the patch
+	size_t pos = sizeof(header) + sizeof(disk_superblock) + n;
+	for (uint32_t i=0; i<inode_chunks; i++) {
+		if(pos + sizeof(uint32_t) > size - sizeof(uint32_t)){
+			return -1;
+		}
+		uint32_t c = get32(patch, pos);
+		if(c >= num_chunks(n)){
+			return -1;
+		}
+		pos += sizeof(uint32_t) + chunk_length(n, c) * sizeof(disk_inode);
+	}
+	for (uint32_t i=0; i<data_blocks; i++) {
+		if(pos + sizeof(uint32_t) > size - sizeof(uint32_t)){
+			return -1;
+		}
+		if(get32(patch, pos) >= n){
+			return -1;
+		}
+		pos += sizeof(uint32_t) + sizeof(disk_block);
+	}
+	return pos == size - sizeof(uint32_t) ? 0 : -1;
+}
+
+int fs_delta_apply(file_system* fs, const char* patch_path){
+	int fd = open(patch_path, O_RDONLY);
+	if(fd == -1){
+		return -1;
+	}
+	struct stat st;
+	uint8_t* patch = NULL;
+	size_t size = 0;
+	if(fstat(fd, &st) == 0 && (patch = malloc(st.st_size > 0 ? st.st_size : 1)) != NULL){
+		while(size < (size_t)st.st_size){
+			ssize_t r = read(fd, patch + size, st.st_size - size);
+			if(r <= 0){
+				break;
+			}
+			size += r;
+		}
+	}
+	close(fd);
+	if(patch == NULL || size != (size_t)st.st_size || check_patch(fs, patch, size) != 0){
+		free(patch);
+		return -1;
+	}
+
+	//nothing may point to retired slots that the patch hands out again
+	fs_sweeper_drain(fs);
+	fs_epoch_barrier(fs);
+
+	uint32_t n = fs->s_block->num_blocks;
+	delta_header header;
+	memcpy(&header, patch, sizeof(header));
+	size_t pos = sizeof(header);
+	disk_superblock raw, sb;
+	memcpy(&raw, patch + pos, sizeof(raw));
+	image_superblock_decode(&raw, &sb);
+	fs->s_block->free_blocks = sb.free_blocks;
+	fs->s_block->root_node = sb.root_node;
+	pos += sizeof(disk_superblock);
+	memcpy(fs->free_list, patch + pos, n);
+	pos += n;
+	for (uint32_t i=0; i<le32(header.inode_chunks); i++) {
+		uint32_t c = get32(patch, pos);
+		pos += sizeof(uint32_t);
+		image_inodes_decode(patch + pos, sizeof(disk_inode), &fs->inodes[c * INODE_CHUNK], chunk_length(n, c));
+		pos += chunk_length(n, c) * sizeof(disk_inode);
+		delta_mark_inode(fs, c * INODE_CHUNK);
+	}
+	disk_block record;
+	for (uint32_t i=0; i<le32(header.data_blocks); i++) {
+		uint32_t b = get32(patch, pos);
+		pos += sizeof(uint32_t);
+		memcpy(&record, patch + pos, sizeof(record));
+		image_block_decode(&record, &fs->data_blocks[b]);
+		pos += sizeof(disk_block);
+		//the source verified the block before sending it, the patch checksum covers the rest
+		fs->verified[b] = 1;
+		delta_mark_block(fs, b);
+	}
+	free(patch);
+
+	//rebuild what is derived from the inodes and the free list
+	fs->change_seq = 0;
+	for (uint32_t i=0; i<n; i++) {
+		fs->change_seq = fs->inodes[i].change_seq > fs->change_seq ? fs->inodes[i].change_seq : fs->change_seq;
+	}
+	fs->root_node = fs->s_block->root_node;
+	fs_groups_init(fs);
+	return 0;
+}
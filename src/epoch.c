@@ -0,0 +1,188 @@
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "../lib/alloc.h"
+#include "../lib/epoch.h"
+#include "../lib/filesystem.h"
+
+#define SLOT_COUNT_SHIFT 48 //a slot holds the number of readers above and their epoch below
+#define SLOT_EPOCH_MASK ((1ULL << SLOT_COUNT_SHIFT) - 1)
+#define SLOT_ONE_READER (1ULL << SLOT_COUNT_SHIFT)
+
+//one cache line per slot, so readers on different cpus don't share lines
+typedef struct _epoch_slot{
+	uint64_t word;
+	uint8_t padding[64 - sizeof(uint64_t)];
+} epoch_slot;
+
+typedef struct _retired{
+	uint64_t epoch; //global epoch when it was retired
+	int num;
+	int is_inode;
+} retired;
+
+struct _epoch{
+	uint64_t global; //advanced on every retirement
+	epoch_slot slots[EPOCH_SLOTS];
+	pthread_mutex_t limbo_lock;
+	retired* limbo; //retired inodes and blocks that may still be seen by a reader
+	size_t limbo_count; //written under limbo_lock, read atomically as a hint
+	size_t limbo_capacity;
+};
+
+static __thread int thread_slot = -1;
+static int next_slot = 0;
+
+static uint64_t* my_slot(file_system* fs){
+	if(thread_slot == -1){
+		thread_slot = __atomic_fetch_add(&next_slot, 1, __ATOMIC_RELAXED) % EPOCH_SLOTS;
+	}
+	return &fs->epoch->slots[thread_slot].word;
+}
+
+void fs_epoch_init(file_system* fs){
+	struct _epoch* ep = calloc(1, sizeof(struct _epoch));
+	if(ep == NULL){
+		exit(1);
+	}
+	ep->global = 1;
+	pthread_mutex_init(&ep->limbo_lock, NULL);
+	fs->epoch = ep;
+}
+
+void fs_epoch_free(file_system* fs){
+	if(fs->epoch == NULL){
+		return;
+	}
+	fs_epoch_barrier(fs);
+	pthread_mutex_destroy(&fs->epoch->limbo_lock);
+	free(fs->epoch->limbo);
+	free(fs->epoch);
+	fs->epoch = NULL;
+}
+
+void fs_epoch_enter(file_system* fs){
+	uint64_t* slot = my_slot(fs);
+	uint64_t old = __atomic_load_n(slot, __ATOMIC_RELAXED);
+	uint64_t new;
+	do{
+		//a thread sharing the slot keeps the older epoch, which only delays reclamation
+		uint64_t epoch = old >> SLOT_COUNT_SHIFT == 0 ?
+			__atomic_load_n(&fs->epoch->global, __ATOMIC_SEQ_CST) : (old & SLOT_EPOCH_MASK);
+		new = ((old & ~SLOT_EPOCH_MASK) + SLOT_ONE_READER) | epoch;
+	}while(!__atomic_compare_exchange_n(slot, &old, new, 1, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+}
+
+//the oldest epoch a reader entered in, UINT64_MAX if there is no reader
+static uint64_t oldest_reader(struct _epoch* ep){
+	uint64_t oldest = UINT64_MAX;
+	for (int i=0; i<EPOCH_SLOTS; i++) {
+		uint64_t word = __atomic_load_n(&ep->slots[i].word, __ATOMIC_SEQ_CST);
+		if(word >> SLOT_COUNT_SHIFT != 0 && (word & SLOT_EPOCH_MASK) < oldest){
+			oldest = word & SLOT_EPOCH_MASK;
+		}
+	}
+	return oldest;
+}
+
+//frees the retired entries no reader can see anymore, limbo_lock is held
+static void reclaim(file_system* fs){
+	struct _epoch* ep = fs->epoch;
+	uint64_t oldest = oldest_reader(ep);
+	int blocks[256];
+	int num_blocks = 0;
+	size_t kept = 0;
+
+	for (size_t i=0; i<ep->limbo_count; i++) {
+		retired* r = &ep->limbo[i];
+		//readers that entered after the retirement got a later epoch and can't find it
+		if(r->epoch >= oldest){
+			ep->limbo[kept++] = *r;
+		}else if(r->is_inode){
+			inode_release(fs, r->num);
+		}else{
+			if(num_blocks == 256){
+				release_blocks(fs, blocks, num_blocks);
+				num_blocks = 0;
+			}
+			blocks[num_blocks++] = r->num;
+		}
+	}
+	release_blocks(fs, blocks, num_blocks);
+	__atomic_store_n(&ep->limbo_count, kept, __ATOMIC_RELAXED);
+}
+
+void fs_epoch_exit(file_system* fs){
+	struct _epoch* ep = fs->epoch;
+	uint64_t left = __atomic_sub_fetch(my_slot(fs), SLOT_ONE_READER, __ATOMIC_RELEASE);
+	if(left >> SLOT_COUNT_SHIFT == 0 && __atomic_load_n(&ep->limbo_count, __ATOMIC_RELAXED) > 0){
+		//whoever holds the lock reclaims anyway, nobody waits for it here
+		if(pthread_mutex_trylock(&ep->limbo_lock) == 0){
+			reclaim(fs);
+			pthread_mutex_unlock(&ep->limbo_lock);
+		}
+	}
+}
+
+static void add_retired(struct _epoch* ep, uint64_t epoch, int num, int is_inode){
+	if(ep->limbo_count == ep->limbo_capacity){
+		ep->limbo_capacity = ep->limbo_capacity == 0 ? 256 : ep->limbo_capacity * 2;
+		ep->limbo = realloc(ep->limbo, ep->limbo_capacity * sizeof(retired));
+		if(ep->limbo == NULL){
+			exit(1);
+		}
+	}
+	retired* r = &ep->limbo[ep->limbo_count];
+	r->epoch = epoch;
+	r->num = num;
+	r->is_inode = is_inode;
+	__atomic_store_n(&ep->limbo_count, ep->limbo_count + 1, __ATOMIC_RELAXED);
+}
+
+void fs_epoch_retire(file_system* fs, const int* blocks, int count, int inode_num){
+	struct _epoch* ep = fs->epoch;
+
+	//the detach by the caller is ordered before the look at the readers: a reader
+	//that isn't visible yet enters later and can't reach what was detached
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if(oldest_reader(ep) == UINT64_MAX){
+		release_blocks(fs, blocks, count);
+		if(inode_num != -1){
+			inode_release(fs, inode_num);
+		}
+		return;
+	}
+
+	pthread_mutex_lock(&ep->limbo_lock);
+	uint64_t epoch = __atomic_fetch_add(&ep->global, 1, __ATOMIC_SEQ_CST);
+	for (int i=0; i<count; i++) {
+		add_retired(ep, epoch, blocks[i], 0);
+	}
+	if(inode_num != -1){
+		add_retired(ep, epoch, inode_num, 1);
+	}
+	reclaim(fs);
+	pthread_mutex_unlock(&ep->limbo_lock);
+}
+
+void fs_epoch_retire_file(file_system* fs, int inode_num){
+	int blocks[DIRECT_BLOCKS_COUNT];
+	int count = inode_detach(fs, inode_num, blocks);
+	//readers that found the file before it was detached may still read the blocks
+	fs_epoch_retire(fs, blocks, count, inode_num);
+}
+
+void fs_epoch_barrier(file_system* fs){
+	struct _epoch* ep = fs->epoch;
+	while(1){
+		pthread_mutex_lock(&ep->limbo_lock);
+		reclaim(fs);
+		size_t left = ep->limbo_count;
+		pthread_mutex_unlock(&ep->limbo_lock);
+		if(left == 0){
+			return;
+		}
+		sched_yield();
+	}
+}
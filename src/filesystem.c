@@ -1,68 +1,455 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+#include "../lib/alloc.h"
+#include "../lib/crc32c.h"
+#include "../lib/delta.h"
+#include "../lib/epoch.h"
 #include "../lib/filesystem.h"
+#include "../lib/image.h"
+#include "../lib/span.h"
+#include "../lib/stats.h"
+#include "../lib/sweeper.h"
 #include "../lib/utils.h"
 
+#define LOAD_SHARD_MIN 4096 //fs_load starts another thread for every this many blocks, up to one per cpu
+
+//file offsets of the regions of an image
+typedef struct _image_layout{
+	off_t free_list;
+	off_t inodes;
+	off_t data_blocks;
+	off_t checksums;
+	off_t inode_checksums;
+	off_t end;
+} image_layout;
+
+static uint32_t num_inode_chunks(uint32_t num_blocks){
+	return (num_blocks + INODE_CHUNK - 1) / INODE_CHUNK;
+}
+
+//inodes in the chunk, the last one may be short
+static uint32_t chunk_length(uint32_t num_blocks, uint32_t chunk){
+	uint32_t first = chunk * INODE_CHUNK;
+	return num_blocks - first < INODE_CHUNK ? num_blocks - first : INODE_CHUNK;
+}
+
+//sizes of the records of an image format
+typedef struct _image_format{
+	size_t superblock_size;
+	size_t inode_size;
+} image_format;
+
+//Formats of the images written before the superblock had a magic number, raw copies of
+//the x86-64 structures of their time. They are told apart by the length of the image.
+//The superblock held num_blocks and free_blocks, the data blocks were already laid out
+//like disk_block and the inodes were prefixes of disk_inode, without timestamps.
+static const image_format old_formats[] = {
+	{2 * sizeof(uint32_t), offsetof(disk_inode, reserved2)},
+};
+
+static image_layout get_layout(uint32_t num_blocks, image_format format){
+	image_layout layout;
+	layout.free_list = format.superblock_size;
+	layout.inodes = layout.free_list + num_blocks;
+	layout.data_blocks = layout.inodes + (off_t)num_blocks * format.inode_size;
+	layout.checksums = layout.data_blocks + (off_t)num_blocks * sizeof(disk_block);
+	layout.inode_checksums = layout.checksums + (off_t)num_blocks * sizeof(uint32_t);
+	layout.end = layout.inode_checksums + (off_t)num_inode_chunks(num_blocks) * sizeof(uint32_t);
+	return layout;
+}
+
+//the regions as the superblock of a current image names them
+static image_layout superblock_layout(const disk_superblock* sb){
+	return (image_layout){sb->free_list, sb->inodes, sb->data_blocks, sb->checksums, sb->inode_checksums, sb->image_size};
+}
+
+//finds the format of an old image of length bytes, it ends after the data blocks.
+//@return its index in old_formats or -1 if none fits
+static int detect_format(uint32_t num_blocks, off_t length){
+	for (size_t i=0; i<sizeof(old_formats) / sizeof(old_formats[0]); i++) {
+		image_layout layout = get_layout(num_blocks, old_formats[i]);
+		if(layout.checksums == length){
+			return i;
+		}
+	}
+	return -1;
+}
+
+//the checksum tables are little-endian in the image
+static void crc_table_order(uint32_t* table, uint32_t count){
+	if(!IMAGE_LITTLE_ENDIAN){
+		for (uint32_t i=0; i<count; i++) {
+			table[i] = le32(table[i]);
+		}
+	}
+}
+
+//reads up to len bytes at offset, a short count means the file ended
+static size_t read_full(int fd, void* buf, size_t len, off_t offset){
+	size_t done = 0;
+	while(done < len){
+		ssize_t r = pread(fd, (uint8_t*)buf + done, len - done, offset + done);
+		if(r <= 0){
+			break;
+		}
+		done += r;
+	}
+	return done;
+}
+
+static size_t write_full(int fd, const void* buf, size_t len, off_t offset){
+	size_t done = 0;
+	while(done < len){
+		ssize_t w = pwrite(fd, (const uint8_t*)buf + done, len - done, offset + done);
+		if(w <= 0){
+			break;
+		}
+		done += w;
+	}
+	return done;
+}
+
+//deallocates a range of the file, it reads back as zeros afterwards. @return 0 or -1 on a write error
+static int punch_hole(int fd, off_t offset, size_t len){
+#ifdef FALLOC_FL_PUNCH_HOLE
+	if(fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, len) == 0){
+		return 0;
+	}
+#endif
+	//no hole punching on this filesystem, overwrite with zeros instead
+	uint8_t zeros[BLOCK_SIZE * 4];
+	memset(zeros, 0, sizeof(zeros));
+	while(len > 0){
+		size_t chunk = len < sizeof(zeros) ? len : sizeof(zeros);
+		if(write_full(fd, zeros, chunk, offset) != chunk){
+			return -1;
+		}
+		offset += chunk;
+		len -= chunk;
+	}
+	return 0;
+}
+
+//allocates the checksum tables for a filesystem of fs->s_block->num_blocks blocks
+static void alloc_checksums(file_system* fs){
+	uint32_t size = fs->s_block->num_blocks;
+	fs->block_crc = malloc(size * sizeof(uint32_t));
+	fs->inode_crc = malloc(num_inode_chunks(size) * sizeof(uint32_t));
+	fs->verified = malloc(size);
+	if(fs->block_crc == NULL || fs->inode_crc == NULL || fs->verified == NULL){
+		exit(1);
+	}
+}
+
+static void alloc_inode_seq(file_system* fs){
+	fs->inode_seq = calloc(fs->s_block->num_blocks, sizeof(uint32_t));
+	if(fs->inode_seq == NULL){
+		exit(1);
+	}
+}
+
+//part of the image that one thread of fs_load reads and verifies
+typedef struct _load_shard{
+	file_system* fs;
+	int fd;
+	image_layout layout;
+	size_t inode_size; //bytes of an inode record of the image
+	int has_checksums;
+	uint32_t begin; //first inode and data block, a multiple of INODE_CHUNK
+	uint32_t end;
+	int corrupt; //an inode chunk doesn't match its checksum
+} load_shard;
+
+//reads the inode records of the shard and verifies them chunk by chunk
+static void load_inodes(load_shard* shard){
+	file_system* fs = shard->fs;
+	uint32_t size = fs->s_block->num_blocks;
+	if(IMAGE_NATIVE_INODES && shard->inode_size == sizeof(disk_inode)){
+		//the records are the inodes, they are read in place
+		read_full(shard->fd, &fs->inodes[shard->begin], (size_t)(shard->end - shard->begin) * sizeof(inode),
+		          shard->layout.inodes + (off_t)shard->begin * sizeof(disk_inode));
+		for (uint32_t c = shard->begin / INODE_CHUNK; shard->has_checksums && c<num_inode_chunks(shard->end); c++) {
+			if(crc32c(0, &fs->inodes[c * INODE_CHUNK], chunk_length(size, c) * sizeof(inode)) != fs->inode_crc[c]){
+				shard->corrupt = 1;
+			}
+		}
+		//the reserved fields are the padding of the inodes. Old images were raw copies of
+		//the structs, there they may hold anything.
+		for (uint32_t i=shard->begin; i<shard->end; i++) {
+			disk_inode* record = (disk_inode*)&fs->inodes[i];
+			record->reserved = 0;
+			record->reserved2 = 0;
+		}
+		return;
+	}
+	uint8_t records[INODE_CHUNK * sizeof(disk_inode)];
+	for (uint32_t c = shard->begin / INODE_CHUNK; c<num_inode_chunks(shard->end); c++) {
+		uint32_t count = chunk_length(size, c);
+		read_full(shard->fd, records, count * shard->inode_size, shard->layout.inodes + (off_t)c * INODE_CHUNK * shard->inode_size);
+		if(shard->has_checksums && crc32c(0, records, count * shard->inode_size) != fs->inode_crc[c]){
+			shard->corrupt = 1;
+		}
+		image_inodes_decode(records, shard->inode_size, &fs->inodes[c * INODE_CHUNK], count);
+	}
+}
+
+//reads the data block records that overlap the bytes [from, to) of the data region of the shard
+static void load_blocks(load_shard* shard, off_t from, off_t to){
+	file_system* fs = shard->fs;
+	off_t base = shard->layout.data_blocks;
+	if(IMAGE_NATIVE_BLOCKS){
+		read_full(shard->fd, (uint8_t*)fs->data_blocks + (from - base), to - from, from);
+		return;
+	}
+	disk_block records[IMAGE_BATCH];
+	uint32_t first = (from - base) / sizeof(disk_block);
+	uint32_t last = (to - base + sizeof(disk_block) - 1) / sizeof(disk_block);
+	for (uint32_t b = first; b<last; b += IMAGE_BATCH) {
+		uint32_t count = last - b < IMAGE_BATCH ? last - b : IMAGE_BATCH;
+		memset(records, 0, sizeof(records));
+		read_full(shard->fd, records, count * sizeof(disk_block), base + (off_t)b * sizeof(disk_block));
+		for (uint32_t i=0; i<count; i++) {
+			image_block_decode(&records[i], &fs->data_blocks[b + i]);
+		}
+	}
+}
+
+//reads the inodes and data blocks [begin, end) and verifies their inode chunks
+static void* load_shard_run(void* arg){
+	load_shard* shard = arg;
+	file_system* fs = shard->fs;
+	int fd = shard->fd;
+	if(shard->begin >= shard->end){
+		return NULL;
+	}
+	//the inode table is needed by every operation, so it is verified in bulk right away
+	load_inodes(shard);
+
+	//read only the parts of the data region that hold data, holes of a sparse image stay zero
+	off_t pos = shard->layout.data_blocks + (off_t)shard->begin * sizeof(disk_block);
+	off_t end = shard->layout.data_blocks + (off_t)shard->end * sizeof(disk_block);
+	while(pos < end){
+		off_t data = lseek(fd, pos, SEEK_DATA);
+		off_t hole = end;
+		if(data == -1 && errno == ENXIO){
+			break; //only holes left
+		}else if(data == -1){
+			data = pos; //SEEK_DATA not supported, read everything
+		}else{
+			hole = lseek(fd, data, SEEK_HOLE);
+		}
+		if(data >= end){
+			break;
+		}
+		if(hole == -1 || hole > end){
+			hole = end;
+		}
+		load_blocks(shard, data, hole);
+		pos = hole;
+	}
+
+	//the used data blocks are checked in bulk too. Corrupt ones stay unverified, so reading them
+	//fails and fs_dump keeps their stored checksum.
+	if(shard->has_checksums){
+		for (uint32_t b = shard->begin; b<shard->end; b++) {
+			if(!fs->free_list[b] && image_block_crc(&fs->data_blocks[b]) == fs->block_crc[b]){
+				fs->verified[b] = 1;
+			}
+		}
+	}
+	return NULL;
+}
+
+//Reads the superblock and finds the regions of the image, old images are told apart by their length.
+//@return 0 on success, -1 if the image is damaged, of a newer version or of no known format
+static int read_superblock(int fd, superblock* sb, image_layout* layout, size_t* inode_size){
+	disk_superblock header;
+	struct stat st;
+	memset(&header, 0, sizeof(header));
+	read_full(fd, &header, sizeof(header), 0);
+	if(fstat(fd, &st) != 0){
+		return -1;
+	}
+	if(memcmp(header.magic, IMAGE_MAGIC, sizeof(header.magic)) == 0){
+		disk_superblock decoded;
+		if(image_superblock_decode(&header, &decoded) != 0 || (uint64_t)st.st_size < decoded.image_size){
+			return -1;
+		}
+		sb->num_blocks = decoded.num_blocks;
+		sb->free_blocks = decoded.free_blocks;
+		sb->root_node = decoded.root_node;
+		*layout = superblock_layout(&decoded);
+		*inode_size = decoded.inode_size;
+		return 0;
+	}
+
+	//an old superblock is num_blocks and free_blocks, the root is found by fs_find_root
+	uint32_t words[2];
+	memcpy(words, &header, sizeof(words));
+	int format = detect_format(le32(words[0]), st.st_size);
+	if(format == -1){
+		return -1;
+	}
+	sb->num_blocks = le32(words[0]);
+	sb->free_blocks = le32(words[1]);
+	sb->root_node = -1;
+	*layout = get_layout(sb->num_blocks, old_formats[format]);
+	*inode_size = old_formats[format].inode_size;
+	return 0;
+}
+
 file_system* fs_load(const char* fs_file_path){
-	//TODO:
-	// * check if file exists -> if not abort
-	// find root_node and set it to new_fs->root_node
-	FILE* fs_file = fopen(fs_file_path,"r");
+	return fs_load_threads(fs_file_path, 0);
+}
+
+file_system* fs_load_threads(const char* fs_file_path, int num_threads){
+	int fd = open(fs_file_path, O_RDONLY);
+	if(fd == -1){
+		return NULL;
+	}
+	superblock sb;
+	image_layout layout;
+	size_t inode_size;
+	if(read_superblock(fd, &sb, &layout, &inode_size) != 0){
+		LOG("Unknown or damaged image format\n");
+		close(fd);
+		return NULL;
+	}
+	span s;
+	span_begin(&s, "fs_load");
 	file_system* new_fs = malloc(sizeof(file_system));
 	if(new_fs == NULL){
 		exit(1);
 	}
+	new_fs->sweeper = NULL;
+	new_fs->groups = NULL;
+	new_fs->epoch = NULL;
 
 	new_fs->s_block = malloc(sizeof(superblock));
 	if(new_fs->s_block == NULL){
 		exit(1);
 	}
-
-	//read size from superblock
-	fread(new_fs->s_block, sizeof(superblock), 1, fs_file);
+	*new_fs->s_block = sb;
+	uint32_t size = sb.num_blocks;
 
 	//allocate memory for the free list and load the free list from file
-	new_fs->free_list = malloc(new_fs->s_block->num_blocks);
-	if(new_fs->free_list == NULL){
+	new_fs->free_list = malloc(size);
+	//zeroed, the padding of the inodes goes into images and stat responses as it is
+	new_fs->inodes = calloc(size, sizeof(inode));
+	new_fs->data_blocks = calloc(size, sizeof(data_block));
+	if(new_fs->free_list == NULL || new_fs->inodes == NULL || new_fs->data_blocks == NULL){
 		exit(1);
 	}
-	fread(new_fs->free_list,sizeof(uint8_t), new_fs->s_block->num_blocks, fs_file);
+	read_full(fd, new_fs->free_list, size, layout.free_list);
 
-	//allocate memory for the inodes and read them from file
-	new_fs->inodes = malloc(sizeof(inode) * new_fs->s_block->num_blocks);
-	if(new_fs->inodes == NULL){
-		exit(1);
+	//read the checksums. Images written before checksums existed end after the data blocks,
+	//their blocks are treated as verified.
+	uint32_t num_chunks = num_inode_chunks(size);
+	alloc_checksums(new_fs);
+	alloc_inode_seq(new_fs);
+	fs_epoch_init(new_fs);
+	fs_delta_init(new_fs);
+	int has_checksums =
+		read_full(fd, new_fs->block_crc, size * sizeof(uint32_t), layout.checksums) == size * sizeof(uint32_t) &&
+		read_full(fd, new_fs->inode_crc, num_chunks * sizeof(uint32_t), layout.inode_checksums) == num_chunks * sizeof(uint32_t);
+	crc_table_order(new_fs->block_crc, size);
+	crc_table_order(new_fs->inode_crc, num_chunks);
+	memset(new_fs->verified, !has_checksums, size);
+
+	//the inode table and the data region are read and verified in slices by parallel threads,
+	//small images aren't worth a thread. The calling thread takes the first slice.
+	if(num_threads <= 0){
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		num_threads = size / LOAD_SHARD_MIN + 1;
+		if(cpus >= 1 && num_threads > cpus){
+			num_threads = cpus;
+		}
 	}
-	fread(new_fs->inodes,sizeof(inode), new_fs->s_block->num_blocks, fs_file);
+	if((uint32_t)num_threads > num_chunks){
+		num_threads = num_chunks > 0 ? num_chunks : 1;
+	}
+	pthread_t threads[num_threads];
+	load_shard shards[num_threads];
+	uint32_t per_thread = (num_chunks + num_threads - 1) / num_threads * INODE_CHUNK;
+	for (int t=0; t<num_threads; t++) {
+		uint32_t begin = (uint32_t)t * per_thread;
+		uint32_t end = begin + per_thread;
+		shards[t] = (load_shard){new_fs, fd, layout, inode_size, has_checksums,
+		                         begin < size ? begin : size, end < size ? end : size, 0};
+	}
+	int started[num_threads];
+	for (int t=1; t<num_threads; t++) {
+		started[t] = pthread_create(&threads[t], NULL, load_shard_run, &shards[t]) == 0;
+		if(!started[t]){
+			load_shard_run(&shards[t]);
+		}
+	}
+	load_shard_run(&shards[0]);
+	int corrupt = shards[0].corrupt;
+	for (int t=1; t<num_threads; t++) {
+		if(started[t]){
+			pthread_join(threads[t], NULL);
+		}
+		corrupt |= shards[t].corrupt;
+	}
+	close(fd);
 
-	//allocate memory for the data blocks and read them from file
-	new_fs->data_blocks = malloc(sizeof(data_block)* new_fs->s_block->num_blocks);
-	if(new_fs->data_blocks == NULL){
-		exit(1);
+	if(corrupt){
+		LOG("Checksum mismatch in inode table\n");
+		cleanup(new_fs);
+		span_end(&s);
+		return NULL;
 	}
-	fread(new_fs->data_blocks,sizeof(data_block), new_fs->s_block->num_blocks, fs_file);
 
-	//find root node
-	for (int i = 0; i<new_fs->s_block->num_blocks; i++) {
-		if(new_fs->inodes[i].n_type==directory && strncmp(new_fs->inodes[i].name,"/",NAME_MAX_LENGTH)==0){
-			new_fs->root_node = i;
-			break;
-		}
+	//the change counter goes on from the newest change in the image
+	new_fs->change_seq = 0;
+	for (uint32_t i = 0; i<size; i++) {
+		new_fs->change_seq = new_fs->inodes[i].change_seq > new_fs->change_seq ? new_fs->inodes[i].change_seq : new_fs->change_seq;
+	}
+
+	//the superblock names the root, images of older formats are searched for it
+	int root = new_fs->s_block->root_node;
+	if(root < 0 || (uint32_t)root >= size || new_fs->inodes[root].n_type != directory){
+		root = fs_find_root(new_fs);
 	}
+	new_fs->root_node = root;
+	new_fs->s_block->root_node = root;
+	fs_groups_init(new_fs);
+	span_end(&s);
 	
 	LOG("Loaded filesystem from file\n");
 
-	fclose(fs_file);
 	return new_fs;
 }
 
+int fs_find_root(file_system* fs){
+	for (uint32_t i = 0; i<fs->s_block->num_blocks; i++) {
+		if(fs->inodes[i].n_type==directory && strncmp(fs->inodes[i].name,"/",NAME_MAX_LENGTH)==0){
+			return i;
+		}
+	}
+	return -1;
+}
+
 file_system* fs_create(const char* fs_file_path, uint32_t size){
 	file_system* new_fs = malloc(sizeof(file_system));
 	if (new_fs == NULL){
 		exit(1);
 	}
+	new_fs->sweeper = NULL;
+	new_fs->groups = NULL;
+	new_fs->epoch = NULL;
 
 	// Create and Initialize the superblock
 	new_fs->s_block = malloc(sizeof(superblock));
@@ -71,6 +458,7 @@ file_system* fs_create(const char* fs_file_path, uint32_t size){
 	}
 	new_fs->s_block->num_blocks = size;
 	new_fs->s_block->free_blocks = size;
+	new_fs->s_block->root_node = 0;
 	
 	// Create free list and set every entry to 1 (meaning that block is free);
 	new_fs->free_list = malloc(size);
@@ -82,7 +470,7 @@ file_system* fs_create(const char* fs_file_path, uint32_t size){
 	}
 
 	// Create Inodes and initialize them
-	new_fs->inodes = malloc(size*sizeof(inode));
+	new_fs->inodes = calloc(size,sizeof(inode));
 	if(new_fs->inodes == NULL){
 		exit(1);
 	}
@@ -99,13 +487,22 @@ file_system* fs_create(const char* fs_file_path, uint32_t size){
 	new_fs->inodes[0].n_type = directory;
 	strncpy(new_fs->inodes[0].name,"/",NAME_MAX_LENGTH);
 	new_fs->root_node = 0;
+	new_fs->change_seq = 0;
+	inode_touch(new_fs, 0, 1);
+	fs_groups_init(new_fs);
 
 	
 	new_fs->data_blocks = calloc(size,sizeof(data_block));
 	if(new_fs->data_blocks == NULL){
 		exit(1);
 	}
-	
+
+	//nothing to verify in a fresh filesystem, the checksums are computed by fs_dump
+	alloc_checksums(new_fs);
+	alloc_inode_seq(new_fs);
+	fs_epoch_init(new_fs);
+	fs_delta_init(new_fs);
+	memset(new_fs->verified, 1, size);
 
 	//write the components to file
 	fs_dump(new_fs, fs_file_path);
@@ -121,26 +518,251 @@ void inode_init(inode *i){
 	memset(i->name,0,NAME_MAX_LENGTH);
 	memset(i->direct_blocks, -1, DIRECT_BLOCKS_COUNT*sizeof(int));
 	i->parent = -1; //meaning it has no parent
+	i->mtime = 0;
+	i->ctime = 0;
+	i->change_seq = 0;
 }
 
+void inode_touch(file_system* fs, int inode_num, int content){
+	inode* i = &fs->inodes[inode_num];
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	i->ctime = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+	if(content){
+		i->mtime = i->ctime;
+		i->change_seq = __atomic_add_fetch(&fs->change_seq, 1, __ATOMIC_RELAXED);
+	}
+}
 
-int fs_dump(file_system *fs, const char *file_path){
+void inode_write_begin(file_system* fs, int inode_num){
+	uint32_t* seq = &fs->inode_seq[inode_num];
+	uint32_t s = __atomic_load_n(seq, __ATOMIC_RELAXED);
+	//an odd count means another writer holds the inode
+	while((s & 1) || !__atomic_compare_exchange_n(seq, &s, s + 1, 1, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)){
+		if(s & 1){
+			sched_yield();
+			s = __atomic_load_n(seq, __ATOMIC_RELAXED);
+		}
+	}
+	//readers that see any of the following writes also see the odd count
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+void inode_write_end(file_system* fs, int inode_num){
+	delta_mark_inode(fs, inode_num);
+	__atomic_fetch_add(&fs->inode_seq[inode_num], 1, __ATOMIC_RELEASE);
+}
+
+uint32_t inode_read(file_system* fs, int inode_num, inode* out){
+	uint32_t* seq = &fs->inode_seq[inode_num];
+	const uint8_t* src = (const uint8_t*)&fs->inodes[inode_num];
+	uint8_t* dst = (uint8_t*)out;
+
+	while(1){
+		uint32_t before = __atomic_load_n(seq, __ATOMIC_ACQUIRE);
+		if(before & 1){
+			sched_yield();
+			continue;
+		}
+		//byte wise atomic loads, the inode may change under the copy
+		for (size_t i=0; i<sizeof(inode); i++) {
+			dst[i] = __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+		}
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if(__atomic_load_n(seq, __ATOMIC_RELAXED) == before){
+			return before;
+		}
+	}
+}
+
+int inode_changed(file_system* fs, int inode_num, uint32_t seq){
+	//whatever was read since inode_read is complete before the count is checked
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return __atomic_load_n(&fs->inode_seq[inode_num], __ATOMIC_RELAXED) != seq;
+}
+
+int inode_detach(file_system* fs, int inode_num, int* out){
+	inode* i = &fs->inodes[inode_num];
+	int count = 0;
+	inode_write_begin(fs, inode_num);
+	i->parent = -1;
+	for (int b=0; b<DIRECT_BLOCKS_COUNT; b++) {
+		if(i->direct_blocks[b] != -1){
+			out[count++] = i->direct_blocks[b];
+		}
+	}
+	inode_write_end(fs, inode_num);
+	return count;
+}
+
+void inode_release(file_system* fs, int inode_num){
+	inode_write_begin(fs, inode_num);
+	inode_init(&fs->inodes[inode_num]);
+	inode_write_end(fs, inode_num);
+	inode_freed(fs, inode_num);
+}
+
+//writes count inodes as records, converted on the stack unless they already have the layout of one.
+//@return 0 or -1 on a write error
+static int write_inodes(int fd, const inode* inodes, uint32_t count, off_t offset){
+	if(IMAGE_NATIVE_INODES){
+		size_t length = (size_t)count * sizeof(disk_inode);
+		return write_full(fd, inodes, length, offset) == length ? 0 : -1;
+	}
+	disk_inode records[INODE_CHUNK];
+	for (uint32_t i=0; i<count; i += INODE_CHUNK) {
+		uint32_t batch = count - i < INODE_CHUNK ? count - i : INODE_CHUNK;
+		image_inodes_encode(&inodes[i], records, batch);
+		if(write_full(fd, records, batch * sizeof(disk_inode), offset + (off_t)i * sizeof(disk_inode)) != batch * sizeof(disk_inode)){
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static int write_blocks(int fd, const data_block* blocks, uint32_t count, off_t offset){
+	if(IMAGE_NATIVE_BLOCKS){
+		size_t length = (size_t)count * sizeof(disk_block);
+		return write_full(fd, blocks, length, offset) == length ? 0 : -1;
+	}
+	disk_block records[IMAGE_BATCH];
+	for (uint32_t i=0; i<count; i += IMAGE_BATCH) {
+		uint32_t batch = count - i < IMAGE_BATCH ? count - i : IMAGE_BATCH;
+		for (uint32_t b=0; b<batch; b++) {
+			image_block_encode(&blocks[i + b], &records[b]);
+		}
+		if(write_full(fd, records, batch * sizeof(disk_block), offset + (off_t)i * sizeof(disk_block)) != batch * sizeof(disk_block)){
+			return -1;
+		}
+	}
+	return 0;
+}
+
+//writes the image, fs_dump times it
+static int dump_image(file_system *fs, const char *file_path){
 	uint32_t size = fs->s_block->num_blocks;
+	uint32_t num_chunks = num_inode_chunks(size);
+
+	//removed subtrees must be reclaimed before the free list is written
+	span s;
+	span_begin(&s, "dump.reclaim");
+	fs_sweeper_drain(fs);
+	fs_epoch_barrier(fs);
+	span_end(&s);
 
-	FILE* fs_file = fopen(file_path,"w");
-	fwrite(fs->s_block, sizeof(superblock), 1, fs_file);
-	fwrite(fs->free_list, sizeof(uint8_t),size,fs_file);
-	fwrite(fs->inodes, sizeof(inode),size,fs_file);
-	fwrite(fs->data_blocks, sizeof(data_block),size,fs_file);
-	fclose(fs_file);
+	//the file is not truncated: blocks that were freed since the last dump are punched out below
+	int fd = open(file_path, O_RDWR | O_CREAT, 0644);
+	if(fd == -1){
+		return -1;
+	}
+	struct stat st;
+	off_t old_size = fstat(fd, &st) == 0 ? st.st_size : 0;
+
+	//the checksums are appended after the data blocks. Free blocks are not written
+	//and read back as zeros, so their checksum is the one of an empty block.
+	//Blocks that failed or never passed verification keep their stored checksum,
+	//otherwise a damaged block would get a valid one.
+	span_begin(&s, "dump.checksums");
+	data_block empty;
+	memset(&empty, 0, sizeof(data_block));
+	uint32_t empty_crc = image_block_crc(&empty);
+	for (uint32_t i=0; i<size; i++) {
+		if(fs->free_list[i]){
+			fs->block_crc[i] = empty_crc;
+		}else if(fs->verified[i]){
+			fs->block_crc[i] = image_block_crc(&fs->data_blocks[i]);
+		}
+	}
+	for (uint32_t c=0; c<num_chunks; c++) {
+		fs->inode_crc[c] = image_inodes_crc(&fs->inodes[c * INODE_CHUNK], chunk_length(size, c));
+	}
+	span_end(&s);
 
+	span_begin(&s, "dump.write");
+	fs->s_block->root_node = fs->root_node; //a resize may have moved it
+	fs_free_blocks(fs);
+	disk_superblock header, decoded;
+	image_superblock_encode(fs, &header);
+	image_superblock_decode(&header, &decoded);
+	image_layout layout = superblock_layout(&decoded);
+	//a failed write (e.g. ENOSPC or EIO) fails the dump, the rest is still attempted
+	int failed = write_full(fd, &header, sizeof(header), 0) != sizeof(header);
+	failed |= write_full(fd, fs->free_list, size, layout.free_list) != size;
+	failed |= write_inodes(fd, fs->inodes, size, layout.inodes) != 0;
+
+	//write runs of used blocks with one call each and punch holes for runs of free blocks
+	uint32_t run_start = 0;
+	for (uint32_t i=1; i<=size; i++) {
+		if(i < size && !fs->free_list[i] == !fs->free_list[run_start]){
+			continue;
+		}
+		off_t offset = layout.data_blocks + (off_t)run_start * sizeof(disk_block);
+		size_t length = (size_t)(i - run_start) * sizeof(disk_block);
+		if(!fs->free_list[run_start]){
+			failed |= write_blocks(fd, &fs->data_blocks[run_start], i - run_start, offset) != 0;
+		}else if(offset < old_size){
+			failed |= punch_hole(fd, offset, length) != 0;
+		}
+		run_start = i;
+	}
+
+	crc_table_order(fs->block_crc, size);
+	crc_table_order(fs->inode_crc, num_chunks);
+	failed |= write_full(fd, fs->block_crc, size * sizeof(uint32_t), layout.checksums) != size * sizeof(uint32_t);
+	failed |= write_full(fd, fs->inode_crc, num_chunks * sizeof(uint32_t), layout.inode_checksums) !=
+	          num_chunks * sizeof(uint32_t);
+	crc_table_order(fs->block_crc, size);
+	crc_table_order(fs->inode_crc, num_chunks);
+	//drops whatever followed the checksums before (e.g. after shrinking) and makes
+	//trailing free blocks a hole
+	failed |= ftruncate(fd, layout.end) != 0;
+	failed |= close(fd) != 0;
+	span_end(&s);
+
+	return failed ? -1 : 0;
+
+}
+
+int fs_dump(file_system *fs, const char *file_path){
+	uint64_t start = stats_start();
+	span s;
+	span_begin(&s, "fs_dump");
+	int result = dump_image(fs, file_path);
+	span_end(&s);
+	stats_finish(stats_dump, start);
+	return result;
+}
+
+int verify_block(file_system* fs, int block_num){
+	if(fs->verified[block_num]){
+		return 0;
+	}
+	if(image_block_crc(&fs->data_blocks[block_num]) != fs->block_crc[block_num]){
+		LOG("Checksum mismatch in data block\n");
+		return -1;
+	}
+	fs->verified[block_num] = 1;
 	return 0;
+}
 
+int fs_verify(file_system* fs){
+	int corrupt = 0;
+	for (uint32_t i=0; i<fs->s_block->num_blocks; i++) {
+		//free blocks hold no data, in a sparse image they aren't even stored
+		if(!fs->free_list[i] && verify_block(fs, i) != 0){
+			corrupt++;
+		}
+	}
+	return corrupt;
 }
 
 
 int find_free_inode(file_system* fs){
-	for (int i=0; i<fs->s_block->num_blocks; i++) {
+	return find_free_inode_from(fs, 0);
+}
+
+int find_free_inode_from(file_system* fs, int start){
+	for (int i=start; i<fs->s_block->num_blocks; i++) {
 		if(fs->inodes[i].n_type==free_block){
 			return i;
 		}
@@ -150,11 +772,19 @@ int find_free_inode(file_system* fs){
 
 
 void cleanup(file_system *fs){
-	
+	fs_sweeper_stop(fs);
+	fs_epoch_free(fs);
+	fs_groups_free(fs);
+
 	free(fs->s_block);
 	free(fs->inodes);
 	free(fs->free_list);
 	free(fs->data_blocks);
+	free(fs->block_crc);
+	free(fs->inode_crc);
+	free(fs->verified);
+	free(fs->inode_seq);
+	fs_delta_free(fs);
 	free(fs);
 
 }
@@ -0,0 +1,354 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "../lib/alloc.h"
+#include "../lib/delta.h"
+#include "../lib/epoch.h"
+#include "../lib/filesystem.h"
+#include "../lib/fsck.h"
+#include "../lib/operations.h"
+#include "../lib/sweeper.h"
+#include "../lib/utils.h"
+
+enum reach_state{
+	reach_yes=1,
+	reach_no=2
+};
+
+typedef struct _fsck_state{
+	file_system* fs;
+	uint32_t* entry_refs; //number of directory entries pointing to an inode
+	int* listed_in; //a directory listing the inode, preferably a reachable one, -1 if there is none
+	uint32_t* block_refs; //number of file block pointers to a data block
+	uint8_t* reach; //enum reach_state of every inode
+	fsck_report report; //updated with atomic adds by the workers
+} fsck_state;
+
+typedef void (*fsck_phase)(fsck_state* st, uint32_t begin, uint32_t end);
+
+typedef struct _fsck_shard{
+	fsck_state* st;
+	fsck_phase phase;
+	uint32_t begin;
+	uint32_t end;
+} fsck_shard;
+
+#define COUNT(field, n) __atomic_fetch_add(&st->report.field, (n), __ATOMIC_RELAXED)
+
+static int used_inode(file_system* fs, int i){
+	return fs->inodes[i].n_type == directory || fs->inodes[i].n_type == reg_file;
+}
+
+static void* run_shard(void* arg){
+	fsck_shard* shard = arg;
+	shard->phase(shard->st, shard->begin, shard->end);
+	return NULL;
+}
+
+//runs phase on num_threads threads, each one gets an equal slice of [0, num_blocks)
+static void run_sharded(fsck_state* st, fsck_phase phase, int num_threads){
+	uint32_t n = st->fs->s_block->num_blocks;
+	pthread_t threads[num_threads];
+	fsck_shard shards[num_threads];
+	uint32_t per_thread = (n + num_threads - 1) / num_threads;
+
+	for (int t=0; t<num_threads; t++) {
+		shards[t].st = st;
+		shards[t].phase = phase;
+		shards[t].begin = MIN((uint32_t)t * per_thread, n);
+		shards[t].end = MIN(shards[t].begin + per_thread, n);
+	}
+	//the calling thread works on the first shard itself
+	for (int t=1; t<num_threads; t++) {
+		if(pthread_create(&threads[t], NULL, run_shard, &shards[t]) != 0){
+			shards[t].phase = NULL;
+			phase(st, shards[t].begin, shards[t].end);
+		}
+	}
+	phase(st, shards[0].begin, shards[0].end);
+	for (int t=1; t<num_threads; t++) {
+		if(shards[t].phase != NULL){
+			pthread_join(threads[t], NULL);
+		}
+	}
+}
+
+//counts the references to inodes and data blocks
+static void scan_inodes(fsck_state* st, uint32_t begin, uint32_t end){
+	file_system* fs = st->fs;
+	int n = fs->s_block->num_blocks;
+
+	for (uint32_t i=begin; i<end; i++) {
+		inode* in = &fs->inodes[i];
+		if(in->n_type == directory){
+			for (int j=0; j<DIRECT_BLOCKS_COUNT; j++) {
+				int child = in->direct_blocks[j];
+				if(child == -1){
+					continue;
+				}
+				if(child < 0 || child >= n || child == (int)i || !used_inode(fs, child)){
+					COUNT(bad_entries, 1);
+					continue;
+				}
+				__atomic_fetch_add(&st->entry_refs[child], 1, __ATOMIC_RELAXED);
+				__atomic_store_n(&st->listed_in[child], (int)i, __ATOMIC_RELAXED);
+			}
+		}else if(in->n_type == reg_file){
+			for (int j=0; j<DIRECT_BLOCKS_COUNT; j++) {
+				int block = in->direct_blocks[j];
+				if(block == -1){
+					continue;
+				}
+				if(block < 0 || block >= n){
+					COUNT(bad_entries, 1);
+					continue;
+				}
+				__atomic_fetch_add(&st->block_refs[block], 1, __ATOMIC_RELAXED);
+			}
+		}else if(in->n_type != free_block){
+			COUNT(bad_inodes, 1);
+		}
+	}
+}
+
+//marks the inodes that can be reached from the root by walking down the directory entries,
+//so an inode listed in several directories is reachable if any of them is
+static void mark_reachable(fsck_state* st){
+	file_system* fs = st->fs;
+	int n = fs->s_block->num_blocks;
+	int root = fs->root_node;
+	memset(st->reach, reach_no, n);
+	if(root < 0 || root >= n || fs->inodes[root].n_type != directory){
+		return;
+	}
+
+	//every inode is queued at most once
+	int* queue = malloc(n * sizeof(int));
+	if(queue == NULL){
+		exit(1);
+	}
+	int head = 0;
+	int tail = 0;
+	st->reach[root] = reach_yes;
+	queue[tail++] = root;
+	while(head < tail){
+		inode* dir = &fs->inodes[queue[head++]];
+		if(dir->n_type != directory){
+			continue;
+		}
+		for (int j=0; j<DIRECT_BLOCKS_COUNT; j++) {
+			int child = dir->direct_blocks[j];
+			if(child < 0 || child >= n || !used_inode(fs, child) || st->reach[child] == reach_yes){
+				continue;
+			}
+			st->reach[child] = reach_yes;
+			queue[tail++] = child;
+		}
+	}
+	free(queue);
+}
+
+//A listing in a reachable directory takes precedence over one in a detached directory,
+//and the directory named by the parent pointer over any other one. The parent pass runs last.
+static void pick_listings(fsck_state* st, uint32_t begin, uint32_t end, int parent_only){
+	file_system* fs = st->fs;
+	int n = fs->s_block->num_blocks;
+
+	for (uint32_t i=begin; i<end; i++) {
+		if(fs->inodes[i].n_type != directory || st->reach[i] != reach_yes){
+			continue;
+		}
+		for (int j=0; j<DIRECT_BLOCKS_COUNT; j++) {
+			int child = fs->inodes[i].direct_blocks[j];
+			if(child < 0 || child >= n || child == (int)i || !used_inode(fs, child)){
+				continue;
+			}
+			if(!parent_only || fs->inodes[child].parent == (int)i){
+				__atomic_store_n(&st->listed_in[child], (int)i, __ATOMIC_RELAXED);
+			}
+		}
+	}
+}
+
+static void pick_reachable_listings(fsck_state* st, uint32_t begin, uint32_t end){
+	pick_listings(st, begin, end, 0);
+}
+
+static void pick_parent_listings(fsck_state* st, uint32_t begin, uint32_t end){
+	pick_listings(st, begin, end, 1);
+}
+
+static void check_inodes(fsck_state* st, uint32_t begin, uint32_t end){
+	file_system* fs = st->fs;
+
+	for (uint32_t i=begin; i<end; i++) {
+		if(!used_inode(fs, i)){
+			continue;
+		}
+		if(st->reach[i] == reach_no){
+			COUNT(unreachable, 1);
+		}
+		if(st->entry_refs[i] > 1){
+			COUNT(multi_linked, st->entry_refs[i] - 1);
+		}
+		if(st->entry_refs[i] > 0 && fs->inodes[i].parent != st->listed_in[i]){
+			COUNT(bad_parents, 1);
+		}
+	}
+}
+
+static void check_blocks(fsck_state* st, uint32_t begin, uint32_t end){
+	file_system* fs = st->fs;
+	uint32_t free_count = 0;
+
+	for (uint32_t b=begin; b<end; b++) {
+		uint32_t refs = st->block_refs[b];
+		if(refs == 0 && !fs->free_list[b]){
+			COUNT(leaked_blocks, 1);
+		}
+		if(refs > 0 && fs->free_list[b]){
+			COUNT(unmarked_blocks, 1);
+		}
+		if(refs > 1){
+			COUNT(shared_blocks, refs - 1);
+		}
+		free_count += fs->free_list[b] != 0;
+	}
+	//free_count is only a per-shard sum here, it is compared after all shards finished
+	COUNT(free_count, free_count);
+}
+
+//drops the -1 holes from a block list, so that appending finds the end of the file again
+static void compact_blocks(inode* in){
+	int used = 0;
+	for (int j=0; j<DIRECT_BLOCKS_COUNT; j++) {
+		if(in->direct_blocks[j] != -1){
+			in->direct_blocks[used++] = in->direct_blocks[j];
+		}
+	}
+	for (int j=used; j<DIRECT_BLOCKS_COUNT; j++) {
+		in->direct_blocks[j] = -1;
+	}
+}
+
+//repairs run single threaded, they only happen on images that are already broken.
+//The inodes are still changed under their seqlock, see fsck.h for why it must run offline.
+static void repair(fsck_state* st){
+	file_system* fs = st->fs;
+	int n = fs->s_block->num_blocks;
+
+	//free inodes that can't be reached. Their children are unreachable as well.
+	for (int i=0; i<n; i++) {
+		if(fs->inodes[i].n_type != free_block && (!used_inode(fs, i) || st->reach[i] == reach_no)){
+			inode_release(fs, i);
+			delta_mark_inode(fs, i);
+		}
+	}
+
+	uint8_t* claimed = calloc(n, 1);
+	if(claimed == NULL){
+		exit(1);
+	}
+	for (int i=0; i<n; i++) {
+		inode* in = &fs->inodes[i];
+		inode_write_begin(fs, i);
+		inode before = *in;
+		if(in->n_type == directory){
+			//keep only the entry the parent pointer is rebuilt from
+			for (int j=0; j<DIRECT_BLOCKS_COUNT; j++) {
+				int child = in->direct_blocks[j];
+				if(child != -1 && (child < 0 || child >= n || !used_inode(fs, child) || st->listed_in[child] != i)){
+					in->direct_blocks[j] = -1;
+				}
+			}
+		}else if(in->n_type == reg_file){
+			//the first file in inode order keeps a shared block
+			int dropped = 0;
+			for (int j=0; j<DIRECT_BLOCKS_COUNT; j++) {
+				int block = in->direct_blocks[j];
+				if(block != -1 && (block < 0 || block >= n || claimed[block])){
+					in->direct_blocks[j] = -1;
+					dropped = 1;
+				}else if(block != -1){
+					claimed[block] = 1;
+				}
+			}
+			compact_blocks(in);
+			//reads and appends go by the size, it has to match the blocks that are left
+			if(dropped){
+				int size = 0;
+				for (int j=0; j<DIRECT_BLOCKS_COUNT && in->direct_blocks[j] != -1; j++) {
+					size += fs->data_blocks[in->direct_blocks[j]].size;
+				}
+				in->size = size;
+			}
+		}
+		if(i != fs->root_node && used_inode(fs, i)){
+			in->parent = st->listed_in[i];
+		}
+		//repaired inodes show up as changed for an incremental sync
+		if(memcmp(&before, in, sizeof(inode)) != 0){
+			inode_touch(fs, i, 1);
+			delta_mark_inode(fs, i);
+		}
+		inode_write_end(fs, i);
+	}
+
+	for (int b=0; b<n; b++) {
+		fs->free_list[b] = !claimed[b];
+	}
+	free(claimed);
+	fs_groups_init(fs);
+	fs_free_blocks(fs);
+	LOG("Repaired filesystem\n");
+}
+
+int fs_fsck(file_system* fs, int repair_fs, int num_threads, fsck_report* report){
+	uint32_t n = fs->s_block->num_blocks;
+	//subtrees waiting for the sweeper would show up as unreachable
+	fs_sweeper_drain(fs);
+	fs_epoch_barrier(fs);
+	if(num_threads <= 0){
+		num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	}
+	//don't start threads for slices that are too small to be worth it
+	num_threads = MIN(num_threads, (int)(n / 4096) + 1);
+
+	fsck_state st;
+	memset(&st, 0, sizeof(st));
+	st.fs = fs;
+	st.entry_refs = calloc(n, sizeof(uint32_t));
+	st.listed_in = malloc(n * sizeof(int));
+	st.block_refs = calloc(n, sizeof(uint32_t));
+	st.reach = calloc(n, 1);
+	if(st.entry_refs == NULL || st.listed_in == NULL || st.block_refs == NULL || st.reach == NULL){
+		exit(1);
+	}
+	memset(st.listed_in, -1, n * sizeof(int));
+
+	run_sharded(&st, scan_inodes, num_threads);
+	mark_reachable(&st);
+	run_sharded(&st, pick_reachable_listings, num_threads);
+	run_sharded(&st, pick_parent_listings, num_threads);
+	run_sharded(&st, check_inodes, num_threads);
+	run_sharded(&st, check_blocks, num_threads);
+	st.report.free_count = st.report.free_count != fs_free_blocks(fs);
+
+	fsck_report* r = &st.report;
+	int problems = r->bad_inodes + r->bad_entries + r->multi_linked + r->unreachable + r->bad_parents +
+		r->leaked_blocks + r->unmarked_blocks + r->shared_blocks + r->free_count;
+	if(repair_fs && problems > 0){
+		repair(&st);
+	}
+	if(report != NULL){
+		*report = st.report;
+	}
+
+	free(st.entry_refs);
+	free(st.listed_in);
+	free(st.block_refs);
+	free(st.reach);
+	return problems;
+}
@@ -0,0 +1,374 @@
+#define _GNU_SOURCE
+#include <endian.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "../lib/filesystem.h"
+#include "../lib/image.h"
+#include "../lib/operations.h"
+#include "../lib/protocol.h"
+#include "../lib/sweeper.h"
+#include "../lib/utils.h"
+
+#define MAX_EVENTS 64
+#define READ_CHUNK (64 * 1024)
+#define OUT_HIGH_WATER (1024 * 1024) //stop reading requests while this much output is pending
+
+typedef struct _buffer{
+	uint8_t* data;
+	size_t start; //first byte that wasn't consumed yet
+	size_t used;
+	size_t capacity;
+} buffer;
+
+typedef struct _connection{
+	int fd;
+	buffer in;
+	buffer out;
+	uint32_t events; //what the connection is registered for in epoll
+} connection;
+
+static file_system* fs;
+static const char* image_path;
+static int epoll_fd;
+
+//makes room for n more bytes at the end of b, consumed bytes are dropped first
+static void reserve(buffer* b, size_t n){
+	if(b->start > 0){
+		memmove(b->data, b->data + b->start, b->used - b->start);
+		b->used -= b->start;
+		b->start = 0;
+	}
+	if(b->used + n <= b->capacity){
+		return;
+	}
+	size_t capacity = b->capacity == 0 ? READ_CHUNK : b->capacity;
+	while(capacity < b->used + n){
+		capacity *= 2;
+	}
+	b->data = realloc(b->data, capacity);
+	if(b->data == NULL){
+		exit(1);
+	}
+	b->capacity = capacity;
+}
+
+static void append_response(connection* c, uint32_t id, int32_t status, const void* payload, uint32_t length){
+	proto_response header;
+	header.length = htole32(length);
+	header.id = htole32(id);
+	header.status = (int32_t)htole32((uint32_t)status);
+
+	reserve(&c->out, sizeof(header) + length);
+	memcpy(c->out.data + c->out.used, &header, sizeof(header));
+	if(length > 0){
+		memcpy(c->out.data + c->out.used + sizeof(header), payload, length);
+	}
+	c->out.used += sizeof(header) + length;
+}
+
+static void execute(connection* c, const proto_request* req, uint8_t* body){
+	//the operations modify their path argument, so every request gets its own copy
+	char path[PROTO_MAX_PATH + 1];
+	memcpy(path, body, req->path_length);
+	path[req->path_length] = '\0';
+	uint8_t* data = body + req->path_length;
+	uint32_t data_length = req->length - req->path_length;
+
+	int32_t status = -1;
+	void* payload = NULL;
+	uint32_t payload_length = 0;
+	inode info;
+	//the payloads are bounded and built on the stack
+	char listing[LIST_MAX_LENGTH + 1];
+	uint8_t content[MAX_FILE_SIZE];
+
+	switch(req->op){
+	case proto_mkdir:
+		status = fs_mkdir(fs, path);
+		break;
+	case proto_mkfile:
+		status = fs_mkfile(fs, path);
+		break;
+	case proto_list:{
+		int length = fs_list_into(fs, path, listing, sizeof(listing));
+		if(length != -1){
+			status = 0;
+			payload = listing;
+			payload_length = length;
+		}
+		break;
+	}
+	case proto_writef:{
+		//the text is terminated in place: the byte behind it belongs to the next request
+		//or is the spare byte read_input keeps, it is put back afterwards
+		uint8_t next = data[data_length];
+		data[data_length] = '\0';
+		status = fs_writef(fs, path, (char*)data);
+		data[data_length] = next;
+		break;
+	}
+	case proto_readf:{
+		int size = fs_readf_into(fs, path, content, sizeof(content));
+		if(size != -1){
+			status = 0;
+			payload = content;
+			payload_length = size;
+		}
+		break;
+	}
+	case proto_rm:
+		status = fs_rm(fs, path);
+		break;
+	case proto_stat:
+		status = fs_stat(fs, path, &info);
+		if(status != -1){
+			//the inode goes out in the fixed layout of the image, not as the host struct
+			disk_inode record;
+			image_inodes_encode(&info, &record, 1);
+			append_response(c, req->id, status, &record, sizeof(record));
+			return;
+		}
+		break;
+	case proto_dump:
+		status = fs_dump(fs, image_path);
+		break;
+	}
+
+	append_response(c, req->id, status, payload, payload_length);
+}
+
+//runs every complete request in the input buffer, in order.
+//@return -1 if the client sent a malformed request
+static int process_requests(connection* c){
+	while(c->out.used - c->out.start < OUT_HIGH_WATER){
+		size_t available = c->in.used - c->in.start;
+		if(available < sizeof(proto_request)){
+			break;
+		}
+		proto_request req;
+		memcpy(&req, c->in.data + c->in.start, sizeof(req));
+		req.length = le32toh(req.length);
+		req.id = le32toh(req.id);
+		req.path_length = le16toh(req.path_length);
+		if(req.length > PROTO_MAX_LENGTH || req.path_length > PROTO_MAX_PATH || req.path_length > req.length){
+			return -1;
+		}
+		if(available < sizeof(req) + req.length){
+			break;
+		}
+		execute(c, &req, c->in.data + c->in.start + sizeof(req));
+		c->in.start += sizeof(req) + req.length;
+	}
+	return 0;
+}
+
+//writes pending output until the socket would block. @return -1 if the connection broke
+static int flush_output(connection* c){
+	while(c->out.start < c->out.used){
+		ssize_t w = write(c->fd, c->out.data + c->out.start, c->out.used - c->out.start);
+		if(w < 0 && errno == EINTR){
+			continue;
+		}
+		if(w < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)){
+			return 0;
+		}
+		if(w <= 0){
+			return -1;
+		}
+		c->out.start += w;
+	}
+	c->out.start = 0;
+	c->out.used = 0;
+	return 0;
+}
+
+//reads everything the client sent so far. @return -1 on end of stream or an error
+static int read_input(connection* c){
+	while(1){
+		reserve(&c->in, READ_CHUNK);
+		//one byte stays spare, so the last request's body can be NUL terminated in place
+		ssize_t r = read(c->fd, c->in.data + c->in.used, c->in.capacity - c->in.used - 1);
+		if(r < 0 && errno == EINTR){
+			continue;
+		}
+		if(r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)){
+			return 0;
+		}
+		if(r <= 0){
+			return -1;
+		}
+		c->in.used += r;
+	}
+}
+
+//reads only while the client keeps up with its responses, waits for writability while output is pending
+static void update_events(connection* c){
+	size_t pending = c->out.used - c->out.start;
+	uint32_t events = (pending < OUT_HIGH_WATER ? EPOLLIN : 0) | (pending > 0 ? EPOLLOUT : 0);
+	if(events != c->events){
+		struct epoll_event ev;
+		ev.events = events;
+		ev.data.ptr = c;
+		epoll_ctl(epoll_fd, EPOLL_CTL_MOD, c->fd, &ev);
+		c->events = events;
+	}
+}
+
+static void close_connection(connection* c){
+	epoll_ctl(epoll_fd, EPOLL_CTL_DEL, c->fd, NULL);
+	close(c->fd);
+	free(c->in.data);
+	free(c->out.data);
+	free(c);
+}
+
+static void handle_connection(connection* c, uint32_t events){
+	int broken = 0;
+	if(events & EPOLLIN){
+		broken = read_input(c) != 0;
+	}
+	//requests that arrived before the end of the stream are still answered
+	if(process_requests(c) != 0 || flush_output(c) != 0){
+		close_connection(c);
+		return;
+	}
+	//output that was held back may have made room for the requests still buffered
+	while(!broken && c->in.start < c->in.used && c->out.used == 0){
+		size_t before = c->in.start;
+		if(process_requests(c) != 0 || flush_output(c) != 0){
+			close_connection(c);
+			return;
+		}
+		if(c->in.start == before){
+			break; //only an incomplete request is left
+		}
+	}
+	if(broken || (events & (EPOLLERR | EPOLLHUP))){
+		close_connection(c);
+		return;
+	}
+	update_events(c);
+}
+
+static void accept_connections(int listen_fd){
+	while(1){
+		int fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if(fd == -1){
+			return; //EAGAIN once the backlog is empty
+		}
+		connection* c = calloc(1, sizeof(connection));
+		if(c == NULL){
+			exit(1);
+		}
+		c->fd = fd;
+		c->events = EPOLLIN;
+		struct epoll_event ev;
+		ev.events = EPOLLIN;
+		ev.data.ptr = c;
+		if(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0){
+			close(fd);
+			free(c);
+		}
+	}
+}
+
+static int listen_on(const char* socket_path){
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if(strlen(socket_path) >= sizeof(addr.sun_path)){
+		return -1;
+	}
+	strcpy(addr.sun_path, socket_path);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if(fd == -1){
+		return -1;
+	}
+	unlink(socket_path);
+	if(bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, SOMAXCONN) != 0){
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+int
+main(int argc, const char *argv[])
+{
+	if (argc < 3) {
+		fprintf(stderr, "Usage: fsd <filename> <socket>\n\tServes an existing filesystem on a Unix domain socket\n");
+		exit(1);
+	}
+	image_path = argv[1];
+
+	//SIGINT and SIGTERM arrive through the event loop, the image is dumped before exiting.
+	//they are blocked before the sweeper starts, so that its thread inherits the mask
+	sigset_t signals;
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGINT);
+	sigaddset(&signals, SIGTERM);
+	sigprocmask(SIG_BLOCK, &signals, NULL);
+	signal(SIGPIPE, SIG_IGN);
+	int signal_fd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+
+	fs = fs_load(image_path);
+	if (fs == NULL) {
+		fprintf(stderr, "Could not load filesystem (missing file or corrupt inode table)\n");
+		exit(1);
+	}
+	fs_sweeper_start(fs, 0);
+
+	int listen_fd = listen_on(argv[2]);
+	if (listen_fd == -1) {
+		fprintf(stderr, "Could not listen on %s\n", argv[2]);
+		exit(1);
+	}
+
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (signal_fd == -1 || epoll_fd == -1) {
+		exit(1);
+	}
+	//the listening socket and the signalfd are told apart from connections by their pointers
+	struct epoll_event ev;
+	ev.events = EPOLLIN;
+	ev.data.ptr = &listen_fd;
+	epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev);
+	ev.data.ptr = &signal_fd;
+	epoll_ctl(epoll_fd, EPOLL_CTL_ADD, signal_fd, &ev);
+	LOG("Listening\n");
+
+	int running = 1;
+	struct epoll_event events[MAX_EVENTS];
+	while (running) {
+		int n = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+		if (n < 0 && errno != EINTR) {
+			break;
+		}
+		for (int i = 0; i < n; i++) {
+			if (events[i].data.ptr == &listen_fd) {
+				accept_connections(listen_fd);
+			} else if (events[i].data.ptr == &signal_fd) {
+				running = 0;
+			} else {
+				handle_connection(events[i].data.ptr, events[i].events);
+			}
+		}
+	}
+
+	int result = fs_dump(fs, image_path);
+	cleanup(fs);
+	close(listen_fd);
+	unlink(argv[2]);
+	return result == 0 ? 0 : 1;
+}
@@ -1,17 +1,340 @@
+#include <inttypes.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
+#include "../lib/bulkio.h"
+#include "../lib/defrag.h"
+#include "../lib/delta.h"
 #include "../lib/filesystem.h"
+#include "../lib/fsck.h"
 #include "../lib/linenoise.h"
 #include "../lib/operations.h"
+#include "../lib/resize.h"
+#include "../lib/span.h"
+#include "../lib/stats.h"
+#include "../lib/sweeper.h"
+#include "../lib/trace.h"
 #include "../lib/utils.h"
 
+#define BATCH_OUTPUT_BUFFER (256 * 1024)
+
+#define COMMAND_EXIT 1
+
+//cuts the next space separated word off *line, NULL if the line has no more words
+static char *
+next_word(char **line)
+{
+	char *word = *line;
+	while (*word == ' ' || *word == '\n') {
+		word++;
+	}
+	if (*word == '\0') {
+		*line = word;
+		return NULL;
+	}
+	char *end = word;
+	while (*end != '\0' && *end != ' ' && *end != '\n') {
+		end++;
+	}
+	if (*end != '\0') {
+		*end++ = '\0';
+	}
+	*line = end;
+	return word;
+}
+
+//the remainder of the line after the last word, NULL if nothing is left
+static char *
+rest_of_line(char **line)
+{
+	char *rest = *line;
+	*line += strlen(rest);
+	return *rest != '\0' ? rest : NULL;
+}
+
+/*
+ * Runs one command line, modifying it in place. Output goes to stdout.
+ * @return 0 on success, -1 if the command failed, COMMAND_EXIT for exit and quit
+ */
+static int
+run_command(file_system *fs, const char *image_path, char *line)
+{
+	char *command = next_word(&line);
+	if (command == NULL) {
+		return 0;
+	}
+
+	//determine which command to execute (only our build in commands are possible)
+	if (!strcmp(command, "mkdir")) {
+		LOG("Chosen mkdir\n");
+		return fs_mkdir(fs, next_word(&line)) == 0 ? 0 : -1;
+	} else if (!strcmp(command, "mkfile")) {
+		LOG("Chosen mkfile\n");
+		return fs_mkfile(fs, next_word(&line)) == 0 ? 0 : -1;
+	} else if (!strcmp(command, "list")) {
+		LOG("Chosen list\n");
+		char *path = next_word(&line);
+		if (path != NULL && !strcmp(path, "-l")) {
+			// long listing: inode, size and blocks of every entry in one pass
+			fs_dir dir;
+			fs_dirent_plus entries[DIRECT_BLOCKS_COUNT];
+			path = next_word(&line);
+			if (path == NULL || fs_opendir(fs, path, &dir) == -1) {
+				return -1;
+			}
+			int count;
+			while ((count = fs_readdir_plus(&dir, entries, DIRECT_BLOCKS_COUNT)) > 0) {
+				for (int i = 0; i < count; i++) {
+					fs_dirent_plus *e = &entries[i];
+					printf("%s %d %u %d %.*s\n", e->info.n_type == directory ? "DIR" : "FIL", e->inode_num,
+					       e->info.size, e->blocks, NAME_MAX_LENGTH, e->info.name);
+				}
+			}
+			return count == -1 ? -1 : 0;
+		}
+		char output[LIST_MAX_LENGTH + 1];
+		if (fs_list_into(fs, path, output, sizeof(output)) == -1) {
+			return -1;
+		}
+		fputs(output, stdout);
+	} else if (!strcmp(command, "writef")) {
+		LOG("Chosen writef\n");
+		char *path = next_word(&line);
+		char *text = rest_of_line(&line);
+		if (path == NULL || text == NULL) {
+			return -1;
+		}
+		return fs_writef(fs, path, text) >= 0 ? 0 : -1;
+	} else if (!strcmp(command, "readf")) {
+		LOG("Chosen readf\n");
+		uint8_t output[MAX_FILE_SIZE];
+		char *path = next_word(&line);
+		int file_size = path != NULL ? fs_readf_into(fs, path, output, sizeof(output)) : -1;
+		if (file_size > 0) {
+			fwrite(output, file_size, 1, stdout);
+		}
+	} else if (!strcmp(command, "stat")) {
+		LOG("Chosen stat\n");
+		inode info;
+		char *path = next_word(&line);
+		int inode_num = path != NULL ? fs_stat(fs, path, &info) : -1;
+		if (inode_num == -1) {
+			return -1;
+		}
+		printf("inode: %d\ntype: %s\nsize: %u\nparent: %d\nmtime: %" PRIu64 "\nctime: %" PRIu64 "\nchange: %" PRIu64 "\n",
+		       inode_num, info.n_type == directory ? "directory" : "file", info.size, info.parent,
+		       info.mtime, info.ctime, info.change_seq);
+	} else if (!strcmp(command, "changes")) {
+		LOG("Chosen changes\n");
+		// `change path` of every inode changed after the given sequence, then the current sequence
+		char *since = next_word(&line);
+		uint64_t current = fs_change_seq(fs);
+		fs_changes changes;
+		fs_dirent_plus entries[DIRECT_BLOCKS_COUNT];
+		char path[4096];
+		int count;
+		fs_changes_begin(fs, since != NULL ? strtoull(since, NULL, 10) : 0, &changes);
+		while ((count = fs_changes_next(&changes, entries, DIRECT_BLOCKS_COUNT)) > 0) {
+			for (int i = 0; i < count; i++) {
+				int length = fs_inode_path(fs, entries[i].inode_num, path, sizeof(path));
+				if (length != -1 && (size_t)length < sizeof(path)) {
+					printf("%" PRIu64 " %s\n", entries[i].info.change_seq, path);
+				}
+			}
+		}
+		printf("seq %" PRIu64 "\n", current);
+	} else if (!strcmp(command, "rm")) {
+		LOG("Chosen rm\n");
+		return fs_rm(fs, next_word(&line)) == 0 ? 0 : -1;
+	} else if (!strcmp(command, "export")) {
+		LOG("Chosen export\n");
+		char *int_path = next_word(&line);
+		char *ext_path = rest_of_line(&line);
+		if (int_path == NULL || ext_path == NULL) {
+			return -1;
+		}
+		return fs_export(fs, int_path, ext_path) == 0 ? 0 : -1;
+	} else if (!strcmp(command, "import")) {
+		char *int_path = next_word(&line);
+		char *ext_path = rest_of_line(&line);
+		if (int_path == NULL || ext_path == NULL) {
+			return -1;
+		}
+		return fs_import(fs, int_path, ext_path) == 0 ? 0 : -1;
+	} else if (!strcmp(command, "fsck")) {
+		LOG("Chosen fsck\n");
+		char *mode = next_word(&line);
+		fsck_report report;
+		int problems = fs_fsck(fs, mode != NULL && !strcmp(mode, "repair"), 0, &report);
+		printf("bad inodes: %u\nbad entries: %u\nmulti linked: %u\nunreachable: %u\n"
+		       "bad parents: %u\nleaked blocks: %u\nunmarked blocks: %u\nshared blocks: %u\n"
+		       "free count: %s\n%d problems found\n",
+		       report.bad_inodes, report.bad_entries, report.multi_linked, report.unreachable,
+		       report.bad_parents, report.leaked_blocks, report.unmarked_blocks, report.shared_blocks,
+		       report.free_count ? "wrong" : "ok", problems);
+	} else if (!strcmp(command, "importtree")) {
+		char *int_path = next_word(&line);
+		char *ext_path = rest_of_line(&line);
+		if (int_path == NULL || ext_path == NULL) {
+			return -1;
+		}
+		int failed = fs_import_tree(fs, int_path, ext_path, 0);
+		if (failed != 0) {
+			printf("%d entries could not be imported\n", failed);
+			return -1;
+		}
+	} else if (!strcmp(command, "exporttree")) {
+		char *int_path = next_word(&line);
+		char *ext_path = rest_of_line(&line);
+		if (int_path == NULL || ext_path == NULL) {
+			return -1;
+		}
+		int failed = fs_export_tree(fs, int_path, ext_path, 0);
+		if (failed != 0) {
+			printf("%d entries could not be exported\n", failed);
+			return -1;
+		}
+	} else if (!strcmp(command, "defrag")) {
+		LOG("Chosen defrag\n");
+		printf("%d blocks relocated\n", fs_defrag(fs));
+	} else if (!strcmp(command, "resize")) {
+		LOG("Chosen resize\n");
+		char *size = next_word(&line);
+		if (size == NULL || fs_resize(fs, (uint32_t)atol(size)) != 0) {
+			printf("Could not resize filesystem\n");
+			return -1;
+		}
+	} else if (!strcmp(command, "delta")) {
+		LOG("Chosen delta\n");
+		char *mode = next_word(&line);
+		char *patch_path = rest_of_line(&line);
+		if (mode == NULL || patch_path == NULL) {
+			return -1;
+		} else if (!strcmp(mode, "export")) {
+			int regions = fs_delta_export(fs, patch_path);
+			if (regions == -1) {
+				printf("Could not write %s\n", patch_path);
+				return -1;
+			}
+			printf("%d regions\n", regions);
+		} else if (!strcmp(mode, "apply")) {
+			if (fs_delta_apply(fs, patch_path) != 0) {
+				printf("Could not apply %s\n", patch_path);
+				return -1;
+			}
+		} else {
+			return -1;
+		}
+	} else if (!strcmp(command, "stats")) {
+		LOG("Chosen stats\n");
+		char *mode = next_word(&line);
+		if (mode == NULL) {
+			char *output = fs_stats_format();
+			fputs(output, stdout);
+			free(output);
+		} else if (!strcmp(mode, "on") || !strcmp(mode, "off")) {
+			fs_stats_enable(!strcmp(mode, "on"));
+		} else if (!strcmp(mode, "reset")) {
+			fs_stats_reset();
+		} else {
+			return -1;
+		}
+	} else if (!strcmp(command, "trace")) {
+		LOG("Chosen trace\n");
+		char *trace_path = rest_of_line(&line);
+		if (trace_path == NULL) {
+			return -1;
+		} else if (!strcmp(trace_path, "off")) {
+			fs_trace_stop();
+		} else if (fs_trace_start(trace_path) != 0) {
+			printf("Could not open %s\n", trace_path);
+			return -1;
+		}
+	} else if (!strcmp(command, "spans")) {
+		LOG("Chosen spans\n");
+		char *json_path = rest_of_line(&line);
+		if (json_path == NULL) {
+			return -1;
+		} else if (!strcmp(json_path, "off")) {
+			fs_spans_stop();
+		} else if (fs_spans_start(json_path) != 0) {
+			printf("Could not open %s\n", json_path);
+			return -1;
+		}
+	} else if (!strcmp(command, "replay")) {
+		LOG("Chosen replay\n");
+		char *trace_path = next_word(&line);
+		char *speed = next_word(&line);
+		trace_report *report = malloc(sizeof(trace_report));
+		if (trace_path == NULL || report == NULL ||
+		    fs_trace_replay(fs, trace_path, speed != NULL ? atof(speed) : 1, report) != 0) {
+			free(report);
+			return -1;
+		}
+		char *output = fs_trace_format(report);
+		fputs(output, stdout);
+		free(output);
+		free(report);
+	} else if (!strcmp(command, "dump")) {
+		LOG("Saving filesystem to disk\n");
+		return fs_dump(fs, image_path) == 0 ? 0 : -1;
+	} else if (!strcmp(command, "exit") || !strcmp(command, "quit")) {
+		return COMMAND_EXIT;
+	} else {
+		LOG("Unknown command\nValid commands:\nlist [-l]\nchanges [seq]\nmkfile\nmakedir\nrm\nstat\nexport\nimport\nimporttree <int_dir> <ext_dir>\nexporttree <int_dir> <ext_dir>\nwritef\nreadf\nfsck [repair]\ndefrag\nresize <blocks>\ndelta export|apply <file>\nstats [on|off|reset]\ntrace <file>|off\nspans <file>|off\nreplay <file> [speed, 0 for full speed]\ndump\n");
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Runs the commands of script line by line without any terminal handling. Empty lines
+ * and lines starting with # are skipped. Output is only flushed when the buffer is full.
+ * @return number of failed commands
+ */
+static int
+run_script(file_system *fs, const char *image_path, FILE *script)
+{
+	setvbuf(stdout, NULL, _IOFBF, BATCH_OUTPUT_BUFFER);
+
+	char *line = NULL;
+	size_t capacity = 0;
+	ssize_t length;
+	size_t line_num = 0;
+	int failed = 0;
+	while ((length = getline(&line, &capacity, script)) != -1) {
+		line_num++;
+		if (length > 0 && line[length - 1] == '\n') {
+			line[--length] = '\0';
+		}
+		if (length > 0 && line[length - 1] == '\r') {
+			line[--length] = '\0';
+		}
+		if (line[0] == '#') {
+			continue;
+		}
+		int result = run_command(fs, image_path, line);
+		if (result == COMMAND_EXIT) {
+			break;
+		} else if (result != 0) {
+			//the command word was cut off the line, so line is just the command now
+			fprintf(stderr, "line %zu: %s failed\n", line_num, line);
+			failed++;
+		}
+	}
+	free(line);
+	fflush(stdout);
+	return failed;
+}
+
 int
 main(int argc, const char *argv[])
 {
 	file_system *fs = NULL;
+	int options = 0; //index of the first argument after the filesystem
 	if (argc < 2) {
 		fprintf(stderr,
 		        "No arguments given. You must either load a filesystem or create a new one.\n\n");
@@ -24,71 +347,95 @@ main(int argc, const char *argv[])
 			exit(1);
 		} else {
 			fs = fs_create(argv[2], (uint32_t)atol(argv[3]));
+			options = 4;
 		}
 	} else if (strcmp(argv[1], "-l") == 0 || strcmp(argv[1], "--load") == 0) {
+		if (argc < 3) {
+			fprintf(stderr, "Not enough arguments given\n");
+			printhelp();
+			exit(1);
+		}
 		fs = fs_load(argv[2]);
+		if (fs == NULL) {
+			fprintf(stderr, "Could not load filesystem (missing file or corrupt inode table)\n");
+			exit(1);
+		}
+		options = 3;
 	} else if (strcmp(argv[1], "-h") == 0 || strcmp(argv[1], "--help") == 0) {
 		printhelp();
-	} 
+		exit(0);
+	}
+
+	if (fs == NULL) {
+		printhelp();
+		exit(1);
+	}
+
+	//a pipe on stdin is run as a script, no prompt is needed there
+	int batch = !isatty(STDIN_FILENO);
+	int dump_at_end = 0;
+	const char *script_path = NULL;
+	for (int i = options; i < argc; i++) {
+		if (strcmp(argv[i], "-b") == 0 || strcmp(argv[i], "--batch") == 0) {
+			batch = 1;
+			if (i + 1 < argc && argv[i + 1][0] != '-') {
+				script_path = argv[++i];
+			}
+		} else if (strcmp(argv[i], "-d") == 0 || strcmp(argv[i], "--dump") == 0) {
+			dump_at_end = 1;
+		} else {
+			fprintf(stderr, "Unknown option %s\n", argv[i]);
+			printhelp();
+			exit(1);
+		}
+	}
 
+	//removed directories are reclaimed in the background
+	fs_sweeper_start(fs, 0);
+	//the latencies are shown by the stats command, recording costs a clock read per operation
+	fs_stats_enable(1);
+
+	if (batch) {
+		FILE *script = script_path != NULL ? fopen(script_path, "r") : stdin;
+		if (script == NULL) {
+			fprintf(stderr, "Could not open script %s\n", script_path);
+			cleanup(fs);
+			exit(1);
+		}
+		int failed = run_script(fs, argv[2], script);
+		if (script != stdin) {
+			fclose(script);
+		}
+		if (dump_at_end && fs_dump(fs, argv[2]) != 0) {
+			fprintf(stderr, "Could not save filesystem\n");
+			failed++;
+		}
+		fs_trace_stop();
+		fs_spans_stop();
+		cleanup(fs);
+		exit(failed == 0 ? 0 : 1);
+	}
 
 	linenoiseHistorySetMaxLen(20);
 
 	while (1) {
 		char *input_buf = linenoise("user@SPR: ");
-		if (input_buf != NULL) {
-			linenoiseHistoryAdd(input_buf);
-		} else {
-			//TODO: error handling
-		}
-		char *command = strtok(input_buf, " \n");
-
-		//determine which command to execute (only our build in commands are possible)
-		if (!strcmp(command, "mkdir")) {
-			LOG("Chosen mkdir\n");
-			fs_mkdir(fs, strtok(NULL, " \n"));
-		} else if (!strcmp(command, "mkfile")) {
-			fs_mkfile(fs, strtok(NULL, " \n"));
-			LOG("Chosen mkfile\n");
-		} else if (!strcmp(command, "list")) {
-			LOG("Chosen list\n");
-			char *output = fs_list(fs, strtok(NULL, " \n"));
-			printf("%s", output);
-			free(output);
-		} else if (!strcmp(command, "writef")) {
-			char *path = strtok(NULL, " \n");
-			char *text = strtok(NULL, "\0");
-			fs_writef(fs, path, text);
-			LOG("Chosen writef\n");
-		} else if (!strcmp(command, "readf")) {
-			LOG("Chosen readf\n");
-			int file_size = 0;
-			char *output  = (char *)fs_readf(fs, strtok(NULL, " \n"), &file_size);
-			fwrite(output, file_size, 1, stdout);
-			fflush(stdout);
-			free(output);
-		} else if (!strcmp(command, "rm")) {
-			LOG("Chosen rm\n");
-			fs_rm(fs, strtok(NULL, " \n"));
-		} else if (!strcmp(command, "export")) {
-			char *int_path = strtok(NULL, " \n");
-			char *ext_path = strtok(NULL, "\0");
-			fs_export(fs, int_path, ext_path);
-			LOG("Chosen export\n");
-		} else if (!strcmp(command, "import")) {
-			char *int_path = strtok(NULL, " \n");
-			char *ext_path = strtok(NULL, "\0");
-			fs_import(fs, int_path, ext_path);
-		} else if (!strcmp(command, "dump")) {
-			LOG("Saving filesystem to disk\n");
-			fs_dump(fs, argv[2]);
-		} else if (!strcmp(command, "exit") || !strcmp(command, "quit")) {
-			cleanup(fs);
-			free(input_buf);
-			exit(0);
-		} else {
-			LOG("Unknown command\nValid commands:\nlist\nmkfile\nmakedir\nrm\nexport\nimport\nwritef\nreadf\ndump\n");
+		if (input_buf == NULL) {
+			break; //end of input
 		}
+		linenoiseHistoryAdd(input_buf);
+		int result = run_command(fs, argv[2], input_buf);
+		fflush(stdout);
 		free(input_buf);
+		if (result == COMMAND_EXIT) {
+			break;
+		}
+	}
+	if (dump_at_end) {
+		fs_dump(fs, argv[2]);
 	}
+	fs_trace_stop();
+	fs_spans_stop();
+	cleanup(fs);
+	exit(0);
 }
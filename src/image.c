@@ -0,0 +1,160 @@
+#include <stdint.h>
+#include <string.h>
+#include "../lib/crc32c.h"
+#include "../lib/image.h"
+
+_Static_assert(sizeof(disk_superblock) == 96, "disk_superblock must not have padding");
+_Static_assert(sizeof(disk_inode) == 120, "disk_inode must not have padding");
+_Static_assert(sizeof(disk_block) == 8 + BLOCK_SIZE, "disk_block must not have padding");
+
+static uint32_t num_inode_chunks(uint32_t num_blocks){
+	return (num_blocks + INODE_CHUNK - 1) / INODE_CHUNK;
+}
+
+void image_superblock_encode(file_system* fs, disk_superblock* out){
+	uint64_t n = fs->s_block->num_blocks;
+	memset(out, 0, sizeof(disk_superblock));
+	memcpy(out->magic, IMAGE_MAGIC, sizeof(out->magic));
+	out->version = le32(IMAGE_VERSION);
+	out->header_size = le32(sizeof(disk_superblock));
+	out->num_blocks = le32(fs->s_block->num_blocks);
+	out->free_blocks = le32(fs->s_block->free_blocks);
+	out->root_node = le32(fs->s_block->root_node);
+	out->block_size = le32(BLOCK_SIZE);
+	out->inode_size = le32(sizeof(disk_inode));
+	out->block_record_size = le32(sizeof(disk_block));
+
+	uint64_t free_list = sizeof(disk_superblock);
+	uint64_t inodes = free_list + n;
+	uint64_t data_blocks = inodes + n * sizeof(disk_inode);
+	uint64_t checksums = data_blocks + n * sizeof(disk_block);
+	uint64_t inode_checksums = checksums + n * sizeof(uint32_t);
+	out->free_list = le64(free_list);
+	out->inodes = le64(inodes);
+	out->data_blocks = le64(data_blocks);
+	out->checksums = le64(checksums);
+	out->inode_checksums = le64(inode_checksums);
+	out->image_size = le64(inode_checksums + num_inode_chunks(fs->s_block->num_blocks) * sizeof(uint32_t));
+	out->crc = le32(crc32c(0, out, offsetof(disk_superblock, crc)));
+}
+
+//1 if the region [offset, offset + length) lies behind the superblock and inside the image
+static int region_fits(const disk_superblock* sb, uint64_t offset, uint64_t length){
+	return offset >= sb->header_size && offset <= sb->image_size && length <= sb->image_size - offset;
+}
+
+int image_superblock_decode(const disk_superblock* in, disk_superblock* out){
+	if(memcmp(in->magic, IMAGE_MAGIC, sizeof(in->magic)) != 0 ||
+	   le32(in->crc) != crc32c(0, in, offsetof(disk_superblock, crc))){
+		return -1;
+	}
+	memcpy(out->magic, in->magic, sizeof(out->magic));
+	out->version = le32(in->version);
+	out->header_size = le32(in->header_size);
+	out->num_blocks = le32(in->num_blocks);
+	out->free_blocks = le32(in->free_blocks);
+	out->root_node = le32(in->root_node);
+	out->block_size = le32(in->block_size);
+	out->inode_size = le32(in->inode_size);
+	out->block_record_size = le32(in->block_record_size);
+	out->free_list = le64(in->free_list);
+	out->inodes = le64(in->inodes);
+	out->data_blocks = le64(in->data_blocks);
+	out->checksums = le64(in->checksums);
+	out->inode_checksums = le64(in->inode_checksums);
+	out->image_size = le64(in->image_size);
+	out->reserved = le32(in->reserved);
+	out->crc = le32(in->crc);
+
+	uint64_t n = out->num_blocks;
+	if(out->version > IMAGE_VERSION || out->header_size != sizeof(disk_superblock) ||
+	   out->block_size != BLOCK_SIZE || out->inode_size != sizeof(disk_inode) ||
+	   out->block_record_size != sizeof(disk_block)){
+		return -1;
+	}
+	if(!region_fits(out, out->free_list, n) || !region_fits(out, out->inodes, n * sizeof(disk_inode)) ||
+	   !region_fits(out, out->data_blocks, n * sizeof(disk_block)) ||
+	   !region_fits(out, out->checksums, n * sizeof(uint32_t)) ||
+	   !region_fits(out, out->inode_checksums, num_inode_chunks(out->num_blocks) * sizeof(uint32_t))){
+		return -1;
+	}
+	return 0;
+}
+
+void image_inodes_encode(const inode* in, disk_inode* out, uint32_t count){
+	if(IMAGE_NATIVE_INODES){
+		//the padding becomes the reserved fields, fs_create and fs_load keep it zeroed
+		memcpy(out, in, (size_t)count * sizeof(disk_inode));
+		return;
+	}
+	for (uint32_t i=0; i<count; i++) {
+		disk_inode* d = &out[i];
+		memset(d, 0, sizeof(disk_inode));
+		d->n_type = le32(in[i].n_type);
+		d->size = le16(in[i].size);
+		memcpy(d->name, in[i].name, NAME_MAX_LENGTH);
+		for (int b=0; b<DIRECT_BLOCKS_COUNT; b++) {
+			d->direct_blocks[b] = le32(in[i].direct_blocks[b]);
+		}
+		d->parent = le32(in[i].parent);
+		d->mtime = le64(in[i].mtime);
+		d->ctime = le64(in[i].ctime);
+		d->change_seq = le64(in[i].change_seq);
+	}
+}
+
+void image_inodes_decode(const uint8_t* in, size_t record_size, inode* out, uint32_t count){
+	if(IMAGE_NATIVE_INODES && record_size == sizeof(disk_inode)){
+		memcpy(out, in, (size_t)count * sizeof(inode));
+		return;
+	}
+	for (uint32_t i=0; i<count; i++) {
+		disk_inode d;
+		memset(&d, 0, sizeof(disk_inode));
+		memcpy(&d, in + (size_t)i * record_size, record_size < sizeof(disk_inode) ? record_size : sizeof(disk_inode));
+		memset(&out[i], 0, sizeof(inode));
+		out[i].n_type = le32(d.n_type);
+		out[i].size = le16(d.size);
+		memcpy(out[i].name, d.name, NAME_MAX_LENGTH);
+		for (int b=0; b<DIRECT_BLOCKS_COUNT; b++) {
+			out[i].direct_blocks[b] = le32(d.direct_blocks[b]);
+		}
+		out[i].parent = le32(d.parent);
+		out[i].mtime = le64(d.mtime);
+		out[i].ctime = le64(d.ctime);
+		out[i].change_seq = le64(d.change_seq);
+	}
+}
+
+void image_block_encode(const data_block* in, disk_block* out){
+	out->size = le64(in->size);
+	memcpy(out->block, in->block, BLOCK_SIZE);
+}
+
+void image_block_decode(const disk_block* in, data_block* out){
+	out->size = le64(in->size);
+	memcpy(out->block, in->block, BLOCK_SIZE);
+}
+
+uint32_t image_inodes_crc(const inode* inodes, uint32_t count){
+	if(IMAGE_NATIVE_INODES){
+		return crc32c(0, inodes, (size_t)count * sizeof(disk_inode));
+	}
+	uint32_t crc = 0;
+	disk_inode records[IMAGE_BATCH];
+	for (uint32_t i=0; i<count; i += IMAGE_BATCH) {
+		uint32_t batch = count - i < IMAGE_BATCH ? count - i : IMAGE_BATCH;
+		image_inodes_encode(&inodes[i], records, batch);
+		crc = crc32c(crc, records, batch * sizeof(disk_inode));
+	}
+	return crc;
+}
+
+uint32_t image_block_crc(const data_block* block){
+	if(IMAGE_NATIVE_BLOCKS){
+		return crc32c(0, block, sizeof(disk_block));
+	}
+	disk_block record;
+	image_block_encode(block, &record);
+	return crc32c(0, &record, sizeof(disk_block));
+}
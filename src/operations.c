@@ -1,128 +1,322 @@
+#include "../lib/alloc.h"
+#include "../lib/arena.h"
+#include "../lib/delta.h"
+#include "../lib/epoch.h"
 #include "../lib/operations.h"
+#include "../lib/span.h"
+#include "../lib/stats.h"
+#include "../lib/sweeper.h"
+#include "../lib/trace.h"
+#include <fcntl.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 /* ***** ***** ***** *****  HELPER  ***** ***** ***** ***** */
-// Helper function to find inode from filepath
-int
-find_inode(file_system* fs, char* path) {
-    int curr_inode = fs->root_node;
-    char* token = strtok(path, "/");
-    while (token != NULL) {
-        int found = 0;
-        for (int i = 0; i < DIRECT_BLOCKS_COUNT; i++) {
-            int inode_num = fs->inodes[curr_inode].direct_blocks[i];
-            if (inode_num != -1) {
-                inode* next_inode = &fs->inodes[inode_num];
-                if (strcmp(next_inode->name, token) == 0) {
-                    curr_inode = inode_num;
-                    found = 1;
-                    break;
-                }
+// Helper function for lookup_child, also hands out the copy of the entry that matched
+static int
+lookup_child_copy(file_system* fs, int dir_num, const char* name, enum node_type type, inode* out) {
+    // Works on copies, so a concurrent writer never shows a half changed entry
+    inode dir;
+    inode_read(fs, dir_num, &dir);
+    if (dir.n_type != directory) {
+        return -1;
+    }
+    for (int i = 0; i < DIRECT_BLOCKS_COUNT; i++) {
+        int inode_num = dir.direct_blocks[i];
+        if (inode_num != -1) {
+            inode_read(fs, inode_num, out);
+            if (strncmp(out->name, name, NAME_MAX_LENGTH) == 0 &&
+                (type == 0 ? out->n_type != free_block : out->n_type == type)) {
+                return inode_num;
             }
         }
-        if (!found) {
-            return -1; // Directory or file not found
+    }
+    return -1;
+}
+
+// Helper function to find inode from filepath, *out is the copy of the inode the walk ended at
+static int
+walk_path(file_system* fs, char* path, inode* out) {
+    int curr_inode = fs->root_node;
+    inode_read(fs, curr_inode, out);
+    char* save = NULL;
+    char* token = strtok_r(path, "/", &save);
+    int depth = 0;
+    while (token != NULL) {
+        curr_inode = lookup_child_copy(fs, curr_inode, token, 0, out);
+        depth++;
+        if (curr_inode == -1) {
+            break; // Directory or file not found
         }
-        token = strtok(NULL, "/");
+        token = strtok_r(NULL, "/", &save);
     }
+    stats_value(stats_walk_depth, depth);
     return curr_inode;
 }
 
+// Helper function to find inode from filepath
+int
+find_inode(file_system* fs, char* path) {
+    inode found;
+    return walk_path(fs, path, &found);
+}
+
 // Helper function to remove inode with inode idx from file-system
 void
 remove_inode(file_system* fs, int inode_num) {
+    span s;
+    span_begin(&s, "remove_inode");
     inode* curr_inode = &fs->inodes[inode_num];
 
+    // The inode is detached already, only readers that found it before can still look at it
     if (curr_inode->n_type == directory) {
-        // Remove all subdirectories and files recursively
-        for (int i = 0; i < DIRECT_BLOCKS_COUNT; i++) {
-            int sub_inode_num = curr_inode->direct_blocks[i];
-            if (sub_inode_num != -1) {
-                remove_inode(fs, sub_inode_num);
-            }
-        }
-    }
-
-    // Clear the inode
-    memset(curr_inode, 0, sizeof(inode));
-    curr_inode->n_type = 3;
-    curr_inode->direct_blocks[0] = -1;
-    fs->free_list[0] = 1;
+        // Remove all subdirectories and files recursively. Once detached the directory
+        // takes no more creates, so no entry is added behind the copy.
+        int entries[DIRECT_BLOCKS_COUNT];
+        int count = inode_detach(fs, inode_num, entries);
+        for (int i = 0; i < count; i++) {
+            remove_inode(fs, entries[i]);
+        }
+    } else if (curr_inode->n_type == reg_file) {
+        // Give the data blocks of the file back to the free list
+        fs_epoch_retire_file(fs, inode_num);
+        span_end(&s);
+        return;
+    }
+
+    // Clear the inode once no reader can look at it anymore
+    fs_epoch_retire(fs, NULL, 0, inode_num);
+    span_end(&s);
 }
 
 // Helper function to remove inode from parent dir
-void
+int
 remove_inode_from_parent_directory(file_system* fs, int parent_inode_num, int inode_num) {
     inode* parent_inode = &fs->inodes[parent_inode_num];
+    int removed = 0;
 
+    inode_write_begin(fs, parent_inode_num);
     for (int i = 0; i < DIRECT_BLOCKS_COUNT; i++) {
         if (parent_inode->direct_blocks[i] == inode_num) {
             parent_inode->direct_blocks[i] = -1; // Clear the entry
-            parent_inode->n_type = 3;
+            removed = 1;
             break;
         }
     }
+    if (removed) {
+        inode_touch(fs, parent_inode_num, 1);
+    }
+    inode_write_end(fs, parent_inode_num);
+    return removed;
 }
 
 // Helper function to find the directory inode index given the path
 int
 find_parent_directory(file_system* fs, char* path) {
     // Separate the path into directory names
-    char* token = strtok(path, "/");
+    char* save = NULL;
+    char* token = strtok_r(path, "/", &save);
     int parent_inode_num = fs->root_node;
+    int depth = 0;
 
     // Traverse the path to find the parent directory
     while (token != NULL) {
-        int found = 0;
-        for (int i = 0; i < DIRECT_BLOCKS_COUNT; i++) {
-            int inode_num = fs->inodes[parent_inode_num].direct_blocks[i];
-            if (inode_num != -1) {
-                inode* curr_inode = &fs->inodes[inode_num];
-                if (strcmp(curr_inode->name, token) == 0) {
-                    if (curr_inode->n_type == directory) {
-                        parent_inode_num = inode_num;
-                        found = 1;
-                        break;
-                    } else {
-                        return -1;
-                    }
-                }
+        parent_inode_num = lookup_child(fs, parent_inode_num, token, directory);
+        depth++;
+        if (parent_inode_num == -1) {
+            break;
+        }
+        token = strtok_r(NULL, "/", &save);
+    }
+
+    stats_value(stats_walk_depth, depth);
+    return parent_inode_num;
+}
+
+// Helper function to find free data block into the file-system
+int
+find_free_data_block(file_system* fs) {
+    return alloc_block_near(fs, 0);
+}
+
+int
+lookup_child(file_system* fs, int dir_num, const char* name, enum node_type type) {
+    inode entry;
+    return lookup_child_copy(fs, dir_num, name, type, &entry);
+}
+
+int
+create_inode(file_system* fs, int parent_num, const char* name, enum node_type type) {
+    inode* parent_dir = &fs->inodes[parent_num];
+    if (name[0] == '\0' || strlen(name) >= NAME_MAX_LENGTH) {
+        return -1;
+    }
+
+    // Check for the name and find a free entry in the parent before taking an inode,
+    // both under the seqlock of the parent, so two creates of one name can't both pass
+    inode_write_begin(fs, parent_num);
+    if (parent_dir->parent == -1 && parent_num != fs->root_node) {
+        inode_write_end(fs, parent_num);
+        return -1; // Directory is being removed, see inode_detach
+    }
+    int entry = -1;
+    for (int i = 0; i < DIRECT_BLOCKS_COUNT; i++) {
+        int child_num = parent_dir->direct_blocks[i];
+        if (child_num == -1) {
+            if (entry == -1) {
+                entry = i;
             }
+            continue;
+        }
+        inode child;
+        inode_read(fs, child_num, &child);
+        if (child.n_type == type && strncmp(child.name, name, NAME_MAX_LENGTH) == 0) {
+            inode_write_end(fs, parent_num);
+            return -2; // Already exists
         }
+    }
+    if (entry == -1) {
+        inode_write_end(fs, parent_num);
+        return -1; // Directory is full
+    }
 
-        if (!found) {
+    // Files stay in the allocation group of their directory
+    int new_inode_num;
+    while (1) {
+        new_inode_num = find_free_inode_near(fs, parent_num, type);
+        if (new_inode_num == -1) {
+            inode_write_end(fs, parent_num);
             return -1;
         }
+        inode_write_begin(fs, new_inode_num);
+        if (fs->inodes[new_inode_num].n_type == free_block) {
+            break;
+        }
+        inode_write_end(fs, new_inode_num); // Taken by a concurrent create in another directory
+    }
+
+    // The inode is complete before the parent points to it
+    inode* new_inode = &fs->inodes[new_inode_num];
+    new_inode->n_type = type;
+    new_inode->size = 0;
+    strcpy(new_inode->name, name);
+    new_inode->parent = parent_num;
+    inode_touch(fs, new_inode_num, 1);
+    inode_write_end(fs, new_inode_num);
+    parent_dir->direct_blocks[entry] = new_inode_num;
+    inode_touch(fs, parent_num, 1);
+    inode_write_end(fs, parent_num);
+
+    return new_inode_num;
+}
 
-        token = strtok(NULL, "/");
+// Helper function for append_inode, the seqlock of the inode is held
+static int
+append_blocks(file_system* fs, int inode_num, const char* text, int len) {
+    inode* file_inode = &fs->inodes[inode_num];
+
+    // Find the last used data block index
+    int last_block_idx = DIRECT_BLOCKS_COUNT - 1;
+    for (int i = 0; i < DIRECT_BLOCKS_COUNT; i++) {
+        if (file_inode->direct_blocks[i] == -1) {
+            last_block_idx = i - 1;
+            break;
+        }
     }
 
-    return parent_inode_num;
+    // Calculate the total size of the text to be appended
+    int total_text_len = len;
+    int chars_written = 0;
+
+    // Iterate over the existing data blocks
+    for (int i = 0; i <= last_block_idx; i++) {
+        int block_num = file_inode->direct_blocks[i];
+        data_block* block = &fs->data_blocks[block_num];
+        if (verify_block(fs, block_num) != 0) {
+            return -1;
+        }
+        int remaining_space = BLOCK_SIZE - block->size;
+
+        if (remaining_space > 0) {
+            // There is remaining space in the block
+            int text_len = (total_text_len > remaining_space) ? remaining_space : total_text_len;
+
+            memcpy(block->block + block->size, text, text_len);
+            block->size += text_len;
+            delta_mark_block(fs, block_num);
+            file_inode->size += text_len;
+            chars_written += text_len;
+
+            text += text_len;
+            total_text_len -= text_len;
+
+            if (total_text_len == 0) {
+                // All text has been written
+                return chars_written;
+            }
+        }
+    }
+
+    // If there is more text to be written, allocate new data blocks
+    while (total_text_len > 0) {
+        // Check that the file has room for another data block
+        if (last_block_idx == DIRECT_BLOCKS_COUNT - 1) {
+            return -2;
+        }
+
+        // Find a free data block, close to the inode of the file
+        int new_block_num = alloc_block_near(fs, inode_num);
+        if (new_block_num == -1) {
+            return -2;
+        }
+
+        // Update the file inode with the new data block
+        last_block_idx++;
+        file_inode->direct_blocks[last_block_idx] = new_block_num;
+
+        // Write as much text as possible to the new block
+        data_block* new_block = &fs->data_blocks[new_block_num];
+        int remaining_space = BLOCK_SIZE;
+        int copy_len = (total_text_len > remaining_space) ? remaining_space : total_text_len;
+        file_inode->size += copy_len;
+
+        memcpy(new_block->block, text, copy_len);
+        new_block->size = copy_len;
+        delta_mark_block(fs, new_block_num);
+        chars_written += copy_len;
+
+        text += copy_len;
+        total_text_len -= copy_len;
+    }
+
+    return chars_written;
 }
 
-// Helper function to find free data block into the file-system
 int
-find_free_data_block(file_system* fs) {
-    // Iterate over data blocks and find the first free data block
-    for (int i = 0; i < fs->s_block->num_blocks; i++) {
-        if (fs->free_list[i]) {
-            fs->free_list[i] = 0; // Mark the data block as used
-            fs->s_block->free_blocks--;
-            return i;
-        }
+append_inode(file_system* fs, int inode_num, const char* text, int len) {
+    inode_write_begin(fs, inode_num);
+    if (fs->inodes[inode_num].parent == -1) {
+        inode_write_end(fs, inode_num);
+        return -1; // Removed since it was looked up
     }
-    return -1; // No free data block found
+    int result = append_blocks(fs, inode_num, text, len);
+    if (result > 0) {
+        inode_touch(fs, inode_num, 1);
+    }
+    inode_write_end(fs, inode_num);
+    return result;
 }
 
 /**********************************************************************************************************************************************/
 
 /* ***** ***** ***** *****  OPERATIONS  ***** ***** ***** ***** */
-int
-fs_mkdir(file_system* fs, char* path) {
+// Helper function for fs_mkdir
+static int
+make_dir(file_system* fs, char* path) {
     if (path[0] != '/') {
         printf("[ERROR] Path should be start '/'\n");
         return -1;
@@ -141,65 +335,36 @@ fs_mkdir(file_system* fs, char* path) {
     }
 
     // Find the parent directory or assume root as the parent if the parent_path is NULL
-    inode* parent_dir = &fs->inodes[fs->root_node];
+    int parent_num = fs->root_node;
     if (parent_path != NULL) {
-        char* token = strtok(parent_path, "/");
-        while (token != NULL) {
-            int found = 0;
-            for (int i = 0; i < DIRECT_BLOCKS_COUNT; i++) {
-                int inode_num = parent_dir->direct_blocks[i];
-                if (inode_num != -1) {
-                    inode* curr_inode = &fs->inodes[inode_num];
-                    if (strcmp(curr_inode->name, token) == 0 && curr_inode->n_type == directory) {
-                        parent_dir = curr_inode;
-                        found = 1;
-                        break;
-                    }
-                }
-            }
-            if (!found) {
-                return -1;
-            }
-            token = strtok(NULL, "/");
+        parent_num = find_parent_directory(fs, parent_path);
+        if (parent_num == -1) {
+            return -1;
         }
     }
 
-    // Check if the directory already exists in the parent directory
-    for (int i = 0; i < DIRECT_BLOCKS_COUNT; i++) {
-        int inode_num = parent_dir->direct_blocks[i];
-        if (inode_num != -1) {
-            inode* curr_inode = &fs->inodes[inode_num];
-            if (strcmp(curr_inode->name, dir_name) == 0 && curr_inode->n_type == directory) {
-                return -1;
-            }
-        }
-    }
-    int new_inode_num = find_free_inode(fs);
-    if (new_inode_num == -1) {
+    // Create the new directory inode, fails if the directory already exists
+    if (create_inode(fs, parent_num, dir_name, directory) < 0) {
         return -1;
     }
-    fs->free_list[new_inode_num] = 0;
-
-    // Create the new directory inode
-    inode* new_dir = &fs->inodes[new_inode_num];
-    new_dir->n_type = directory;
-    new_dir->size = 0;
-    strcpy(new_dir->name, dir_name);
-    new_dir->parent = parent_dir - fs->inodes; // Calculate parent inode number
-
-    // Update the parent directory entry
-    for (int i = 0; i < DIRECT_BLOCKS_COUNT; i++) {
-        if (parent_dir->direct_blocks[i] == -1) {
-            parent_dir->direct_blocks[i] = new_inode_num;
-            break;
-        }
-    }
 
     return 0;
 }
 
 int
-fs_mkfile(file_system* fs, char* path_and_name) {
+fs_mkdir(file_system* fs, char* path) {
+    trace_call call;
+    trace_begin(&call, path);
+    uint64_t start = stats_start();
+    int result = make_dir(fs, path);
+    stats_finish(stats_mkdir, start);
+    trace_end(&call, trace_mkdir, NULL, 0, result);
+    return result;
+}
+
+// Helper function for fs_mkfile
+static int
+make_file(file_system* fs, char* path_and_name) {
     // Find the last occurrence of '/' to separate the path and filename
     char* last_slash = strrchr(path_and_name, '/');
     if (last_slash == NULL) {
@@ -209,39 +374,9 @@ fs_mkfile(file_system* fs, char* path_and_name) {
             printf("[ERROR] Path should be start '/'\n");
             return -1;
         }
-        // Check if the file already exists in the root directory
-        for (int i = 0; i < DIRECT_BLOCKS_COUNT; i++) {
-            int inode_num = fs->inodes[fs->root_node].direct_blocks[i];
-            if (inode_num != -1) {
-                inode* curr_inode = &fs->inodes[inode_num];
-                if (strcmp(curr_inode->name, filename) == 0 && curr_inode->n_type == reg_file) {
-                    return -2;
-                }
-            }
-        }
-
-        // Find a free inode for the new file
-        int new_inode_num = find_free_inode(fs);
-        if (new_inode_num == -1) {
-            return -1;
-        }
-
-        // Create the new file inode in the root directory
-        inode* new_file = &fs->inodes[new_inode_num];
-        new_file->n_type = reg_file;
-        new_file->size = 0;
-        strcpy(new_file->name, filename);
-        new_file->parent = fs->root_node;
-
-        // Update the root directory entry
-        for (int i = 0; i < DIRECT_BLOCKS_COUNT; i++) {
-            if (fs->inodes[fs->root_node].direct_blocks[i] == -1) {
-                fs->inodes[fs->root_node].direct_blocks[i] = new_inode_num;
-                break;
-            }
-        }
-
-        return 0;
+        // Create the new file inode in the root directory, -2 if the file already exists
+        int file_num = create_inode(fs, fs->root_node, filename, reg_file);
+        return file_num < 0 ? file_num : 0;
     }
 
     if (path_and_name[0] != '/') {
@@ -254,399 +389,555 @@ fs_mkfile(file_system* fs, char* path_and_name) {
     char* path = path_and_name;
     char* filename = last_slash + 1;
 
-    // Find the parent directory or create it if it doesn't exist
-    inode* parent_dir = &fs->inodes[fs->root_node];
-    char* token = strtok(path, "/");
-    while (token != NULL) {
-        int found = 0;
-        for (int i = 0; i < DIRECT_BLOCKS_COUNT; i++) {
-            int inode_num = parent_dir->direct_blocks[i];
-            if (inode_num != -1) {
-                inode* curr_inode = &fs->inodes[inode_num];
-                if (strcmp(curr_inode->name, token) == 0 && curr_inode->n_type == directory) {
-                    parent_dir = curr_inode;
-                    found = 1;
-                    break;
-                }
-            }
-        }
-        if (!found) {
-            // Parent directory does not exist
-            return -1;
-        }
-        token = strtok(NULL, "/");
+    // Find the parent directory
+    int parent_num = find_parent_directory(fs, path);
+    if (parent_num == -1) {
+        // Parent directory does not exist
+        return -1;
     }
 
-    // Check if the file already exists in the parent directory
-    for (int i = 0; i < DIRECT_BLOCKS_COUNT; i++) {
-        int inode_num = parent_dir->direct_blocks[i];
-        if (inode_num != -1) {
-            inode* curr_inode = &fs->inodes[inode_num];
-            if (strcmp(curr_inode->name, filename) == 0 && curr_inode->n_type == reg_file) {
-                return -2;
-            }
-        }
-    }
+    // Create the new file inode, -2 if the file already exists
+    int file_num = create_inode(fs, parent_num, filename, reg_file);
+    return file_num < 0 ? file_num : 0;
+}
 
-    // Find a free inode for the new file
-    int new_inode_num = find_free_inode(fs);
-    if (new_inode_num == -1) {
+int
+fs_mkfile(file_system* fs, char* path_and_name) {
+    trace_call call;
+    trace_begin(&call, path_and_name);
+    uint64_t start = stats_start();
+    int result = make_file(fs, path_and_name);
+    stats_finish(stats_mkfile, start);
+    trace_end(&call, trace_mkfile, NULL, 0, result);
+    return result;
+}
+
+int
+fs_opendir(file_system* fs, char* path, fs_dir* dir) {
+    fs_epoch_enter(fs);
+    int dir_num = find_parent_directory(fs, path);
+    fs_epoch_exit(fs);
+    if (dir_num == -1) {
         return -1;
     }
+    dir->fs = fs;
+    dir->dir_num = dir_num;
+    dir->next = 0;
+    return 0;
+}
 
-    // Create the new file inode
-    inode* new_file = &fs->inodes[new_inode_num];
-    new_file->n_type = reg_file;
-    new_file->size = 0;
-    strcpy(new_file->name, filename);
-    new_file->parent = parent_dir - fs->inodes;
+// Helper function for fs_readdir and fs_readdir_plus, copies the next entries of the cursor
+static int
+next_entries(fs_dir* dir, int* nums, inode* copies, int max) {
+    file_system* fs = dir->fs;
+    int count = 0;
 
-    // Update the parent directory entry
-    for (int i = 0; i < DIRECT_BLOCKS_COUNT; i++) {
-        if (parent_dir->direct_blocks[i] == -1) {
-            parent_dir->direct_blocks[i] = new_inode_num;
-            break;
+    // Copy the directory and the entries of the batch without locking
+    fs_epoch_enter(fs);
+    inode curr_dir;
+    inode_read(fs, dir->dir_num, &curr_dir);
+    if (curr_dir.n_type != directory) {
+        fs_epoch_exit(fs);
+        return -1; // Removed since fs_opendir
+    }
+    // The child inodes are scattered over the table, their loads are started together
+    for (int i = dir->next; i < DIRECT_BLOCKS_COUNT; i++) {
+        if (curr_dir.direct_blocks[i] != -1) {
+            __builtin_prefetch(&fs->inodes[curr_dir.direct_blocks[i]]);
+            __builtin_prefetch(&fs->inode_seq[curr_dir.direct_blocks[i]]);
         }
     }
-
-    return 0;
-}
-
-char*
-fs_list(file_system* fs, char* path) {
-    // Find the directory specified by the path
-    inode* curr_dir = &fs->inodes[fs->root_node];
-    char* token = strtok(path, "/");
-    while (token != NULL) {
-        int found = 0;
-        for (int i = 0; i < DIRECT_BLOCKS_COUNT; i++) {
-            int inode_num = curr_dir->direct_blocks[i];
-            if (inode_num != -1) {
-                inode* next_dir = &fs->inodes[inode_num];
-                if (strcmp(next_dir->name, token) == 0 && next_dir->n_type == directory) {
-                    curr_dir = next_dir;
-                    found = 1;
-                    break;
-                }
-            }
+    while (dir->next < DIRECT_BLOCKS_COUNT && count < max) {
+        int inode_num = curr_dir.direct_blocks[dir->next++];
+        if (inode_num == -1) {
+            continue;
         }
-        if (!found) {
-            return NULL;
+        inode_read(fs, inode_num, &copies[count]);
+        if (copies[count].n_type == directory || copies[count].n_type == reg_file) {
+            nums[count++] = inode_num;
         }
-        token = strtok(NULL, "/");
     }
+    fs_epoch_exit(fs);
 
-    // Count the number of entries in the directory
-    int num_entries = 0;
-    for (int i = 0; i < DIRECT_BLOCKS_COUNT; i++) {
-        int inode_num = curr_dir->direct_blocks[i];
-        if (inode_num != -1) {
-            inode* entry_inode = &fs->inodes[inode_num];
-            if (entry_inode->n_type == directory || entry_inode->n_type == reg_file) {
-                num_entries++;
-            }
-        }
+    return count;
+}
+
+int
+fs_readdir(fs_dir* dir, fs_dirent* entries, int max) {
+    int nums[DIRECT_BLOCKS_COUNT];
+    inode copies[DIRECT_BLOCKS_COUNT];
+    int count = next_entries(dir, nums, copies, MIN(max, DIRECT_BLOCKS_COUNT));
+    for (int i = 0; i < count; i++) {
+        entries[i].inode_num = nums[i];
+        entries[i].type = copies[i].n_type;
+        entries[i].size = copies[i].size;
+        memcpy(entries[i].name, copies[i].name, NAME_MAX_LENGTH);
+        entries[i].name[NAME_MAX_LENGTH] = '\0';
+    }
+    return count;
+}
+
+int
+fs_readdir_plus(fs_dir* dir, fs_dirent_plus* entries, int max) {
+    int nums[DIRECT_BLOCKS_COUNT];
+    inode copies[DIRECT_BLOCKS_COUNT];
+    int count = next_entries(dir, nums, copies, MIN(max, DIRECT_BLOCKS_COUNT));
+    for (int i = 0; i < count; i++) {
+        entries[i].inode_num = nums[i];
+        entries[i].info = copies[i];
+        // The direct blocks of a directory are its entries, not data
+        entries[i].blocks = 0;
+        for (int j = 0; j < DIRECT_BLOCKS_COUNT && copies[i].n_type == reg_file; j++) {
+            entries[i].blocks += copies[i].direct_blocks[j] != -1;
+        }
+    }
+    return count;
+}
+
+// Helper function for fs_list, prints the listing into buf like snprintf
+static int
+list_dir(file_system* fs, char* path, char* buf, size_t size) {
+    fs_dir dir;
+    if (fs_opendir(fs, path, &dir) == -1) {
+        return -1;
     }
 
-    // Allocate memory for the result string
-    int result_size = num_entries * (NAME_MAX_LENGTH + 10); // Assuming max length of entry name + 10 characters for "DIR " or "FILE"
-    char* result = (char*)malloc((result_size + 1) * sizeof(char));
-    result[0] = '\0';
+    // A batch covers the whole directory, so the listing is one consistent copy
+    fs_dirent entries[DIRECT_BLOCKS_COUNT];
+    int num_entries = fs_readdir(&dir, entries, DIRECT_BLOCKS_COUNT);
+    if (num_entries == -1) {
+        return -1;
+    }
 
-    // Concatenate the directory entries to the result string
-    for (int i = 0; i < DIRECT_BLOCKS_COUNT; i++) {
-        int inode_num = curr_dir->direct_blocks[i];
-        if (inode_num != -1) {
-            inode* entry_inode = &fs->inodes[inode_num];
-            if (entry_inode->n_type == directory) {
-                snprintf(result + strlen(result), result_size - strlen(result), "DIR %s\n", entry_inode->name);
-            } else if (entry_inode->n_type == reg_file) {
-                snprintf(result + strlen(result), result_size - strlen(result), "FIL %s\n", entry_inode->name);
-            }
-        }
+    // Print the directory entries, the length is counted on even if buf is full
+    size_t length = 0;
+    for (int i = 0; i < num_entries; i++) {
+        length += snprintf(length < size ? buf + length : NULL, length < size ? size - length : 0, "%s %s\n",
+                           entries[i].type == directory ? "DIR" : "FIL", entries[i].name);
+    }
+    if (num_entries == 0 && size > 0) {
+        buf[0] = '\0';
     }
 
-    return result;
+    return length;
 }
 
 int
-fs_writef(file_system* fs, char* filepath, char* text) {
+fs_list_into(file_system* fs, char* path, char* buf, size_t size) {
+    trace_call call;
+    trace_begin(&call, path);
+    uint64_t start = stats_start();
+    int result = list_dir(fs, path, buf, size);
+    stats_finish(stats_list, start);
+    trace_end(&call, trace_list, NULL, MAX(result, 0), result != -1 ? 0 : -1);
+    return result;
+}
+
+char*
+fs_list(file_system* fs, char* path) {
+    // The listing is bounded, so it is printed on the stack and copied out at its exact size
+    char listing[LIST_MAX_LENGTH + 1];
+    int length = fs_list_into(fs, path, listing, sizeof(listing));
+    if (length == -1) {
+        return NULL;
+    }
+    char* result = malloc(length + 1);
+    if (result == NULL) {
+        return NULL;
+    }
+    memcpy(result, listing, length + 1);
+    return result;
+}
+
+// Helper function to find the regular file a path points to, the path is copied into the arena
+static int
+find_file(file_system* fs, arena* a, const char* filepath) {
     // Separate the path and filename
-    char* path = strdup(filepath);
+    char* path = arena_strdup(a, filepath);
     char* filename = strrchr(path, '/');
+    int parent_inode_num = fs->root_node;
     if (filename != NULL) {
         *filename = '\0';  // Terminate the path string at the last '/'
         filename++;  // Skip the '/' character
-    } else {
-        // No directory path specified, use the root directory
-        filename = path;
-        path = NULL;
-    }
-
-    // Find the parent directory inode
-    int parent_inode_num;
-    if (path == NULL) {
-        parent_inode_num = fs->root_node;
-    } else {
         parent_inode_num = find_parent_directory(fs, path);
         if (parent_inode_num == -1) {
-            free(path);
             return -1;
         }
+    } else {
+        // No directory path specified, use the root directory
+        filename = path;
     }
 
     // Find the inode of the file
-    int file_inode_num = -1;
-    inode* parent_inode = &fs->inodes[parent_inode_num];
-    for (int i = 0; i < DIRECT_BLOCKS_COUNT; i++) {
-        int inode_num = parent_inode->direct_blocks[i];
-        if (inode_num != -1) {
-            inode* curr_inode = &fs->inodes[inode_num];
-            if (strcmp(curr_inode->name, filename) == 0) {
-                file_inode_num = inode_num;
-                break;
-            }
-        }
-    }
+    return lookup_child(fs, parent_inode_num, filename, reg_file);
+}
 
+// Helper function for fs_writef, runs inside a read side section
+static int
+write_file(file_system* fs, arena* a, char* filepath, char* text) {
+    int file_inode_num = find_file(fs, a, filepath);
     if (file_inode_num == -1) {
-        free(path);
         return -1;
     }
 
-    free(path);
+    return append_inode(fs, file_inode_num, text, strlen(text));
+}
 
-    inode* file_inode = &fs->inodes[file_inode_num];
-    if (file_inode->n_type != reg_file) {
-        return -1;
-    }
+int
+fs_writef(file_system* fs, char* filepath, char* text) {
+    trace_call call;
+    trace_begin(&call, filepath);
+    uint64_t start = stats_start();
+    uint8_t space[ARENA_STACK_SIZE];
+    arena a;
+    arena_init(&a, space, sizeof(space));
+    // The blocks of the file must not be reused while they are appended to
+    fs_epoch_enter(fs);
+    int result = write_file(fs, &a, filepath, text);
+    fs_epoch_exit(fs);
+    arena_release(&a);
+    if (result > 0) {
+        stats_add(stats_bytes_written, result);
+    }
+    stats_finish(stats_writef, start);
+    trace_end(&call, trace_writef, NULL, call.path != NULL ? strlen(text) : 0, result);
+    return result;
+}
 
-    // Find the last used data block index
-    int last_block_idx = -1;
-    for (int i = 0; i < DIRECT_BLOCKS_COUNT; i++) {
-        if (file_inode->direct_blocks[i] == -1) {
-            last_block_idx = i - 1;
-            break;
-        }
+// Helper function for fs_readf, runs inside a read side section.
+// Copies at most size bytes into buf and returns the file size
+static int
+read_file(file_system* fs, arena* a, char* filepath, uint8_t* buf, size_t size) {
+    int file_inode_num = find_file(fs, a, filepath);
+    if (file_inode_num == -1) {
+        return -1;
     }
 
-    // Calculate the total size of the text to be appended
-    int total_text_len = strlen(text);
-    int chars_written = 0;
-
-    // Iterate over the existing data blocks
-    for (int i = 0; i <= last_block_idx; i++) {
-        int block_num = file_inode->direct_blocks[i];
-        data_block* block = &fs->data_blocks[block_num];
-        int remaining_space = BLOCK_SIZE - block->size;
-
-        if (remaining_space > 0) {
-            // There is remaining space in the block
-            int text_len = (total_text_len > remaining_space) ? remaining_space : total_text_len;
-
-            memcpy(block->block + block->size, text, text_len);
-            block->size += text_len;
-            chars_written += text_len;
-
-            text += text_len;
-            total_text_len -= text_len;
+    // Work on a copy of the block list. Appends and defrag may change the inode meanwhile,
+    // the read is repeated if one did
+    inode file_copy;
+    inode* file_inode = &file_copy;
+    while (1) {
+        uint32_t seq = inode_read(fs, file_inode_num, &file_copy);
 
-            if (total_text_len == 0) {
-                // All text has been written
-                return chars_written;
+        // Calculate the file size. The block sizes are kept, an append may grow the last block meanwhile
+        int block_sizes[DIRECT_BLOCKS_COUNT];
+        int file_size = 0;
+        int corrupt = 0;
+        for (int i = 0; i < DIRECT_BLOCKS_COUNT; i++) {
+            int block_num = file_inode->direct_blocks[i];
+            if (block_num != -1) {
+                if (verify_block(fs, block_num) != 0) {
+                    corrupt = 1;
+                    break;
+                }
+                data_block* block = &fs->data_blocks[block_num];
+                block_sizes[i] = MIN(__atomic_load_n(&block->size, __ATOMIC_RELAXED), BLOCK_SIZE);
+                file_size += block_sizes[i];
             }
         }
-    }
-
-    // If there is more text to be written, allocate new data blocks
-    while (total_text_len > 0) {
-        // Find a free data block
-        int new_block_num = find_free_data_block(fs);
-        if (new_block_num == -1) {
-            return -2;
+        if (corrupt) {
+            if (inode_changed(fs, file_inode_num, seq)) {
+                continue; // The block was checked while it moved
+            }
+            return -1; // Corrupt data block
+        }
+
+        // Read the file into the buffer
+        size_t copied = 0;
+        for (int i = 0; i < DIRECT_BLOCKS_COUNT && copied < size; i++) {
+            int block_num = file_inode->direct_blocks[i];
+            if (block_num != -1) {
+                data_block* block = &fs->data_blocks[block_num];
+                size_t n = MIN((size_t)block_sizes[i], size - copied);
+                memcpy(buf + copied, block->block, n);
+                copied += n;
+            }
         }
 
-        // Update the file inode with the new data block
-        if (last_block_idx == DIRECT_BLOCKS_COUNT - 1) {
-            return -2;
+        if (!inode_changed(fs, file_inode_num, seq)) {
+            return file_size;
         }
-
-        last_block_idx++;
-        file_inode->direct_blocks[0] = 0;
-        file_inode->direct_blocks[last_block_idx] = new_block_num;
-
-        // Write as much text as possible to the new block
-        data_block* new_block = &fs->data_blocks[new_block_num];
-        int remaining_space = BLOCK_SIZE;
-        int copy_len = (total_text_len > remaining_space) ? remaining_space : total_text_len;
-        file_inode->size += copy_len;
-
-        memcpy(new_block->block, text, copy_len);
-        new_block->size = copy_len;
-        chars_written += copy_len;
-
-        text += copy_len;
-        total_text_len -= copy_len;
     }
+}
 
-    return chars_written;
+int
+fs_readf_into(file_system* fs, char* filepath, uint8_t* buf, size_t size) {
+    trace_call call;
+    trace_begin(&call, filepath);
+    uint64_t start = stats_start();
+    uint8_t space[ARENA_STACK_SIZE];
+    arena a;
+    arena_init(&a, space, sizeof(space));
+    // Freed blocks are not reused before the read is done
+    fs_epoch_enter(fs);
+    int result = read_file(fs, &a, filepath, buf, size);
+    fs_epoch_exit(fs);
+    arena_release(&a);
+    if (result > 0) {
+        stats_add(stats_bytes_read, MIN((size_t)result, size));
+    }
+    stats_finish(stats_readf, start);
+    trace_end(&call, trace_readf, NULL, MAX(result, 0), result);
+    return result;
 }
 
 uint8_t*
 fs_readf(file_system* fs, char* filepath, int* file_size) {
-    // Separate the path and filename
-    char* path = strdup(filepath);
-    char* filename = strrchr(path, '/');
-    if (filename != NULL) {
-        *filename = '\0';  // Terminate the path string at the last '/'
-        filename++;  // Skip the '/' character
-    } else {
-        // No directory path specified, use the root directory
-        filename = path;
-        path = NULL;
-    }
-
-    // Find the parent directory inode
-    int parent_inode_num;
-    if (path == NULL) {
-        parent_inode_num = fs->root_node;
-    } else {
-        parent_inode_num = find_parent_directory(fs, path);
-        if (parent_inode_num == -1) {
-            free(path);
-            return NULL;
-        }
-    }
-
-    // Find the inode of the file
-    int file_inode_num = -1;
-    inode* parent_inode = &fs->inodes[parent_inode_num];
-    for (int i = 0; i < DIRECT_BLOCKS_COUNT; i++) {
-        int inode_num = parent_inode->direct_blocks[i];
-        if (inode_num != -1) {
-            inode* curr_inode = &fs->inodes[inode_num];
-            if (strcmp(curr_inode->name, filename) == 0) {
-                file_inode_num = inode_num;
-                break;
-            }
-        }
-    }
-
-    if (file_inode_num == -1) {
-        free(path);
+    // A file has at most MAX_FILE_SIZE bytes, it is read on the stack and copied out at its exact size
+    uint8_t content[MAX_FILE_SIZE];
+    int size = fs_readf_into(fs, filepath, content, sizeof(content));
+    *file_size = MAX(size, 0);
+    if (size <= 0) {
         return NULL;
     }
-
-    free(path);
-
-    inode* file_inode = &fs->inodes[file_inode_num];
-    if (file_inode->n_type != reg_file) {
+    uint8_t* buffer = malloc(size + 1);
+    if (buffer == NULL) {
         return NULL;
     }
+    memcpy(buffer, content, size);
+    buffer[size] = '\0';
+    return buffer;
+}
 
-    // Calculate the file size
-    *file_size = 0;
-    for (int i = 0; i < DIRECT_BLOCKS_COUNT; i++) {
-        int block_num = file_inode->direct_blocks[i];
-        if (block_num != -1) {
-            data_block* block = &fs->data_blocks[block_num];
-            *file_size += block->size;
-        }
-    }
+int
+fs_stat(file_system* fs, char* path, inode* out) {
+    trace_call call;
+    trace_begin(&call, path);
+    uint64_t start = stats_start();
+    // The copy is the one the name matched on, not a second read that could see a reused inode
+    fs_epoch_enter(fs);
+    int inode_num = walk_path(fs, path, out);
+    fs_epoch_exit(fs);
+    stats_finish(stats_stat, start);
+    trace_end(&call, trace_stat, NULL, 0, inode_num);
+    return inode_num;
+}
 
-    // Allocate memory for the buffer
-    int size = (*file_size) + 1;
-    uint8_t* buffer = (uint8_t*)malloc(sizeof(uint8_t) * size);
-    if (buffer == NULL) {
-        return NULL;
+// Helper function for fs_rm
+static int
+remove_path(file_system* fs, char* path) {
+    inode curr_inode;
+    int inode_num = walk_path(fs, path, &curr_inode);
+    if (inode_num == -1 || inode_num == fs->root_node) {
+        return -1; // File or directory not found, the root can't be removed
     }
-    memset(buffer, '\0', size);
+    int parent_inode_num = curr_inode.parent;
 
-    // Read the file into the buffer
-    uint8_t* ptr = buffer;
-    for (int i = 0; i < DIRECT_BLOCKS_COUNT; i++) {
-        int block_num = file_inode->direct_blocks[i];
-        if (block_num != -1) {
-            data_block* block = &fs->data_blocks[block_num];
-            memcpy(ptr, block->block, block->size);
-            ptr += block->size;
-        }
+    // Remove the inode from its parent directory. Of concurrent removals of one path only
+    // the one that cleared the entry goes on, the others must not free the inode again.
+    if (!remove_inode_from_parent_directory(fs, parent_inode_num, inode_num)) {
+        return -1;
     }
 
-    if (*file_size == 0)
-        return NULL;
+    // Remove the inode and its subdirectories/files recursively,
+    // in the background if a sweeper is running
+    if (fs->sweeper != NULL) {
+        fs_sweeper_submit(fs, inode_num);
+    } else {
+        remove_inode(fs, inode_num);
+    }
 
-    return buffer;
+    return 0; // Removal successful
 }
 
 int
 fs_rm(file_system* fs, char* path) {
-    int inode_num = find_inode(fs, path);
-    if (inode_num == -1) {
-        return -1; // File or directory not found
-    }
+    trace_call call;
+    trace_begin(&call, path);
+    uint64_t start = stats_start();
+    int result = remove_path(fs, path);
+    stats_finish(stats_rm, start);
+    trace_end(&call, trace_rm, NULL, 0, result);
+    return result;
+}
 
-    inode* curr_inode = &fs->inodes[inode_num];
-    int parent_inode_num = curr_inode->parent;
+// Helper function for fs_import, streams the file in block sized chunks
+static int
+import_file(file_system* fs, arena* a, char* int_path, char* ext_path) {
+    int fd = open(ext_path, O_RDONLY);
+    if (fd == -1) {
+        return -1;
+    }
 
-    // Remove the inode from its parent directory
-    remove_inode_from_parent_directory(fs, parent_inode_num, inode_num);
+    // An existing file is appended to
+    fs_mkfile(fs, arena_strdup(a, int_path));
 
-    // Remove the inode and its subdirectories/files recursively
-    remove_inode(fs, inode_num);
+    int written = 0;
+    int failed = 0;
+    char chunk[BLOCK_SIZE];
+    fs_epoch_enter(fs);
+    int file_inode_num = find_file(fs, a, int_path);
+    if (file_inode_num == -1) {
+        failed = 1;
+    }
+    while (!failed) {
+        ssize_t length = read(fd, chunk, sizeof(chunk));
+        if (length <= 0) {
+            failed = length < 0;
+            break;
+        }
+        int result = append_inode(fs, file_inode_num, chunk, length);
+        if (result < 0) {
+            failed = 1;
+        } else {
+            written += result;
+        }
+    }
+    fs_epoch_exit(fs);
+    close(fd);
 
-    return 0; // Removal successful
+    if (written > 0) {
+        stats_add(stats_bytes_written, written);
+    }
+    if (written > 0 && !failed)
+        return 0;
+    return -1;
 }
 
 int
 fs_import(file_system* fs, char* int_path, char* ext_path) {
-    FILE* file = fopen(ext_path, "r"); // Open a file for reading
-    if (file == NULL) {
+    trace_call call;
+    trace_begin(&call, int_path);
+    span s;
+    span_begin(&s, "fs_import");
+    uint8_t space[ARENA_STACK_SIZE];
+    arena a;
+    arena_init(&a, space, sizeof(space));
+    int result = import_file(fs, &a, int_path, ext_path);
+    arena_release(&a);
+    span_end(&s);
+    trace_end(&call, trace_import, ext_path, 0, result);
+    return result;
+}
+
+// Helper function for fs_export
+static int
+export_file(file_system* fs, char* int_path, char* ext_path) {
+    uint8_t content[MAX_FILE_SIZE];
+    int file_size = fs_readf_into(fs, int_path, content, sizeof(content));
+    if (file_size <= 0) {
         return -1;
     }
-    fseek (file, 0, SEEK_END);
-    long length = ftell(file);
-    fseek (file, 0, SEEK_SET);
 
-    char* buffer = malloc (sizeof(char) * (length + 1));
-    memset(buffer, '\0', length + 1);
-    if (length > 0)
-        fread(buffer, sizeof(char), length, file);   
+    // An existing file is not overwritten
+    int fd = open(ext_path, O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if (fd == -1) {
+        return -1;
+    }
 
-    char* copy_path = strdup(int_path);
-    int result = fs_mkfile(fs, copy_path);    
-    result = fs_writef(fs, int_path, buffer);    
+    int result = 0;
+    for (int done = 0; done < file_size;) {
+        ssize_t n = write(fd, content + done, file_size - done);
+        if (n <= 0) {
+            result = -1;
+            break;
+        }
+        done += n;
+    }
+    close(fd);
+    return result;
+}
 
-    fclose(file);
-    free(buffer);
-    free(copy_path);
+int
+fs_export(file_system* fs, char* int_path, char* ext_path) {
+    trace_call call;
+    trace_begin(&call, int_path);
+    span s;
+    span_begin(&s, "fs_export");
+    int result = export_file(fs, int_path, ext_path);
+    span_end(&s);
+    trace_end(&call, trace_export, ext_path, 0, result);
+    return result;
+}
 
-    if (result > 0)
-        return 0;
-    return -1;
+uint64_t
+fs_change_seq(file_system* fs) {
+    return __atomic_load_n(&fs->change_seq, __ATOMIC_RELAXED);
+}
+
+void
+fs_changes_begin(file_system* fs, uint64_t since, fs_changes* changes) {
+    changes->fs = fs;
+    changes->since = since;
+    changes->next = 0;
 }
 
 int
-fs_export(file_system* fs, char* int_path, char* ext_path) {
-    int fileSize = -1;
-    uint8_t* content = fs_readf(fs, int_path, &fileSize);
-    if (content == NULL) {
+fs_changes_next(fs_changes* changes, fs_dirent_plus* entries, int max) {
+    file_system* fs = changes->fs;
+    int count = 0;
+
+    // One pass over the inode table, the copies are taken without locking
+    fs_epoch_enter(fs);
+    while (changes->next < fs->s_block->num_blocks && count < max) {
+        int inode_num = changes->next++;
+        inode copy;
+        inode_read(fs, inode_num, &copy);
+        if (copy.n_type == free_block || copy.change_seq <= changes->since) {
+            continue;
+        }
+        fs_dirent_plus* out = &entries[count++];
+        out->inode_num = inode_num;
+        out->info = copy;
+        out->blocks = 0;
+        for (int j = 0; j < DIRECT_BLOCKS_COUNT && copy.n_type == reg_file; j++) {
+            out->blocks += copy.direct_blocks[j] != -1;
+        }
+    }
+    fs_epoch_exit(fs);
+
+    return count;
+}
+
+// Helper function for fs_inode_path, steps from an inode to its parent. @return the length of its name, -1 if it is gone
+static int
+path_step(file_system* fs, int* curr_num, inode* curr) {
+    if (*curr_num < 0 || (uint32_t)*curr_num >= fs->s_block->num_blocks) {
         return -1;
     }
+    inode_read(fs, *curr_num, curr);
+    if (curr->n_type == free_block) {
+        return -1; // Removed meanwhile
+    }
+    *curr_num = curr->parent;
+    return strnlen(curr->name, NAME_MAX_LENGTH);
+}
 
-    FILE* file = fopen(ext_path, "r");
-    if (file != NULL) {;
-        fclose(file);
-        return -1;
+int
+fs_inode_path(file_system* fs, int inode_num, char* buf, size_t size) {
+    // Removed inodes are not reused before the section ends, so both walks see the same chain
+    fs_epoch_enter(fs);
+    inode curr;
+    int length = 0;
+    int depth = 0;
+    for (int curr_num = inode_num; curr_num != fs->root_node; depth++) {
+        int name_length = path_step(fs, &curr_num, &curr);
+        if (name_length == -1 || depth == (int)fs->s_block->num_blocks) {
+            fs_epoch_exit(fs);
+            return -1;
+        }
+        length += name_length + 1;
+    }
+    if (depth == 0) {
+        length = 1; // The root itself
     }
 
-    file = fopen(ext_path, "w");
-    if (file == NULL) {
-        return -1;
+    // Fill the path in from its end, only if it fits
+    if ((size_t)length < size) {
+        buf[0] = '/';
+        buf[length] = '\0';
+        int pos = length;
+        for (int curr_num = inode_num; curr_num != fs->root_node;) {
+            int name_length = path_step(fs, &curr_num, &curr);
+            pos -= name_length;
+            memcpy(buf + pos, curr.name, name_length);
+            buf[--pos] = '/';
+        }
+    } else if (size > 0) {
+        buf[0] = '\0';
     }
+    fs_epoch_exit(fs);
 
-    fwrite(content, sizeof(char), fileSize, file);
-    free(content);
-    fclose(file);
-    return 0;
-}
\ No newline at end of file
+    return length;
+}
@@ -0,0 +1,177 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../lib/alloc.h"
+#include "../lib/defrag.h"
+#include "../lib/delta.h"
+#include "../lib/epoch.h"
+#include "../lib/filesystem.h"
+#include "../lib/resize.h"
+#include "../lib/sweeper.h"
+#include "../lib/utils.h"
+
+static int used_inode(file_system* fs, uint32_t i){
+	return fs->inodes[i].n_type == directory || fs->inodes[i].n_type == reg_file;
+}
+
+//reallocates every per-block array of the filesystem to num_blocks entries
+static void resize_arrays(file_system* fs, uint32_t num_blocks){
+	uint32_t num_chunks = (num_blocks + INODE_CHUNK - 1) / INODE_CHUNK;
+	uint8_t* free_list = realloc(fs->free_list, num_blocks);
+	inode* inodes = realloc(fs->inodes, num_blocks * sizeof(inode));
+	data_block* data_blocks = realloc(fs->data_blocks, num_blocks * sizeof(data_block));
+	uint32_t* block_crc = realloc(fs->block_crc, num_blocks * sizeof(uint32_t));
+	uint32_t* inode_crc = realloc(fs->inode_crc, num_chunks * sizeof(uint32_t));
+	uint8_t* verified = realloc(fs->verified, num_blocks);
+	uint32_t* inode_seq = realloc(fs->inode_seq, num_blocks * sizeof(uint32_t));
+	if(free_list == NULL || inodes == NULL || data_blocks == NULL ||
+	   block_crc == NULL || inode_crc == NULL || verified == NULL || inode_seq == NULL){
+		exit(1);
+	}
+	fs->free_list = free_list;
+	fs->inodes = inodes;
+	fs->data_blocks = data_blocks;
+	fs->block_crc = block_crc;
+	fs->inode_crc = inode_crc;
+	fs->verified = verified;
+	fs->inode_seq = inode_seq;
+}
+
+static int grow(file_system* fs, uint32_t num_blocks){
+	uint32_t old_size = fs->s_block->num_blocks;
+	resize_arrays(fs, num_blocks);
+
+	for (uint32_t i=old_size; i<num_blocks; i++) {
+		fs->free_list[i] = 1;
+		memset(&fs->inodes[i], 0, sizeof(inode));
+		inode_init(&fs->inodes[i]);
+		memset(&fs->data_blocks[i], 0, sizeof(data_block));
+		fs->verified[i] = 1;
+		fs->inode_seq[i] = 0;
+	}
+	fs->s_block->num_blocks = num_blocks;
+	fs->s_block->free_blocks += num_blocks - old_size;
+	fs_groups_init(fs);
+	return 0;
+}
+
+//moves inode from to the free slot to and redirects every reference to it
+static void move_inode(file_system* fs, int from, int to){
+	inode_write_begin(fs, to);
+	fs->inodes[to] = fs->inodes[from];
+	inode_touch(fs, to, 0);
+	inode_write_end(fs, to);
+	inode* moved = &fs->inodes[to];
+
+	if(from == fs->root_node){
+		fs->root_node = to;
+	}else if(moved->parent != -1){
+		inode* parent = &fs->inodes[moved->parent];
+		for (int j=0; j<DIRECT_BLOCKS_COUNT; j++) {
+			if(parent->direct_blocks[j] == from){
+				parent->direct_blocks[j] = to;
+			}
+		}
+	}
+	if(moved->n_type == directory){
+		for (int j=0; j<DIRECT_BLOCKS_COUNT; j++) {
+			if(moved->direct_blocks[j] != -1){
+				fs->inodes[moved->direct_blocks[j]].parent = to;
+			}
+		}
+	}
+	inode_init(&fs->inodes[from]);
+}
+
+static int shrink(file_system* fs, uint32_t num_blocks){
+	uint32_t old_size = fs->s_block->num_blocks;
+
+	//check that everything in the tail fits into the free slots in front of it
+	uint32_t tail_inodes = 0, head_free_inodes = 0;
+	uint32_t tail_blocks = 0, head_free_blocks = 0;
+	int* owner_inode = malloc(old_size * sizeof(int));
+	int* owner_slot = malloc(old_size * sizeof(int));
+	if(owner_inode == NULL || owner_slot == NULL){
+		exit(1);
+	}
+	block_owners(fs, owner_inode, owner_slot);
+	for (uint32_t i=0; i<old_size; i++) {
+		if(i < num_blocks){
+			head_free_inodes += !used_inode(fs, i);
+			head_free_blocks += fs->free_list[i] != 0;
+		}else{
+			tail_inodes += used_inode(fs, i);
+			tail_blocks += owner_inode[i] != -1;
+		}
+	}
+	if(tail_inodes > head_free_inodes || tail_blocks > head_free_blocks){
+		free(owner_inode);
+		free(owner_slot);
+		return -1;
+	}
+
+	uint32_t free_slot = 0;
+	for (uint32_t i=num_blocks; i<old_size; i++) {
+		if(!used_inode(fs, i)){
+			continue;
+		}
+		while(used_inode(fs, free_slot)){
+			free_slot++;
+		}
+		move_inode(fs, i, free_slot);
+	}
+
+	//the block owners are looked up again, the inodes owning them may have moved
+	block_owners(fs, owner_inode, owner_slot);
+	free_slot = 0;
+	for (uint32_t b=num_blocks; b<old_size; b++) {
+		if(owner_inode[b] == -1){
+			continue;
+		}
+		while(!fs->free_list[free_slot]){
+			free_slot++;
+		}
+		fs->data_blocks[free_slot] = fs->data_blocks[b];
+		fs->block_crc[free_slot] = fs->block_crc[b];
+		fs->verified[free_slot] = fs->verified[b];
+		fs->free_list[free_slot] = 0;
+		inode_write_begin(fs, owner_inode[b]);
+		fs->inodes[owner_inode[b]].direct_blocks[owner_slot[b]] = free_slot;
+		inode_touch(fs, owner_inode[b], 0);
+		inode_write_end(fs, owner_inode[b]);
+	}
+	free(owner_inode);
+	free(owner_slot);
+
+	resize_arrays(fs, num_blocks);
+	fs->s_block->num_blocks = num_blocks;
+	fs->s_block->free_blocks = 0;
+	for (uint32_t i=0; i<num_blocks; i++) {
+		fs->s_block->free_blocks += fs->free_list[i] != 0;
+	}
+	fs_groups_init(fs);
+	return 0;
+}
+
+int fs_resize(file_system* fs, uint32_t num_blocks){
+	if(num_blocks == 0){
+		return -1;
+	}
+	fs_sweeper_drain(fs);
+	fs_epoch_barrier(fs);
+	//a patch only applies to a filesystem of the same size, the next one has to carry everything
+	if(num_blocks > fs->s_block->num_blocks){
+		int result = grow(fs, num_blocks);
+		fs_delta_mark_all(fs);
+		return result;
+	}
+	if(num_blocks < fs->s_block->num_blocks){
+		int result = shrink(fs, num_blocks);
+		if(result == 0){
+			LOG("Shrunk filesystem\n");
+			fs_delta_mark_all(fs);
+		}
+		return result;
+	}
+	return 0;
+}
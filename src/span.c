@@ -0,0 +1,187 @@
+#define _GNU_SOURCE
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "../lib/span.h"
+
+typedef struct _span_event{
+	const char* name;
+	uint64_t start;
+	uint64_t end;
+	uint32_t tid;
+} span_event;
+
+//single producer (the thread owning it) and single consumer (the writer) ring
+typedef struct _span_ring{
+	span_event events[SPAN_RING_SIZE];
+	uint64_t head; //next slot the owner fills
+	uint64_t tail; //next slot the writer takes
+	int in_use; //a ring of a thread that ended is handed to the next new thread
+	struct _span_ring* next;
+} span_ring;
+
+int spans_on = 0;
+
+static span_ring* rings = NULL; //every ring ever created, never shrinks
+static pthread_key_t ring_key;
+static pthread_once_t ring_key_once = PTHREAD_ONCE_INIT;
+static __thread span_ring* my_ring = NULL;
+static __thread uint32_t my_tid = 0;
+
+static pthread_mutex_t writer_lock = PTHREAD_MUTEX_INITIALIZER; //serializes start and stop
+static pthread_mutex_t flush_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t flush_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t writer;
+static int writer_stop; //guarded by flush_lock
+static FILE* json_file;
+static int first_event; //no comma before the first event
+static uint64_t dropped;
+
+static void release_ring(void* ring){
+	__atomic_store_n(&((span_ring*)ring)->in_use, 0, __ATOMIC_RELEASE);
+}
+
+static void create_key(void){
+	pthread_key_create(&ring_key, release_ring);
+}
+
+static span_ring* get_ring(void){
+	if(my_ring != NULL){
+		return my_ring;
+	}
+	pthread_once(&ring_key_once, create_key);
+	my_tid = syscall(SYS_gettid);
+
+	span_ring* ring = NULL;
+	for (span_ring* r = __atomic_load_n(&rings, __ATOMIC_ACQUIRE); r != NULL; r = r->next) {
+		int free = 0;
+		if(__atomic_compare_exchange_n(&r->in_use, &free, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)){
+			ring = r;
+			break;
+		}
+	}
+	if(ring == NULL){
+		ring = calloc(1, sizeof(span_ring));
+		if(ring == NULL){
+			exit(1);
+		}
+		ring->in_use = 1;
+		ring->next = __atomic_load_n(&rings, __ATOMIC_RELAXED);
+		while(!__atomic_compare_exchange_n(&rings, &ring->next, ring, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+	}
+	pthread_setspecific(ring_key, ring);
+	my_ring = ring;
+	return ring;
+}
+
+void span_record(const span* s, uint64_t end){
+	span_ring* ring = get_ring();
+	uint64_t head = ring->head;
+	if(head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == SPAN_RING_SIZE){
+		__atomic_fetch_add(&dropped, 1, __ATOMIC_RELAXED);
+		return;
+	}
+	span_event* e = &ring->events[head % SPAN_RING_SIZE];
+	e->name = s->name;
+	e->start = s->start;
+	e->end = end;
+	e->tid = my_tid;
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+//writes the spans that are waiting in the rings, flush_lock is held
+static void drain(void){
+	int pid = getpid();
+	for (span_ring* r = __atomic_load_n(&rings, __ATOMIC_ACQUIRE); r != NULL; r = r->next) {
+		uint64_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+		for (uint64_t i = r->tail; i<head; i++) {
+			span_event* e = &r->events[i % SPAN_RING_SIZE];
+			//ts and dur are microseconds
+			fprintf(json_file, "%s{\"name\": \"%s\", \"ph\": \"X\", \"ts\": %" PRIu64 ".%03" PRIu64
+			        ", \"dur\": %" PRIu64 ".%03" PRIu64 ", \"pid\": %d, \"tid\": %" PRIu32 "}",
+			        first_event ? "" : ",\n", e->name, e->start / 1000, e->start % 1000,
+			        (e->end - e->start) / 1000, (e->end - e->start) % 1000, pid, e->tid);
+			first_event = 0;
+		}
+		__atomic_store_n(&r->tail, head, __ATOMIC_RELEASE);
+	}
+	fflush(json_file);
+}
+
+static void* write_spans(void* arg){
+	pthread_mutex_lock(&flush_lock);
+	while(!writer_stop){
+		struct timespec wake;
+		clock_gettime(CLOCK_REALTIME, &wake);
+		wake.tv_nsec += SPAN_FLUSH_MS * 1000000L;
+		wake.tv_sec += wake.tv_nsec / 1000000000;
+		wake.tv_nsec %= 1000000000;
+		pthread_cond_timedwait(&flush_cond, &flush_lock, &wake);
+		drain();
+	}
+	pthread_mutex_unlock(&flush_lock);
+	return NULL;
+}
+
+int fs_spans_start(const char* json_path){
+	pthread_mutex_lock(&writer_lock);
+	if(json_file != NULL){
+		pthread_mutex_unlock(&writer_lock);
+		fs_spans_stop();
+		pthread_mutex_lock(&writer_lock);
+	}
+	FILE* file = fopen(json_path, "w");
+	if(file == NULL){
+		pthread_mutex_unlock(&writer_lock);
+		return -1;
+	}
+	//spans left over from an earlier recording are dropped
+	for (span_ring* r = __atomic_load_n(&rings, __ATOMIC_ACQUIRE); r != NULL; r = r->next) {
+		__atomic_store_n(&r->tail, __atomic_load_n(&r->head, __ATOMIC_ACQUIRE), __ATOMIC_RELEASE);
+	}
+	fputs("[\n", file);
+	json_file = file;
+	first_event = 1;
+	writer_stop = 0;
+	__atomic_store_n(&dropped, 0, __ATOMIC_RELAXED);
+	if(pthread_create(&writer, NULL, write_spans, NULL) != 0){
+		fclose(file);
+		json_file = NULL;
+		pthread_mutex_unlock(&writer_lock);
+		return -1;
+	}
+	__atomic_store_n(&spans_on, 1, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&writer_lock);
+	return 0;
+}
+
+void fs_spans_stop(void){
+	pthread_mutex_lock(&writer_lock);
+	if(json_file == NULL){
+		pthread_mutex_unlock(&writer_lock);
+		return;
+	}
+	__atomic_store_n(&spans_on, 0, __ATOMIC_RELAXED);
+
+	pthread_mutex_lock(&flush_lock);
+	writer_stop = 1;
+	pthread_cond_signal(&flush_cond);
+	pthread_mutex_unlock(&flush_lock);
+	pthread_join(writer, NULL);
+
+	//spans that ended after the last pass of the writer
+	pthread_mutex_lock(&flush_lock);
+	drain();
+	pthread_mutex_unlock(&flush_lock);
+	//the number of dropped spans shows up as a counter track
+	fprintf(json_file, "%s{\"name\": \"dropped_spans\", \"ph\": \"C\", \"ts\": %" PRIu64
+	        ", \"pid\": %d, \"args\": {\"count\": %" PRIu64 "}}\n]\n", first_event ? "" : ",\n",
+	        span_now() / 1000, (int)getpid(), __atomic_load_n(&dropped, __ATOMIC_RELAXED));
+	fclose(json_file);
+	json_file = NULL;
+	pthread_mutex_unlock(&writer_lock);
+}
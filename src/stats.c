@@ -0,0 +1,193 @@
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../lib/stats.h"
+
+#define STATS_SUB_BUCKETS (1 << STATS_SUB_BITS)
+
+//the statistics of one thread. Only the owner writes, snapshots read concurrently
+typedef struct _stats_shard{
+	fs_stats stats;
+	int in_use; //a shard of a thread that ended is handed to the next new thread
+	struct _stats_shard* next;
+} stats_shard;
+
+int stats_on = 0;
+
+static stats_shard* shards = NULL; //every shard ever created, never shrinks
+static pthread_key_t shard_key;
+static pthread_once_t shard_key_once = PTHREAD_ONCE_INIT;
+static __thread stats_shard* my_shard = NULL;
+
+static const char* hist_names[STATS_HISTOGRAMS] = {
+	"mkdir", "mkfile", "list", "writef", "readf", "rm", "stat", "dump", "walk_depth"
+};
+
+static const char* counter_names[STATS_COUNTERS] = {
+	"bytes_written", "bytes_read", "blocks_allocated", "blocks_freed"
+};
+
+//the counts are kept when a thread ends, they still belong to the totals
+static void release_shard(void* shard){
+	__atomic_store_n(&((stats_shard*)shard)->in_use, 0, __ATOMIC_RELEASE);
+}
+
+static void create_key(void){
+	pthread_key_create(&shard_key, release_shard);
+}
+
+static stats_shard* get_shard(void){
+	if(my_shard != NULL){
+		return my_shard;
+	}
+	pthread_once(&shard_key_once, create_key);
+
+	stats_shard* shard = NULL;
+	for (stats_shard* s = __atomic_load_n(&shards, __ATOMIC_ACQUIRE); s != NULL; s = s->next) {
+		int free = 0;
+		if(__atomic_compare_exchange_n(&s->in_use, &free, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)){
+			shard = s;
+			break;
+		}
+	}
+	if(shard == NULL){
+		shard = calloc(1, sizeof(stats_shard));
+		if(shard == NULL){
+			exit(1);
+		}
+		shard->in_use = 1;
+		shard->next = __atomic_load_n(&shards, __ATOMIC_RELAXED);
+		while(!__atomic_compare_exchange_n(&shards, &shard->next, shard, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+	}
+	pthread_setspecific(shard_key, shard);
+	my_shard = shard;
+	return shard;
+}
+
+//only the owning thread writes, so a plain add is enough. The atomics keep snapshots tear free
+static inline void bump(uint64_t* value, uint64_t n){
+	__atomic_store_n(value, __atomic_load_n(value, __ATOMIC_RELAXED) + n, __ATOMIC_RELAXED);
+}
+
+static int bucket_of(uint64_t value){
+	if(value < STATS_SUB_BUCKETS){
+		return value;
+	}
+	int exponent = 63 - __builtin_clzll(value);
+	if(exponent > STATS_MAX_EXPONENT){
+		return STATS_BUCKETS - 1;
+	}
+	int sub = (value >> (exponent - STATS_SUB_BITS)) & (STATS_SUB_BUCKETS - 1);
+	return ((exponent - STATS_SUB_BITS + 1) << STATS_SUB_BITS) + sub;
+}
+
+//largest value that falls into bucket
+static uint64_t bucket_end(int bucket){
+	if(bucket < STATS_SUB_BUCKETS){
+		return bucket;
+	}
+	int exponent = (bucket >> STATS_SUB_BITS) + STATS_SUB_BITS - 1;
+	uint64_t sub = bucket & (STATS_SUB_BUCKETS - 1);
+	return ((STATS_SUB_BUCKETS + sub + 1) << (exponent - STATS_SUB_BITS)) - 1;
+}
+
+void stats_record(enum stats_hist hist, uint64_t value){
+	stats_histogram* h = &get_shard()->stats.hist[hist];
+	bump(&h->count, 1);
+	bump(&h->sum, value);
+	bump(&h->buckets[bucket_of(value)], 1);
+	if(value > __atomic_load_n(&h->max, __ATOMIC_RELAXED)){
+		__atomic_store_n(&h->max, value, __ATOMIC_RELAXED);
+	}
+}
+
+void stats_histogram_add(stats_histogram* h, uint64_t value){
+	h->count++;
+	h->sum += value;
+	h->buckets[bucket_of(value)]++;
+	h->max = value > h->max ? value : h->max;
+}
+
+void stats_count(enum stats_counter counter, uint64_t n){
+	bump(&get_shard()->stats.counters[counter], n);
+}
+
+void fs_stats_enable(int enabled){
+	__atomic_store_n(&stats_on, enabled != 0, __ATOMIC_RELAXED);
+}
+
+void fs_stats_snapshot(fs_stats* out){
+	memset(out, 0, sizeof(fs_stats));
+	for (stats_shard* s = __atomic_load_n(&shards, __ATOMIC_ACQUIRE); s != NULL; s = s->next) {
+		for (int i=0; i<STATS_HISTOGRAMS; i++) {
+			stats_histogram* from = &s->stats.hist[i];
+			stats_histogram* to = &out->hist[i];
+			to->count += __atomic_load_n(&from->count, __ATOMIC_RELAXED);
+			to->sum += __atomic_load_n(&from->sum, __ATOMIC_RELAXED);
+			uint64_t max = __atomic_load_n(&from->max, __ATOMIC_RELAXED);
+			to->max = max > to->max ? max : to->max;
+			for (int b=0; b<STATS_BUCKETS; b++) {
+				to->buckets[b] += __atomic_load_n(&from->buckets[b], __ATOMIC_RELAXED);
+			}
+		}
+		for (int i=0; i<STATS_COUNTERS; i++) {
+			out->counters[i] += __atomic_load_n(&s->stats.counters[i], __ATOMIC_RELAXED);
+		}
+	}
+}
+
+void fs_stats_reset(void){
+	for (stats_shard* s = __atomic_load_n(&shards, __ATOMIC_ACQUIRE); s != NULL; s = s->next) {
+		uint64_t* words = (uint64_t*)&s->stats;
+		for (size_t i=0; i<sizeof(fs_stats) / sizeof(uint64_t); i++) {
+			__atomic_store_n(&words[i], 0, __ATOMIC_RELAXED);
+		}
+	}
+}
+
+uint64_t fs_stats_percentile(const stats_histogram* h, double p){
+	if(h->count == 0){
+		return 0;
+	}
+	uint64_t rank = (uint64_t)(p * h->count + 0.5);
+	rank = rank < 1 ? 1 : (rank > h->count ? h->count : rank);
+	uint64_t seen = 0;
+	for (int b=0; b<STATS_BUCKETS; b++) {
+		seen += h->buckets[b];
+		if(seen >= rank){
+			//the end of the last bucket can lie above anything that was recorded
+			uint64_t end = bucket_end(b);
+			return end < h->max ? end : h->max;
+		}
+	}
+	return h->max;
+}
+
+char* fs_stats_format(void){
+	fs_stats* snapshot = malloc(sizeof(fs_stats));
+	size_t size = (STATS_HISTOGRAMS + STATS_COUNTERS) * 256 + 1;
+	char* result = malloc(size);
+	if(snapshot == NULL || result == NULL){
+		exit(1);
+	}
+	fs_stats_snapshot(snapshot);
+
+	size_t used = 0;
+	for (int i=0; i<STATS_HISTOGRAMS; i++) {
+		stats_histogram* h = &snapshot->hist[i];
+		used += snprintf(result + used, size - used,
+		                 "%s count=%" PRIu64 " mean=%" PRIu64 " p50=%" PRIu64
+		                 " p90=%" PRIu64 " p99=%" PRIu64 " max=%" PRIu64 "\n", hist_names[i],
+		                 h->count, h->count > 0 ? h->sum / h->count : 0,
+		                 fs_stats_percentile(h, 0.5), fs_stats_percentile(h, 0.9),
+		                 fs_stats_percentile(h, 0.99), h->max);
+	}
+	for (int i=0; i<STATS_COUNTERS; i++) {
+		used += snprintf(result + used, size - used, "%s %" PRIu64 "\n", counter_names[i], snapshot->counters[i]);
+	}
+	free(snapshot);
+	return result;
+}
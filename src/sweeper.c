@@ -0,0 +1,93 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include "../lib/epoch.h"
+#include "../lib/filesystem.h"
+#include "../lib/span.h"
+#include "../lib/sweeper.h"
+#include "../lib/threadpool.h"
+
+struct _sweeper{
+	threadpool* pool;
+};
+
+typedef struct _sweep_task{
+	file_system* fs;
+	int inode_num;
+} sweep_task;
+
+static void sweep(void* arg);
+
+static void submit_sweep(file_system* fs, int inode_num){
+	sweep_task* task = malloc(sizeof(sweep_task));
+	if(task == NULL){
+		exit(1);
+	}
+	task->fs = fs;
+	task->inode_num = inode_num;
+	threadpool_submit(fs->sweeper->pool, sweep, task);
+}
+
+//frees one inode of a detached subtree. Files are freed right away,
+//subdirectories become tasks of their own so wide trees are swept in parallel.
+static void sweep(void* arg){
+	sweep_task* task = arg;
+	file_system* fs = task->fs;
+	span s;
+	span_begin(&s, "sweep");
+	inode* curr_inode = &fs->inodes[task->inode_num];
+
+	if(curr_inode->n_type == directory){
+		//no create adds an entry behind the copy, see inode_detach
+		int entries[DIRECT_BLOCKS_COUNT];
+		int count = inode_detach(fs, task->inode_num, entries);
+		for (int i=0; i<count; i++) {
+			int child = entries[i];
+			if(fs->inodes[child].n_type == directory){
+				submit_sweep(fs, child);
+			}else{
+				fs_epoch_retire_file(fs, child);
+			}
+		}
+		fs_epoch_retire(fs, NULL, 0, task->inode_num);
+	}else{
+		fs_epoch_retire_file(fs, task->inode_num);
+	}
+	free(task);
+	span_end(&s);
+}
+
+int fs_sweeper_start(file_system* fs, int num_threads){
+	if(fs->sweeper != NULL){
+		return 0;
+	}
+	struct _sweeper* sweeper = malloc(sizeof(struct _sweeper));
+	if(sweeper == NULL){
+		exit(1);
+	}
+	sweeper->pool = threadpool_create(num_threads);
+	if(sweeper->pool == NULL){
+		free(sweeper);
+		return -1;
+	}
+	fs->sweeper = sweeper;
+	return 0;
+}
+
+void fs_sweeper_submit(file_system* fs, int inode_num){
+	submit_sweep(fs, inode_num);
+}
+
+void fs_sweeper_drain(file_system* fs){
+	if(fs->sweeper != NULL){
+		threadpool_wait(fs->sweeper->pool);
+	}
+}
+
+void fs_sweeper_stop(file_system* fs){
+	if(fs->sweeper == NULL){
+		return;
+	}
+	threadpool_destroy(fs->sweeper->pool);
+	free(fs->sweeper);
+	fs->sweeper = NULL;
+}
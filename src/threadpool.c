@@ -0,0 +1,227 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "../lib/threadpool.h"
+
+typedef struct _task{
+	task_fn fn;
+	void* arg;
+} task;
+
+//a growable deque: the owner pushes and pops at the tail, thieves take from the head
+typedef struct _task_queue{
+	pthread_mutex_t lock;
+	task* tasks;
+	size_t head;
+	size_t tail;
+	size_t capacity;
+} task_queue;
+
+struct _threadpool{
+	int num_threads;
+	pthread_t* threads;
+	task_queue* queues;
+	size_t pending; //submitted tasks that did not finish yet, updated atomically
+	size_t queued; //tasks sitting in a queue, updated atomically
+	int idle; //workers sleeping on work_available, updated atomically
+	unsigned next_queue; //round robin target for submissions from outside the pool
+	int stop;
+	pthread_mutex_t lock; //only taken to sleep and to wake sleepers
+	pthread_cond_t work_available;
+	pthread_cond_t all_done;
+};
+
+static __thread int worker_id = -1;
+static __thread threadpool* worker_pool = NULL;
+
+typedef struct _worker_arg{
+	threadpool* pool;
+	int id;
+} worker_arg;
+
+static void queue_push(task_queue* q, task t){
+	pthread_mutex_lock(&q->lock);
+	if(q->tail == q->capacity){
+		//move the live range to the front before growing
+		size_t live = q->tail - q->head;
+		if(q->head > 0 && live < q->capacity / 2){
+			for (size_t i=0; i<live; i++) {
+				q->tasks[i] = q->tasks[q->head + i];
+			}
+		}else{
+			size_t capacity = q->capacity ? q->capacity * 2 : 64;
+			task* tasks = malloc(capacity * sizeof(task));
+			if(tasks == NULL){
+				exit(1);
+			}
+			for (size_t i=0; i<live; i++) {
+				tasks[i] = q->tasks[q->head + i];
+			}
+			free(q->tasks);
+			q->tasks = tasks;
+			q->capacity = capacity;
+		}
+		q->head = 0;
+		q->tail = live;
+	}
+	q->tasks[q->tail++] = t;
+	pthread_mutex_unlock(&q->lock);
+}
+
+//own work is taken newest first, stolen work oldest first
+static int queue_pop(task_queue* q, task* t, int steal){
+	int found = 0;
+	pthread_mutex_lock(&q->lock);
+	if(q->head < q->tail){
+		*t = steal ? q->tasks[q->head++] : q->tasks[--q->tail];
+		found = 1;
+	}
+	pthread_mutex_unlock(&q->lock);
+	return found;
+}
+
+static int find_task(threadpool* pool, int id, task* t){
+	if(queue_pop(&pool->queues[id], t, 0)){
+		return 1;
+	}
+	for (int k=1; k<pool->num_threads; k++) {
+		if(queue_pop(&pool->queues[(id + k) % pool->num_threads], t, 1)){
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static void* worker_main(void* arg){
+	worker_arg* warg = arg;
+	threadpool* pool = warg->pool;
+	worker_id = warg->id;
+	worker_pool = pool;
+	free(warg);
+	//wait until threadpool_create knows how many workers were started
+	pthread_mutex_lock(&pool->lock);
+	pthread_mutex_unlock(&pool->lock);
+
+	while(1){
+		task t;
+		if(find_task(pool, worker_id, &t)){
+			__atomic_sub_fetch(&pool->queued, 1, __ATOMIC_SEQ_CST);
+			t.fn(t.arg);
+			if(__atomic_sub_fetch(&pool->pending, 1, __ATOMIC_SEQ_CST) == 0){
+				pthread_mutex_lock(&pool->lock);
+				pthread_cond_broadcast(&pool->all_done);
+				pthread_mutex_unlock(&pool->lock);
+			}
+			continue;
+		}
+
+		//announce being idle before looking at queued, threadpool_submit checks
+		//them in the opposite order, so one of the two sees the other
+		pthread_mutex_lock(&pool->lock);
+		__atomic_add_fetch(&pool->idle, 1, __ATOMIC_SEQ_CST);
+		while(__atomic_load_n(&pool->queued, __ATOMIC_SEQ_CST) == 0 && !pool->stop){
+			pthread_cond_wait(&pool->work_available, &pool->lock);
+		}
+		__atomic_sub_fetch(&pool->idle, 1, __ATOMIC_SEQ_CST);
+		int stop = pool->stop && __atomic_load_n(&pool->queued, __ATOMIC_SEQ_CST) == 0;
+		pthread_mutex_unlock(&pool->lock);
+		if(stop){
+			return NULL;
+		}
+	}
+}
+
+threadpool* threadpool_create(int num_threads){
+	if(num_threads <= 0){
+		num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	}
+	threadpool* pool = calloc(1, sizeof(threadpool));
+	if(pool == NULL){
+		exit(1);
+	}
+	pool->threads = malloc(num_threads * sizeof(pthread_t));
+	pool->queues = calloc(num_threads, sizeof(task_queue));
+	if(pool->threads == NULL || pool->queues == NULL){
+		exit(1);
+	}
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->work_available, NULL);
+	pthread_cond_init(&pool->all_done, NULL);
+	for (int i=0; i<num_threads; i++) {
+		pthread_mutex_init(&pool->queues[i].lock, NULL);
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	for (int i=0; i<num_threads; i++) {
+		worker_arg* arg = malloc(sizeof(worker_arg));
+		if(arg == NULL){
+			exit(1);
+		}
+		arg->pool = pool;
+		arg->id = i;
+		if(pthread_create(&pool->threads[i], NULL, worker_main, arg) != 0){
+			free(arg);
+			break;
+		}
+		pool->num_threads++;
+	}
+	pthread_mutex_unlock(&pool->lock);
+	if(pool->num_threads == 0){
+		threadpool_destroy(pool);
+		return NULL;
+	}
+	return pool;
+}
+
+void threadpool_submit(threadpool* pool, task_fn fn, void* arg){
+	task t = { fn, arg };
+	int target = worker_pool == pool ? worker_id
+		: (int)(__atomic_fetch_add(&pool->next_queue, 1, __ATOMIC_RELAXED) % pool->num_threads);
+
+	__atomic_add_fetch(&pool->pending, 1, __ATOMIC_SEQ_CST);
+	__atomic_add_fetch(&pool->queued, 1, __ATOMIC_SEQ_CST);
+	queue_push(&pool->queues[target], t);
+	if(__atomic_load_n(&pool->idle, __ATOMIC_SEQ_CST) > 0){
+		pthread_mutex_lock(&pool->lock);
+		pthread_cond_signal(&pool->work_available);
+		pthread_mutex_unlock(&pool->lock);
+	}
+}
+
+void threadpool_wait(threadpool* pool){
+	pthread_mutex_lock(&pool->lock);
+	while(__atomic_load_n(&pool->pending, __ATOMIC_SEQ_CST) > 0){
+		pthread_cond_wait(&pool->all_done, &pool->lock);
+	}
+	pthread_mutex_unlock(&pool->lock);
+}
+
+int threadpool_size(threadpool* pool){
+	return pool->num_threads;
+}
+
+int threadpool_worker_id(void){
+	return worker_id;
+}
+
+void threadpool_destroy(threadpool* pool){
+	threadpool_wait(pool);
+	pthread_mutex_lock(&pool->lock);
+	pool->stop = 1;
+	pthread_cond_broadcast(&pool->work_available);
+	pthread_mutex_unlock(&pool->lock);
+	for (int i=0; i<pool->num_threads; i++) {
+		pthread_join(pool->threads[i], NULL);
+	}
+
+	for (int i=0; i<pool->num_threads; i++) {
+		pthread_mutex_destroy(&pool->queues[i].lock);
+		free(pool->queues[i].tasks);
+	}
+	pthread_mutex_destroy(&pool->lock);
+	pthread_cond_destroy(&pool->work_available);
+	pthread_cond_destroy(&pool->all_done);
+	free(pool->queues);
+	free(pool->threads);
+	free(pool);
+}
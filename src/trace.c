@@ -0,0 +1,265 @@
+#define _GNU_SOURCE
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../lib/operations.h"
+#include "../lib/stats.h"
+#include "../lib/trace.h"
+
+int trace_on = 0;
+__thread int trace_depth = 0;
+
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static FILE* trace_file = NULL; //guarded by trace_lock
+static uint64_t trace_epoch; //start of the recording
+
+static const char* op_names[TRACE_OPS] = {
+	"mkdir", "mkfile", "list", "writef", "readf", "rm", "import", "export", "stat"
+};
+
+static uint64_t now_ns(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+int fs_trace_start(const char* trace_path){
+	FILE* file = fopen(trace_path, "w");
+	if(file == NULL){
+		return -1;
+	}
+	fprintf(file, "# fs trace v1 started=%ld\n# start_ns\top\tduration_ns\tresult\tsize\tpath\targ\n", (long)time(NULL));
+
+	pthread_mutex_lock(&trace_lock);
+	if(trace_file != NULL){
+		fclose(trace_file);
+	}
+	trace_file = file;
+	trace_epoch = now_ns();
+	__atomic_store_n(&trace_on, 1, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&trace_lock);
+	return 0;
+}
+
+void fs_trace_stop(void){
+	pthread_mutex_lock(&trace_lock);
+	__atomic_store_n(&trace_on, 0, __ATOMIC_RELAXED);
+	if(trace_file != NULL){
+		fclose(trace_file);
+		trace_file = NULL;
+	}
+	pthread_mutex_unlock(&trace_lock);
+}
+
+void trace_record(trace_call* call, enum trace_op op, const char* arg, int64_t size, int64_t result){
+	uint64_t end = now_ns();
+	pthread_mutex_lock(&trace_lock);
+	//calls that started before the recording did are left out
+	if(trace_file != NULL && call->start >= trace_epoch){
+		fprintf(trace_file, "%" PRIu64 "\t%s\t%" PRIu64 "\t%" PRId64 "\t%" PRId64 "\t%s\t%s\n",
+		        call->start - trace_epoch, op_names[op], end - call->start, result, size,
+		        call->path, arg != NULL ? arg : "");
+	}
+	pthread_mutex_unlock(&trace_lock);
+	free(call->path);
+	call->path = NULL;
+}
+
+typedef struct _trace_entry{
+	uint64_t start;
+	enum trace_op op;
+	int64_t result;
+	int64_t size;
+	char* path;
+	char* arg;
+	char* line; //the fields above point into it
+} trace_entry;
+
+//splits a trace line into an entry, the strings point into line. @return 0 on success, -1 else
+static int parse_entry(char* line, trace_entry* entry){
+	char* fields[7];
+	for (int i=0; i<7; i++) {
+		fields[i] = strsep(&line, "\t");
+		if(fields[i] == NULL){
+			return -1;
+		}
+	}
+	char* end;
+	entry->start = strtoull(fields[0], &end, 10);
+	if(*end != '\0'){
+		return -1;
+	}
+	entry->op = TRACE_OPS;
+	for (int i=0; i<TRACE_OPS; i++) {
+		if(strcmp(fields[1], op_names[i]) == 0){
+			entry->op = i;
+		}
+	}
+	entry->result = strtoll(fields[3], NULL, 10);
+	entry->size = strtoll(fields[4], NULL, 10);
+	entry->path = fields[5];
+	entry->arg = fields[6];
+	return entry->op == TRACE_OPS ? -1 : 0;
+}
+
+static int compare_entries(const void* a, const void* b){
+	uint64_t x = ((const trace_entry*)a)->start;
+	uint64_t y = ((const trace_entry*)b)->start;
+	return x < y ? -1 : (x > y);
+}
+
+//runs one entry, @return the result in the format of the trace
+static int64_t run_entry(file_system* fs, const trace_entry* entry, char* text){
+	//the operations cut up their path argument, the entry may be replayed again
+	char* path = strdup(entry->path);
+	int64_t result = -1;
+	inode info;
+	uint8_t content[MAX_FILE_SIZE]; //any file fits, so an empty one reads as size 0
+	char* listing;
+
+	switch(entry->op){
+	case trace_mkdir:
+		result = fs_mkdir(fs, path);
+		break;
+	case trace_mkfile:
+		result = fs_mkfile(fs, path);
+		break;
+	case trace_list:
+		listing = fs_list(fs, path);
+		result = listing != NULL ? 0 : -1;
+		free(listing);
+		break;
+	case trace_writef:
+		text[entry->size] = '\0';
+		result = fs_writef(fs, path, text);
+		text[entry->size] = 'x';
+		break;
+	case trace_readf:
+		result = fs_readf_into(fs, path, content, sizeof(content));
+		break;
+	case trace_rm:
+		result = fs_rm(fs, path);
+		break;
+	case trace_import:
+		result = fs_import(fs, path, entry->arg);
+		break;
+	case trace_export:
+		result = fs_export(fs, path, entry->arg);
+		break;
+	case trace_stat:
+		result = fs_stat(fs, path, &info);
+		break;
+	case TRACE_OPS:
+		break;
+	}
+	free(path);
+	return result;
+}
+
+int fs_trace_replay(file_system* fs, const char* trace_path, double speed, trace_report* report){
+	FILE* file = fopen(trace_path, "r");
+	if(file == NULL){
+		return -1;
+	}
+	memset(report, 0, sizeof(trace_report));
+
+	//the lines of concurrent callers are written when the calls end, so they are sorted by start first
+	trace_entry* entries = NULL;
+	size_t count = 0;
+	size_t capacity = 0;
+	int64_t max_size = 0;
+	char* line = NULL;
+	size_t line_capacity = 0;
+	ssize_t length;
+	while((length = getline(&line, &line_capacity, file)) != -1){
+		if(length > 0 && line[length - 1] == '\n'){
+			line[--length] = '\0';
+		}
+		if(length == 0 || line[0] == '#'){
+			continue;
+		}
+		if(count == capacity){
+			capacity = capacity == 0 ? 1024 : capacity * 2;
+			entries = realloc(entries, capacity * sizeof(trace_entry));
+			if(entries == NULL){
+				exit(1);
+			}
+		}
+		char* copy = strdup(line);
+		entries[count].line = copy;
+		if(parse_entry(copy, &entries[count]) != 0 || entries[count].size < 0 || entries[count].size > INT32_MAX){
+			free(copy);
+			report->skipped++;
+			continue;
+		}
+		max_size = MAX(max_size, entries[count].size);
+		count++;
+	}
+	free(line);
+	fclose(file);
+	qsort(entries, count, sizeof(trace_entry), compare_entries);
+
+	//placeholder data for the writes, each one cuts it to its size
+	char* text = malloc(max_size + 1);
+	if(text == NULL){
+		exit(1);
+	}
+	memset(text, 'x', max_size);
+	text[max_size] = '\0';
+
+	uint64_t replay_start = now_ns();
+	for (size_t i=0; i<count; i++) {
+		trace_entry* entry = &entries[i];
+		if(speed > 0){
+			uint64_t due = replay_start + (uint64_t)(entry->start / speed);
+			uint64_t now = now_ns();
+			if(due > now){
+				struct timespec wait = {(due - now) / 1000000000, (due - now) % 1000000000};
+				nanosleep(&wait, NULL);
+			}
+		}
+		uint64_t start = now_ns();
+		int64_t result = run_entry(fs, entry, text);
+		stats_histogram_add(&report->latency[entry->op], now_ns() - start);
+		report->ops++;
+		if(result != entry->result){
+			report->mismatches++;
+		}
+	}
+	report->duration_ns = now_ns() - replay_start;
+
+	for (size_t i=0; i<count; i++) {
+		free(entries[i].line);
+	}
+	free(text);
+	free(entries);
+	return 0;
+}
+
+char* fs_trace_format(const trace_report* report){
+	size_t size = (TRACE_OPS + 1) * 256;
+	char* result = malloc(size);
+	if(result == NULL){
+		exit(1);
+	}
+	size_t used = 0;
+	for (int i=0; i<TRACE_OPS; i++) {
+		const stats_histogram* h = &report->latency[i];
+		if(h->count == 0){
+			continue;
+		}
+		used += snprintf(result + used, size - used,
+		                 "%s count=%" PRIu64 " mean=%" PRIu64 " p50=%" PRIu64
+		                 " p90=%" PRIu64 " p99=%" PRIu64 " max=%" PRIu64 "\n", op_names[i],
+		                 h->count, h->sum / h->count, fs_stats_percentile(h, 0.5),
+		                 fs_stats_percentile(h, 0.9), fs_stats_percentile(h, 0.99), h->max);
+	}
+	snprintf(result + used, size - used, "replayed %" PRIu64 " ops in %" PRIu64 " ns, %" PRIu64
+	         " results differ, %" PRIu64 " lines skipped\n",
+	         report->ops, report->duration_ns, report->mismatches, report->skipped);
+	return result;
+}
@@ -4,5 +4,9 @@ void printhelp(){
 	printf("Usage:\n"
 	"-l, --load <filename>\n\tLoads an existing filesystem\n"
 	"-c, --create <filename> <size>\n\tCreates a new filesystem with given filename and size (in Bytes)\n"
-	"-h, --help\n\tPrint this help\n");
+	"-h, --help\n\tPrint this help\n"
+	"\nOptions after -l or -c:\n"
+	"-b, --batch [script]\n\tRuns the commands of script (or stdin) line by line without a prompt,\n"
+	"\tthe exit status is 1 if a command failed. Used automatically when stdin is a pipe\n"
+	"-d, --dump\n\tSaves the filesystem when the commands are done\n");
 }
@@ -0,0 +1,60 @@
+import ctypes
+from wrappers import *
+
+GROUP_BLOCKS = 1024
+
+class Test_Alloc:
+    # a top level directory goes to the emptiest group, its files and their blocks follow it
+    def test_alloc_groups_locality(self):
+        fs = setup(3000)
+        libc.fs_mkfile(ctypes.byref(fs), path("/big"))
+        libc.fs_writef(ctypes.byref(fs), path("/big"), path(LONG_DATA * 4))
+        assert fs.inodes[0].direct_blocks[0] == 1
+        assert fs.inodes[1].direct_blocks[0] < GROUP_BLOCKS
+
+        assert libc.fs_mkdir(ctypes.byref(fs), path("/dir")) == 0
+        dir_num = fs.inodes[0].direct_blocks[1]
+        assert dir_num // GROUP_BLOCKS == 1
+        libc.fs_mkfile(ctypes.byref(fs), path("/dir/fil"))
+        fil_num = fs.inodes[dir_num].direct_blocks[0]
+        assert fil_num // GROUP_BLOCKS == 1
+        libc.fs_writef(ctypes.byref(fs), path("/dir/fil"), path(LONG_DATA))
+        for i in range(2):
+            assert fs.inodes[fil_num].direct_blocks[i] // GROUP_BLOCKS == 1
+        assert libc.fs_free_blocks(ctypes.byref(fs)) == 3000 - 7
+
+    # freed blocks are reused before the rest of the group
+    def test_alloc_groups_reuse(self):
+        fs = setup(20)
+        for i in range(3):
+            libc.fs_mkfile(ctypes.byref(fs), path("/f%d" % i))
+            libc.fs_writef(ctypes.byref(fs), path("/f%d" % i), path(SHORT_DATA))
+        assert [fs.inodes[i].direct_blocks[0] for i in range(1, 4)] == [0, 1, 2]
+        libc.fs_rm(ctypes.byref(fs), path("/f1"))
+        assert fs.free_list[1] == 1
+        libc.fs_mkfile(ctypes.byref(fs), path("/g"))
+        libc.fs_writef(ctypes.byref(fs), path("/g"), path(SHORT_DATA))
+        assert fs.inodes[2].direct_blocks[0] == 1
+        assert libc.fs_free_blocks(ctypes.byref(fs)) == 17
+
+    # blocks taken from the groups behind their back are still handed out only once
+    def test_alloc_groups_full(self):
+        fs = setup(5)
+        for i in range(4):
+            fs.free_list[i] = 0
+        libc.fs_mkfile(ctypes.byref(fs), path("/f"))
+        assert libc.fs_writef(ctypes.byref(fs), path("/f"), path(SHORT_DATA)) == len(SHORT_DATA)
+        assert fs.inodes[1].direct_blocks[0] == 4
+        assert libc.fs_writef(ctypes.byref(fs), path("/f"), path(LONG_DATA)) == -2
+
+    # a reused block comes back empty, the previous file's bytes don't survive behind the new size
+    def test_alloc_reused_block_is_cleared(self):
+        fs = setup(5)
+        libc.fs_mkfile(ctypes.byref(fs), path("/old"))
+        libc.fs_writef(ctypes.byref(fs), path("/old"), path(LONG_DATA))
+        libc.fs_rm(ctypes.byref(fs), path("/old"))
+        libc.fs_mkfile(ctypes.byref(fs), path("/new"))
+        libc.fs_writef(ctypes.byref(fs), path("/new"), path(SHORT_DATA))
+        block = fs.data_blocks[fs.inodes[1].direct_blocks[0]]
+        assert block.size == len(SHORT_DATA)
+        assert bytes(block.block)[len(SHORT_DATA):] == bytes(BLOCK_SIZE - len(SHORT_DATA))
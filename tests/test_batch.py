@@ -0,0 +1,81 @@
+import ctypes
+from wrappers import *
+
+class FsOp(ctypes.Structure):
+    _fields_ = [
+        ("type", ctypes.c_int),
+        ("path", ctypes.c_char_p),
+        ("text", ctypes.c_char_p),
+        ("result", ctypes.c_int)
+    ]
+
+OP_MKDIR = 1
+OP_MKFILE = 2
+OP_WRITE = 3
+OP_RM = 4
+
+def batch(fs, ops):
+    array = (FsOp * len(ops))()
+    for i, (op_type, path, text) in enumerate(ops):
+        array[i].type = op_type
+        array[i].path = bytes(path, "UTF-8")
+        array[i].text = bytes(text, "UTF-8") if text is not None else None
+    failed = libc.fs_batch(ctypes.byref(fs), array, ctypes.c_size_t(len(ops)))
+    return failed, [array[i].result for i in range(len(ops))]
+
+class Test_Batch:
+    # files inside a directory can be listed before the directory itself
+    def test_batch_create_and_write(self):
+        fs = setup(10)
+        failed, results = batch(fs, [
+            (OP_MKFILE, "/dir/fil1", None),
+            (OP_WRITE, "/dir/fil1", SHORT_DATA),
+            (OP_MKDIR, "/dir", None),
+            (OP_MKFILE, "/top", None),
+            (OP_WRITE, "/top", LONG_DATA),
+        ])
+        assert failed == 0
+        assert results == [0, len(SHORT_DATA), 0, 0, len(LONG_DATA)]
+        assert read(fs, "/dir/fil1") == SHORT_DATA
+        assert read(fs, "/top") == LONG_DATA
+        assert fs.inodes[fs.inodes[0].direct_blocks[0]].name.decode("utf-8") == "dir"
+
+    def test_batch_result_codes(self):
+        fs = setup(10)
+        failed, results = batch(fs, [
+            (OP_MKFILE, "/fil", None),
+            (OP_MKFILE, "/fil", None),
+            (OP_WRITE, "/missing", "text"),
+            (OP_MKDIR, "/nodir/dir", None),
+            (OP_RM, "/fil", None),
+            (OP_RM, "/fil", None),
+            (OP_MKDIR, "relative", None),
+        ])
+        assert failed == 5
+        assert results == [0, -2, -1, -1, 0, -1, -1]
+        assert fs.inodes[0].direct_blocks[0] == -1
+
+    # blocks freed by an earlier rm in the same batch can be reused
+    def test_batch_reuses_freed_blocks(self):
+        fs = setup(3)
+        failed, results = batch(fs, [
+            (OP_MKFILE, "/a", None),
+            (OP_WRITE, "/a", LONG_DATA),
+            (OP_RM, "/a", None),
+            (OP_MKFILE, "/b", None),
+            (OP_WRITE, "/b", LONG_DATA),
+        ])
+        assert failed == 0
+        assert read(fs, "/b") == LONG_DATA
+
+    # a directory of the same name listed first doesn't hide the file from a write
+    def test_batch_write_beside_same_named_dir(self):
+        fs = setup(10)
+        failed, results = batch(fs, [
+            (OP_MKDIR, "/x", None),
+            (OP_MKFILE, "/x", None),
+            (OP_WRITE, "/x", SHORT_DATA),
+        ])
+        assert failed == 0
+        assert results == [0, 0, len(SHORT_DATA)]
+        assert read(fs, "/x") == SHORT_DATA
@@ -0,0 +1,20 @@
+import json
+import subprocess
+
+class Test_Bench:
+    # the quick run covers every benchmark and prints one JSON object per line
+    def test_bench_quick(self):
+        result = subprocess.run(["./build/bench", "--quick"], capture_output=True, timeout=60)
+        assert result.returncode == 0
+        results = [json.loads(line) for line in result.stdout.decode().splitlines()]
+        names = {r["bench"] for r in results}
+        assert names == {"mkdir", "mkfile", "lookup_depth", "lookup_fanout", "append", "read",
+                         "rm_tree", "rm_tree_reclaim", "dump", "load_single", "load", "verify"}
+        for r in results:
+            assert set(r) == {"bench", "param", "value", "unit"}
+            assert r["value"] >= 0
+
+    # names given on the command line select the benchmarks
+    def test_bench_select(self):
+        result = subprocess.run(["./build/bench", "--quick", "lookup"], capture_output=True, timeout=60)
+        assert {json.loads(line)["bench"] for line in result.stdout.decode().splitlines()} == {"lookup_depth", "lookup_fanout"}
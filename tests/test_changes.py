@@ -0,0 +1,73 @@
+import ctypes
+from wrappers import *
+
+FS_FILE = "./mypyfiles.fs"
+
+class DirentPlus(ctypes.Structure):
+    _fields_ = [("inode_num", ctypes.c_int),
+                ("blocks", ctypes.c_int),
+                ("info", Inode)]
+
+class Changes(ctypes.Structure):
+    _fields_ = [("fs", ctypes.c_void_p),
+                ("since", ctypes.c_uint64),
+                ("next", ctypes.c_uint32)]
+
+libc.fs_change_seq.restype = ctypes.c_uint64
+libc.fs_load.restype = ctypes.POINTER(FileSystem)
+
+# {path: change_seq} of the inodes changed after since, read in batches of 2
+def changed(fs, since):
+    cursor = Changes()
+    libc.fs_changes_begin(ctypes.byref(fs), ctypes.c_uint64(since), ctypes.byref(cursor))
+    entries = (DirentPlus * 2)()
+    buf = ctypes.create_string_buffer(256)
+    result = {}
+    while True:
+        count = libc.fs_changes_next(ctypes.byref(cursor), entries, 2)
+        if count == 0:
+            return result
+        for e in entries[:count]:
+            assert libc.fs_inode_path(ctypes.byref(fs), e.inode_num, buf, 256) > 0
+            result[buf.value.decode()] = e.info.change_seq
+
+class Test_Changes:
+    # writes stamp the file with a new sequence and mtime, creating a file stamps its directory
+    def test_changes_since(self):
+        fs = setup(20)
+        libc.fs_mkdir(ctypes.byref(fs), path("/dir"))
+        libc.fs_mkfile(ctypes.byref(fs), path("/dir/a"))
+        libc.fs_mkfile(ctypes.byref(fs), path("/b"))
+        synced = libc.fs_change_seq(ctypes.byref(fs))
+        assert set(changed(fs, 0)) == {"/", "/dir", "/dir/a", "/b"}
+        assert changed(fs, synced) == {}
+
+        mtime = fs.inodes[2].mtime
+        assert libc.fs_writef(ctypes.byref(fs), path("/dir/a"), path(SHORT_DATA)) == len(SHORT_DATA)
+        assert changed(fs, synced) == {"/dir/a": synced + 1}
+        assert fs.inodes[2].mtime >= mtime and fs.inodes[2].ctime == fs.inodes[2].mtime
+
+        libc.fs_rm(ctypes.byref(fs), path("/b"))
+        assert set(changed(fs, synced)) == {"/dir/a", "/"}
+
+    # the sequences are saved in the image and the counter continues after loading
+    def test_changes_dump_load(self):
+        fs = setup(20)
+        libc.fs_mkfile(ctypes.byref(fs), path("/a"))
+        seq = libc.fs_change_seq(ctypes.byref(fs))
+        assert libc.fs_dump(ctypes.byref(fs), path(FS_FILE)) == 0
+
+        loaded = libc.fs_load(path(FS_FILE)).contents
+        assert libc.fs_change_seq(ctypes.byref(loaded)) == seq
+        libc.fs_writef(ctypes.byref(loaded), path("/a"), path(SHORT_DATA))
+        assert changed(loaded, seq) == {"/a": seq + 1}
+
+    # images of the old inode format still load, without timestamps
+    def test_changes_legacy_image(self):
+        loaded = libc.fs_load(path("./SysProgFiles.fs")).contents
+        size = ctypes.c_int()
+        libc.fs_readf.restype = ctypes.c_char_p
+        assert libc.fs_readf(ctypes.byref(loaded), path("/testfile.txt"), ctypes.byref(size)) is not None
+        assert size.value > 0
+        assert libc.fs_change_seq(ctypes.byref(loaded)) == 0
+        assert all(loaded.inodes[i].change_seq == 0 for i in range(loaded.s_block.contents.num_blocks))
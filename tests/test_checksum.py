@@ -0,0 +1,66 @@
+import ctypes
+from wrappers import *
+
+FS_FILE = "./mypyfiles.fs"
+
+def dump_and_load(fs, corrupt_offset=None):
+    libc.fs_dump(ctypes.byref(fs), ctypes.c_char_p(bytes(FS_FILE,"UTF-8")))
+    if corrupt_offset is not None:
+        with open(FS_FILE,"r+b") as f:
+            f.seek(corrupt_offset)
+            byte = f.read(1)
+            f.seek(corrupt_offset)
+            f.write(bytes([byte[0] ^ 0xff]))
+    libc.fs_load.restype = ctypes.POINTER(FileSystem)
+    return libc.fs_load(ctypes.c_char_p(bytes(FS_FILE,"UTF-8")))
+
+def data_block_offset(num_blocks, block_num):
+    return read_superblock(FS_FILE).data_blocks + block_num * ctypes.sizeof(DataBlock)
+
+class Test_Checksum:
+    def test_crc32c_check_value(self):
+        libc.crc32c.restype = ctypes.c_uint32
+        assert libc.crc32c(ctypes.c_uint32(0), ctypes.c_char_p(b"123456789"), ctypes.c_size_t(9)) == 0xe3069283
+
+    def test_checksum_roundtrip(self):
+        fs = setup(5)
+        fs = set_fil(name="fil1",inode=1,parent=0,parent_block=0,fs=fs)
+        libc.fs_writef(ctypes.byref(fs), ctypes.c_char_p(bytes("/fil1","UTF-8")),ctypes.c_char_p(bytes(SHORT_DATA,"utf-8")))
+        loaded = dump_and_load(fs)
+        assert loaded
+        assert libc.fs_verify(loaded) == 0
+        size = ctypes.c_int()
+        libc.fs_readf.restype = ctypes.c_char_p
+        retval = libc.fs_readf(loaded, ctypes.c_char_p(bytes("/fil1","UTF-8")), ctypes.byref(size))
+        assert retval.decode("utf-8") == SHORT_DATA
+
+    # a flipped bit in a data block is detected when the block is first read
+    def test_checksum_corrupt_data_block(self):
+        fs = setup(5)
+        fs = set_fil(name="fil1",inode=1,parent=0,parent_block=0,fs=fs)
+        libc.fs_writef(ctypes.byref(fs), ctypes.c_char_p(bytes("/fil1","UTF-8")),ctypes.c_char_p(bytes(SHORT_DATA,"utf-8")))
+        loaded = dump_and_load(fs, corrupt_offset=data_block_offset(5, 0) + ctypes.sizeof(ctypes.c_size_t) + 3)
+        assert loaded
+        size = ctypes.c_int()
+        libc.fs_readf.restype = ctypes.c_char_p
+        assert libc.fs_readf(loaded, ctypes.c_char_p(bytes("/fil1","UTF-8")), ctypes.byref(size)) is None
+        assert libc.fs_verify(loaded) == 1
+
+    # a flipped bit in the inode table makes the whole image unloadable
+    def test_checksum_corrupt_inode_table(self):
+        fs = setup(5)
+        fs = set_fil(name="fil1",inode=1,parent=0,parent_block=0,fs=fs)
+        libc.fs_dump(ctypes.byref(fs), ctypes.c_char_p(bytes(FS_FILE,"UTF-8")))
+        inode_offset = read_superblock(FS_FILE).inodes + ctypes.sizeof(Inode) + Inode.name.offset
+        assert not dump_and_load(fs, corrupt_offset=inode_offset)
+
+    # a damaged block keeps its stored checksum when the image is dumped again
+    def test_checksum_corrupt_block_survives_dump(self):
+        fs = setup(5)
+        fs = set_fil(name="fil1",inode=1,parent=0,parent_block=0,fs=fs)
+        libc.fs_writef(ctypes.byref(fs), ctypes.c_char_p(bytes("/fil1","UTF-8")),ctypes.c_char_p(bytes(SHORT_DATA,"utf-8")))
+        loaded = dump_and_load(fs, corrupt_offset=data_block_offset(5, 0) + ctypes.sizeof(ctypes.c_size_t) + 3)
+        assert loaded
+        reloaded = dump_and_load(loaded.contents)
+        assert reloaded
+        assert libc.fs_verify(reloaded) == 1
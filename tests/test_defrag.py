@@ -0,0 +1,73 @@
+import ctypes
+import threading
+from wrappers import *
+
+class Test_Defrag:
+    # two files with interleaved blocks end up in two contiguous runs from block 0
+    def test_defrag_interleaved(self):
+        fs = setup(10)
+        fs = set_fil(name="fil1",inode=1,parent=0,parent_block=0,fs=fs)
+        fs = set_fil(name="fil2",inode=2,parent=0,parent_block=1,fs=fs)
+        fs = set_data_block_with_string(block_num=7,string_data="a1",parent_inode=1,parent_block_num=0,fs=fs)
+        fs = set_data_block_with_string(block_num=1,string_data="b1",parent_inode=2,parent_block_num=0,fs=fs)
+        fs = set_data_block_with_string(block_num=3,string_data="a2",parent_inode=1,parent_block_num=1,fs=fs)
+        fs = set_data_block_with_string(block_num=0,string_data="b2",parent_inode=2,parent_block_num=1,fs=fs)
+        fs = set_data_block_with_string(block_num=5,string_data="a3",parent_inode=1,parent_block_num=2,fs=fs)
+
+        moved = libc.fs_defrag(ctypes.byref(fs))
+        assert moved == 4
+        assert [fs.inodes[1].direct_blocks[i] for i in range(3)] == [0, 1, 2]
+        assert [fs.inodes[2].direct_blocks[i] for i in range(2)] == [3, 4]
+        assert [fs.free_list[i] for i in range(10)] == [0, 0, 0, 0, 0, 1, 1, 1, 1, 1]
+        assert read(fs, "/fil1") == "a1a2a3"
+        assert read(fs, "/fil2") == "b1b2"
+
+    # an already compact filesystem is left alone
+    def test_defrag_nothing_to_do(self):
+        fs = setup(5)
+        fs = set_fil(name="fil1",inode=1,parent=0,parent_block=0,fs=fs)
+        libc.fs_writef(ctypes.byref(fs), ctypes.c_char_p(bytes("/fil1","UTF-8")),ctypes.c_char_p(bytes(LONG_DATA,"utf-8")))
+        assert libc.fs_defrag(ctypes.byref(fs)) == 0
+        assert read(fs, "/fil1") == LONG_DATA
+
+    # reads and appends running during defragmentation see whole files, the free counts stay exact
+    def test_defrag_concurrent(self):
+        fs = setup(1024)
+        names = ["/fil%d" % i for i in range(4)]
+        for name in names:
+            libc.fs_mkfile(ctypes.byref(fs), ctypes.c_char_p(bytes(name,"UTF-8")))
+        chunks = [chr(ord("a") + i) * BLOCK_SIZE for i in range(4)]
+        done = threading.Event()
+        errors = []
+
+        def writer():
+            # round robin appends interleave the blocks of the files
+            for round in range(30):
+                for name in names:
+                    libc.fs_rm(ctypes.byref(fs), ctypes.c_char_p(bytes(name,"UTF-8")))
+                    libc.fs_mkfile(ctypes.byref(fs), ctypes.c_char_p(bytes(name,"UTF-8")))
+                for block in range(10):
+                    for name, chunk in zip(names, chunks):
+                        libc.fs_writef(ctypes.byref(fs), ctypes.c_char_p(bytes(name,"UTF-8")), ctypes.c_char_p(bytes(chunk,"UTF-8")))
+            done.set()
+
+        def reader():
+            while not done.is_set():
+                for name, chunk in zip(names, chunks):
+                    # a file is empty until its first append
+                    data = read(fs, name) or ""
+                    if data.strip(chunk[0]) != "" or len(data) % BLOCK_SIZE != 0:
+                        errors.append(name)
+
+        threads = [threading.Thread(target=writer), threading.Thread(target=reader)]
+        for thread in threads:
+            thread.start()
+        while not done.is_set():
+            libc.fs_defrag(ctypes.byref(fs))
+        for thread in threads:
+            thread.join()
+        libc.fs_defrag(ctypes.byref(fs))
+        assert errors == []
+        for name, chunk in zip(names, chunks):
+            assert read(fs, name) == chunk * 10
+        assert libc.fs_free_blocks(ctypes.byref(fs)) == sum(fs.free_list[i] for i in range(1024))
@@ -0,0 +1,70 @@
+import ctypes
+import os
+import shutil
+from wrappers import *
+
+FS_FILE = "./mypyfiles.fs"
+REPLICA = "./replica.fs"
+PATCH = "./delta.patch"
+
+libc.fs_load.restype = ctypes.POINTER(FileSystem)
+
+def remove(*files):
+    for f in files:
+        if os.path.exists(f):
+            os.remove(f)
+
+class Test_Delta:
+    # a replica that gets the patch of every change ends up with the same image
+    def test_delta_replicates(self):
+        fs = setup(200)
+        libc.fs_mkdir(ctypes.byref(fs), path("/dir"))
+        libc.fs_mkfile(ctypes.byref(fs), path("/dir/old"))
+        libc.fs_writef(ctypes.byref(fs), path("/dir/old"), path(LONG_DATA))
+        assert libc.fs_dump(ctypes.byref(fs), path(FS_FILE)) == 0
+        shutil.copy(FS_FILE, REPLICA)
+        replica = libc.fs_load(path(REPLICA)).contents
+        # nothing changed since loading
+        assert libc.fs_delta_export(ctypes.byref(replica), path(PATCH)) == 0
+
+        assert libc.fs_delta_export(ctypes.byref(fs), path(PATCH)) > 0
+        assert libc.fs_delta_apply(ctypes.byref(replica), path(PATCH)) == 0
+        libc.fs_mkfile(ctypes.byref(fs), path("/dir/new"))
+        libc.fs_writef(ctypes.byref(fs), path("/dir/new"), path(SHORT_DATA))
+        libc.fs_rm(ctypes.byref(fs), path("/dir/old"))
+        # one inode chunk and the block of the new file
+        assert libc.fs_delta_export(ctypes.byref(fs), path(PATCH)) == 2
+        assert os.path.getsize(PATCH) < os.path.getsize(FS_FILE) / 10
+        assert libc.fs_delta_apply(ctypes.byref(replica), path(PATCH)) == 0
+
+        libc.fs_list.restype = ctypes.c_char_p
+        assert libc.fs_list(ctypes.byref(replica), path("/dir")) == b"FIL new\n"
+        libc.fs_readf.restype = ctypes.c_char_p
+        size = ctypes.c_int()
+        assert libc.fs_readf(ctypes.byref(replica), path("/dir/new"), ctypes.byref(size)) == bytes(SHORT_DATA, "UTF-8")
+
+        assert libc.fs_dump(ctypes.byref(fs), path(FS_FILE)) == 0
+        assert libc.fs_dump(ctypes.byref(replica), path(REPLICA)) == 0
+        assert open(FS_FILE, "rb").read() == open(REPLICA, "rb").read()
+        remove(REPLICA, PATCH)
+
+    # damaged patches and patches of a filesystem of another size are rejected without changes
+    def test_delta_rejects(self):
+        fs = setup(50)
+        libc.fs_mkfile(ctypes.byref(fs), path("/f"))
+        assert libc.fs_delta_export(ctypes.byref(fs), path(PATCH)) > 0
+
+        other = setup(60)
+        assert libc.fs_delta_apply(ctypes.byref(other), path(PATCH)) == -1
+
+        target = setup(50)
+        data = bytearray(open(PATCH, "rb").read())
+        data[len(data) // 2] ^= 0xff
+        open(PATCH, "wb").write(data)
+        assert libc.fs_delta_apply(ctypes.byref(target), path(PATCH)) == -1
+        open(PATCH, "wb").write(data[:-10])
+        assert libc.fs_delta_apply(ctypes.byref(target), path(PATCH)) == -1
+        assert libc.fs_delta_apply(ctypes.byref(target), path("./missing.patch")) == -1
+        libc.fs_list.restype = ctypes.c_char_p
+        assert libc.fs_list(ctypes.byref(target), path("/")) == b""
+        remove(PATCH)
@@ -0,0 +1,58 @@
+import ctypes
+from wrappers import *
+
+class Test_Epoch:
+    # while a reader is inside a section, removed inodes and blocks are not reused
+    def test_epoch_defers_reuse(self):
+        fs = setup(10)
+        libc.fs_mkfile(ctypes.byref(fs), path("/a"))
+        libc.fs_writef(ctypes.byref(fs), path("/a"), path(SHORT_DATA))
+        assert fs.inodes[1].direct_blocks[0] == 0
+
+        libc.fs_epoch_enter(ctypes.byref(fs))
+        assert libc.fs_rm(ctypes.byref(fs), path("/a")) == 0
+        assert fs.inodes[0].direct_blocks[0] == -1
+        assert fs.inodes[1].n_type == NodeType.reg_file
+        assert fs.free_list[0] == 0
+
+        libc.fs_mkfile(ctypes.byref(fs), path("/b"))
+        libc.fs_writef(ctypes.byref(fs), path("/b"), path(SHORT_DATA))
+        assert fs.inodes[0].direct_blocks[0] == 2
+        assert fs.inodes[2].direct_blocks[0] == 1
+
+        libc.fs_epoch_exit(ctypes.byref(fs))
+        assert fs.inodes[1].n_type == NodeType.free_block
+        assert fs.free_list[0] == 1
+        assert libc.fs_free_blocks(ctypes.byref(fs)) == 9
+
+    # nested sections only reclaim when the outermost one ends
+    def test_epoch_nested(self):
+        fs = setup(10)
+        libc.fs_mkdir(ctypes.byref(fs), path("/dir"))
+        libc.fs_mkfile(ctypes.byref(fs), path("/dir/a"))
+        libc.fs_writef(ctypes.byref(fs), path("/dir/a"), path(LONG_DATA))
+
+        libc.fs_epoch_enter(ctypes.byref(fs))
+        libc.fs_epoch_enter(ctypes.byref(fs))
+        libc.fs_rm(ctypes.byref(fs), path("/dir"))
+        libc.fs_epoch_exit(ctypes.byref(fs))
+        assert fs.inodes[2].n_type == NodeType.reg_file
+        assert libc.fs_free_blocks(ctypes.byref(fs)) == 8
+        libc.fs_epoch_exit(ctypes.byref(fs))
+        for i in range(1, 3):
+            assert fs.inodes[i].n_type == NodeType.free_block
+        assert libc.fs_free_blocks(ctypes.byref(fs)) == 10
+
+    # a creator that found a directory before it was removed can't add an entry nobody frees
+    def test_epoch_create_in_removed_dir(self):
+        fs = setup(10)
+        libc.fs_mkdir(ctypes.byref(fs), path("/dir"))
+        dir_num = fs.inodes[0].direct_blocks[0]
+
+        libc.fs_epoch_enter(ctypes.byref(fs))
+        assert libc.fs_rm(ctypes.byref(fs), path("/dir")) == 0
+        assert libc.create_inode(ctypes.byref(fs), dir_num, path("late"), NodeType.reg_file) == -1
+        libc.fs_epoch_exit(ctypes.byref(fs))
+
+        for i in range(1, 10):
+            assert fs.inodes[i].n_type == NodeType.free_block
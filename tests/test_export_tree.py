@@ -0,0 +1,40 @@
+import ctypes
+import os
+import shutil
+from wrappers import *
+
+TREE = "temp_test_export"
+
+def write(fs, path, data):
+    libc.fs_writef(ctypes.byref(fs), ctypes.c_char_p(bytes(path,"UTF-8")),ctypes.c_char_p(bytes(data,"utf-8")))
+
+def export_tree(fs, int_path, threads=4):
+    return libc.fs_export_tree(ctypes.byref(fs), ctypes.c_char_p(bytes(int_path,"UTF-8")), ctypes.c_char_p(bytes(TREE,"UTF-8")), threads)
+
+class Test_ExportTree:
+    def test_export_tree(self):
+        shutil.rmtree(TREE, ignore_errors=True)
+        fs = setup(20)
+        libc.fs_mkdir(ctypes.byref(fs), ctypes.c_char_p(b"/proj"))
+        libc.fs_mkdir(ctypes.byref(fs), ctypes.c_char_p(b"/proj/src"))
+        libc.fs_mkfile(ctypes.byref(fs), ctypes.c_char_p(b"/proj/readme"))
+        libc.fs_mkfile(ctypes.byref(fs), ctypes.c_char_p(b"/proj/src/main"))
+        libc.fs_mkfile(ctypes.byref(fs), ctypes.c_char_p(b"/proj/src/empty"))
+        write(fs, "/proj/readme", SHORT_DATA)
+        write(fs, "/proj/src/main", LONG_DATA * 2)
+
+        assert export_tree(fs, "/proj") == 0
+        assert read_temp_file(os.path.join(TREE, "readme")) == SHORT_DATA
+        assert read_temp_file(os.path.join(TREE, "src/main")) == LONG_DATA * 2
+        assert read_temp_file(os.path.join(TREE, "src/empty")) == ""
+
+        # a second export doesn't overwrite the existing files
+        assert export_tree(fs, "/proj") == 3
+        shutil.rmtree(TREE)
+
+    def test_export_tree_not_a_directory(self):
+        fs = setup(5)
+        libc.fs_mkfile(ctypes.byref(fs), ctypes.c_char_p(b"/fil"))
+        assert export_tree(fs, "/fil") == -1
+        assert export_tree(fs, "/missing") == -1
+        assert not os.path.exists(TREE)
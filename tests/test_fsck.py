@@ -0,0 +1,95 @@
+import ctypes
+from wrappers import *
+
+class FsckReport(ctypes.Structure):
+    _fields_ = [
+        ("bad_inodes", ctypes.c_uint32),
+        ("bad_entries", ctypes.c_uint32),
+        ("multi_linked", ctypes.c_uint32),
+        ("unreachable", ctypes.c_uint32),
+        ("bad_parents", ctypes.c_uint32),
+        ("leaked_blocks", ctypes.c_uint32),
+        ("unmarked_blocks", ctypes.c_uint32),
+        ("shared_blocks", ctypes.c_uint32),
+        ("free_count", ctypes.c_uint32)
+    ]
+
+def fsck(fs, repair=0, threads=0):
+    report = FsckReport()
+    problems = libc.fs_fsck(ctypes.byref(fs), repair, threads, ctypes.byref(report))
+    return problems, report
+
+class Test_Fsck:
+    # a tree built through the operations is consistent, also after removing parts of it
+    def test_fsck_clean(self):
+        fs = setup(10)
+        libc.fs_mkdir(ctypes.byref(fs), ctypes.c_char_p(bytes("/dir","UTF-8")))
+        libc.fs_mkfile(ctypes.byref(fs), ctypes.c_char_p(bytes("/dir/fil","UTF-8")))
+        libc.fs_writef(ctypes.byref(fs), ctypes.c_char_p(bytes("/dir/fil","UTF-8")),ctypes.c_char_p(bytes(LONG_DATA,"utf-8")))
+        libc.fs_mkfile(ctypes.byref(fs), ctypes.c_char_p(bytes("/other","UTF-8")))
+        libc.fs_writef(ctypes.byref(fs), ctypes.c_char_p(bytes("/other","UTF-8")),ctypes.c_char_p(bytes(SHORT_DATA,"utf-8")))
+        assert fsck(fs)[0] == 0
+        libc.fs_rm(ctypes.byref(fs), ctypes.c_char_p(bytes("/dir","UTF-8")))
+        assert fsck(fs, threads=4)[0] == 0
+        assert libc.fs_free_blocks(ctypes.byref(fs)) == 9
+
+    def test_fsck_leaked_block(self):
+        fs = setup(5)
+        fs.free_list[3] = 0
+        # the groups are built from the free list, as when the image is loaded
+        libc.fs_groups_init(ctypes.byref(fs))
+        problems, report = fsck(fs, repair=1)
+        assert problems == 1
+        assert report.leaked_blocks == 1
+        assert fs.free_list[3] == 1
+        assert fsck(fs)[0] == 0
+
+    # inode 2 claims to live in directory 1, which isn't linked into the tree
+    def test_fsck_unreachable(self):
+        fs = setup(5)
+        fs = set_dir(name="lost",inode=1,parent=0,parent_block=0,fs=fs)
+        fs = set_fil(name="fil",inode=2,parent=1,parent_block=0,fs=fs)
+        fs = set_data_block_with_string(block_num=0,string_data="I am lost",parent_inode=2,parent_block_num=0,fs=fs)
+        fs.inodes[0].direct_blocks[0] = -1
+        problems, report = fsck(fs, repair=1)
+        assert report.unreachable == 2
+        assert fs.inodes[1].n_type == 3
+        assert fs.inodes[2].n_type == 3
+        assert fs.free_list[0] == 1
+        assert libc.fs_free_blocks(ctypes.byref(fs)) == 5
+        assert fsck(fs)[0] == 0
+
+    def test_fsck_bad_parent_and_shared_block(self):
+        fs = setup(5)
+        fs = set_fil(name="fil1",inode=1,parent=0,parent_block=0,fs=fs)
+        fs = set_fil(name="fil2",inode=2,parent=0,parent_block=1,fs=fs)
+        fs.inodes[2].parent = 3
+        fs = set_data_block_with_string(block_num=0,string_data="mine",parent_inode=1,parent_block_num=0,fs=fs)
+        fs.inodes[2].direct_blocks[0] = 0
+        fs.inodes[2].size = 4
+        problems, report = fsck(fs, repair=1)
+        assert report.bad_parents == 1
+        assert report.shared_blocks == 1
+        assert fs.inodes[2].parent == 0
+        assert fs.inodes[1].direct_blocks[0] == 0
+        assert fs.inodes[2].direct_blocks[0] == -1
+        assert (fs.inodes[1].size, fs.inodes[2].size) == (4, 0)
+        assert fsck(fs)[0] == 0
+
+    # inode 3 is listed in /a and in the detached directory 2, which its parent pointer names.
+    # It is reachable through /a and keeps living there.
+    def test_fsck_multi_linked_orphan_listing(self):
+        fs = setup(5)
+        fs = set_dir(name="a",inode=1,parent=0,parent_block=0,fs=fs)
+        fs = set_dir(name="lost",inode=2,parent=0,parent_block=1,fs=fs)
+        fs = set_fil(name="fil",inode=3,parent=2,parent_block=0,fs=fs)
+        fs.inodes[1].direct_blocks[0] = 3
+        fs.inodes[0].direct_blocks[1] = -1
+        problems, report = fsck(fs, repair=1, threads=4)
+        assert report.unreachable == 1
+        assert report.multi_linked == 1
+        assert report.bad_parents == 1
+        assert fs.inodes[2].n_type == 3
+        assert fs.inodes[3].n_type == 1
+        assert fs.inodes[3].parent == 1
+        assert fsck(fs)[0] == 0
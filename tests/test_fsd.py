@@ -0,0 +1,98 @@
+import ctypes
+import os
+import signal
+import socket
+import struct
+import subprocess
+import time
+from wrappers import *
+
+FS_FILE = "./mypyfiles.fs"
+SOCKET_PATH = "./fsd_test.sock"
+
+MKDIR, MKFILE, LIST, WRITEF, READF, RM, STAT, DUMP = range(1, 9)
+
+def request(req_id, op, path, data=b""):
+    body = bytes(path, "UTF-8") + data
+    return struct.pack("<IIBBH", len(body), req_id, op, 0, len(path)) + body
+
+def recv_exact(sock, n):
+    data = b""
+    while len(data) < n:
+        chunk = sock.recv(n - len(data))
+        assert chunk != b""
+        data += chunk
+    return data
+
+def response(sock):
+    length, req_id, status = struct.unpack("<IIi", recv_exact(sock, 12))
+    return req_id, status, recv_exact(sock, length)
+
+def start_daemon():
+    daemon = subprocess.Popen(["./build/fsd", FS_FILE, SOCKET_PATH])
+    sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+    for _ in range(200):
+        try:
+            sock.connect(SOCKET_PATH)
+            return daemon, sock
+        except (FileNotFoundError, ConnectionRefusedError):
+            time.sleep(0.01)
+    raise TimeoutError("fsd did not start listening")
+
+class Test_Fsd:
+    # requests sent back to back are answered in order and the image is saved on SIGTERM
+    def test_fsd_pipelined(self):
+        setup(50)
+        daemon, sock = start_daemon()
+        try:
+            sock.sendall(request(1, MKDIR, "/dir") +
+                         request(2, MKFILE, "/dir/fil") +
+                         request(3, WRITEF, "/dir/fil", bytes(LONG_DATA, "UTF-8")) +
+                         request(4, READF, "/dir/fil") +
+                         request(5, LIST, "/dir") +
+                         request(6, STAT, "/dir/fil") +
+                         request(7, MKFILE, "/gone") +
+                         request(8, RM, "/gone") +
+                         request(9, READF, "/missing"))
+            assert response(sock) == (1, 0, b"")
+            assert response(sock) == (2, 0, b"")
+            assert response(sock) == (3, len(LONG_DATA), b"")
+            assert response(sock) == (4, 0, bytes(LONG_DATA, "UTF-8"))
+            assert response(sock) == (5, 0, b"FIL fil\n")
+            req_id, status, payload = response(sock)
+            assert (req_id, status, len(payload)) == (6, 2, 120)
+            record = struct.unpack("<IH32sH12iiIQQQ", payload)
+            assert record[0] == NodeType.reg_file and record[1] == len(LONG_DATA)
+            assert record[2].rstrip(b"\0") == b"fil" and record[16] == 1
+            assert response(sock)[:2] == (7, 0)
+            assert response(sock)[:2] == (8, 0)
+            assert response(sock)[:2] == (9, -1)
+        finally:
+            sock.close()
+            daemon.send_signal(signal.SIGTERM)
+            assert daemon.wait(timeout=10) == 0
+        assert not os.path.exists(SOCKET_PATH)
+
+        libc.fs_load.restype = ctypes.POINTER(FileSystem)
+        loaded = libc.fs_load(ctypes.c_char_p(bytes(FS_FILE, "UTF-8"))).contents
+        libc.fs_readf.restype = ctypes.c_char_p
+        size = ctypes.c_int()
+        data = libc.fs_readf(ctypes.byref(loaded), ctypes.c_char_p(b"/dir/fil"), ctypes.byref(size))
+        assert data == bytes(LONG_DATA, "UTF-8")
+
+    # a request split across writes is executed once it is complete, a bad header closes the connection
+    def test_fsd_partial_and_malformed(self):
+        setup(20)
+        daemon, sock = start_daemon()
+        try:
+            req = request(1, MKFILE, "/f")
+            sock.sendall(req[:5])
+            time.sleep(0.05)
+            sock.sendall(req[5:])
+            assert response(sock) == (1, 0, b"")
+            sock.sendall(struct.pack("<IIBBH", 16, 2, MKDIR, 0, 100))
+            assert sock.recv(1) == b""
+        finally:
+            sock.close()
+            daemon.send_signal(signal.SIGTERM)
+            assert daemon.wait(timeout=10) == 0
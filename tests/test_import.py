@@ -45,4 +45,18 @@ class Test_Imp:
         delete_temp_file()
 
 
+    # the file is streamed in blocks, bytes after a zero byte are kept
+    def test_import_binary_file(self):
+        fs = setup(5)
+        data = bytes(range(256)) * 5
+        with open(DEFAULT_TEST_FILE_NAME, "wb") as f:
+            f.write(data)
+        retval = libc.fs_import(ctypes.byref(fs),ctypes.c_char_p(bytes("/fil1","UTF-8")),ctypes.c_char_p(bytes(DEFAULT_TEST_FILE_NAME,"utf-8")))
+        delete_temp_file()
+
+        assert retval == 0
+        buf = ctypes.create_string_buffer(len(data))
+        assert libc.fs_readf_into(ctypes.byref(fs), ctypes.c_char_p(bytes("/fil1","utf-8")), buf, len(data)) == len(data)
+        assert buf.raw == data
+
     # TODO: add test for failing operations
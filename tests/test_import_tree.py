@@ -0,0 +1,45 @@
+import ctypes
+import os
+import shutil
+from wrappers import *
+
+TREE = "temp_test_tree"
+
+def make_tree(files):
+    shutil.rmtree(TREE, ignore_errors=True)
+    for path, data in files.items():
+        full = os.path.join(TREE, path)
+        os.makedirs(os.path.dirname(full), exist_ok=True)
+        with open(full, "w") as f:
+            f.write(data)
+
+class Test_ImportTree:
+    def test_import_tree(self):
+        files = {"a.txt": SHORT_DATA, "sub/b.txt": LONG_DATA, "sub/deeper/c.txt": "", "other/d.txt": SHORT_DATA * 3}
+        make_tree(files)
+        fs = setup(50)
+        retval = libc.fs_import_tree(ctypes.byref(fs), ctypes.c_char_p(b"/"), ctypes.c_char_p(bytes(TREE,"UTF-8")), 4)
+        assert retval == 0
+        for path, data in files.items():
+            if data:
+                assert read(fs, "/" + path) == data
+        libc.fs_list.restype = ctypes.c_char_p
+        listing = libc.fs_list(ctypes.byref(fs), ctypes.c_char_p(b"/sub/deeper")).decode("utf-8")
+        assert listing == "FIL c.txt\n"
+        assert libc.fs_free_blocks(ctypes.byref(fs)) == 50 - 4
+        shutil.rmtree(TREE)
+
+    # a file that is too big for the direct blocks is skipped, the rest is imported
+    def test_import_tree_partial(self):
+        make_tree({"big": "x" * (DIRECT_BLOCKS_COUNT * BLOCK_SIZE + 1), "small": SHORT_DATA})
+        fs = setup(50)
+        retval = libc.fs_import_tree(ctypes.byref(fs), ctypes.c_char_p(b"/"), ctypes.c_char_p(bytes(TREE,"UTF-8")), 2)
+        assert retval == 1
+        assert read(fs, "/small") == SHORT_DATA
+        assert libc.fs_free_blocks(ctypes.byref(fs)) == 49
+        shutil.rmtree(TREE)
+
+    def test_import_tree_missing(self):
+        fs = setup(5)
+        assert libc.fs_import_tree(ctypes.byref(fs), ctypes.c_char_p(b"/"), ctypes.c_char_p(b"does_not_exist"), 2) == -1
+        assert libc.fs_import_tree(ctypes.byref(fs), ctypes.c_char_p(b"/nodir"), ctypes.c_char_p(b"."), 2) == -1
@@ -1,6 +1,22 @@
 import ctypes
 from wrappers import *
 
+class Dirent(ctypes.Structure):
+    _fields_ = [("inode_num", ctypes.c_int),
+                ("type", ctypes.c_int),
+                ("size", ctypes.c_uint32),
+                ("name", ctypes.c_char * 33)]
+
+class DirentPlus(ctypes.Structure):
+    _fields_ = [("inode_num", ctypes.c_int),
+                ("blocks", ctypes.c_int),
+                ("info", Inode)]
+
+class Dir(ctypes.Structure):
+    _fields_ = [("fs", ctypes.c_void_p),
+                ("dir_num", ctypes.c_int),
+                ("next", ctypes.c_int)]
+
 class Test_List:
     def test_list_one_dir(self):
         fs = setup(5)
@@ -35,3 +51,58 @@ class Test_List:
         libc.fs_list.restype = ctypes.c_char_p
         retval = libc.fs_list(ctypes.byref(fs), ctypes.c_char_p(bytes("/","UTF-8")))
         assert retval.decode("utf-8") == "DIR Dir1\nDIR Dir2\nDIR Dir3\nFIL Fil1\nFIL Fil2\n"
+
+    # fs_list_into prints into the buffer of the caller like snprintf
+    def test_list_into(self):
+        fs = setup(5)
+        fs = set_dir(name="Dir1",inode=1,parent=0,parent_block=0,fs=fs)
+        fs = set_fil(name="Fil1",inode=2,parent=0,parent_block=1,fs=fs)
+
+        buf = ctypes.create_string_buffer(64)
+        retval = libc.fs_list_into(ctypes.byref(fs), ctypes.c_char_p(bytes("/","UTF-8")), buf, 64)
+        assert retval == len("DIR Dir1\nFIL Fil1\n")
+        assert buf.value.decode("utf-8") == "DIR Dir1\nFIL Fil1\n"
+
+        retval = libc.fs_list_into(ctypes.byref(fs), ctypes.c_char_p(bytes("/","UTF-8")), buf, 6)
+        assert retval == len("DIR Dir1\nFIL Fil1\n")
+        assert buf.value.decode("utf-8") == "DIR D"
+
+        retval = libc.fs_list_into(ctypes.byref(fs), ctypes.c_char_p(bytes("/missing","UTF-8")), buf, 64)
+        assert retval == -1
+
+    # fs_readdir hands out the entries in batches, in the order of fs_list
+    def test_readdir_batches(self):
+        fs = setup(10)
+        fs = set_dir(name="Dir1",inode=1,parent=0,parent_block=0,fs=fs)
+        fs = set_fil(name="Fil1",inode=2,parent=0,parent_block=2,fs=fs)
+        fs = set_dir(name="Dir2",inode=3,parent=0,parent_block=5,fs=fs)
+        fs = set_data_block_with_string(block_num=0,string_data=SHORT_DATA,parent_inode=2,parent_block_num=0,fs=fs)
+
+        cursor = Dir()
+        assert libc.fs_opendir(ctypes.byref(fs), ctypes.c_char_p(bytes("/","UTF-8")), ctypes.byref(cursor)) == 0
+        entries = (Dirent * 2)()
+        assert libc.fs_readdir(ctypes.byref(cursor), entries, 2) == 2
+        assert [(e.inode_num, e.type, e.name) for e in entries] == [(1, 2, b"Dir1"), (2, 1, b"Fil1")]
+        assert entries[1].size == len(SHORT_DATA)
+        assert libc.fs_readdir(ctypes.byref(cursor), entries, 2) == 1
+        assert (entries[0].inode_num, entries[0].name) == (3, b"Dir2")
+        assert libc.fs_readdir(ctypes.byref(cursor), entries, 2) == 0
+
+        assert libc.fs_opendir(ctypes.byref(fs), ctypes.c_char_p(bytes("/missing","UTF-8")), ctypes.byref(cursor)) == -1
+
+    # fs_readdir_plus hands out the inode and the block count of every entry
+    def test_readdir_plus(self):
+        fs = setup(10)
+        fs = set_dir(name="Dir1",inode=1,parent=0,parent_block=0,fs=fs)
+        fs = set_fil(name="Fil1",inode=2,parent=0,parent_block=1,fs=fs)
+        fs = set_data_block_with_string(block_num=0,string_data=LONG_DATA[:1024],parent_inode=2,parent_block_num=0,fs=fs)
+        fs = set_data_block_with_string(block_num=1,string_data=LONG_DATA[1024:],parent_inode=2,parent_block_num=1,fs=fs)
+
+        cursor = Dir()
+        assert libc.fs_opendir(ctypes.byref(fs), ctypes.c_char_p(bytes("/","UTF-8")), ctypes.byref(cursor)) == 0
+        entries = (DirentPlus * 12)()
+        assert libc.fs_readdir_plus(ctypes.byref(cursor), entries, 12) == 2
+        assert (entries[0].inode_num, entries[0].blocks, entries[0].info.name) == (1, 0, b"Dir1")
+        assert (entries[1].inode_num, entries[1].blocks, entries[1].info.name) == (2, 2, b"Fil1")
+        assert entries[1].info.size == len(LONG_DATA)
+        assert entries[1].info.parent == 0
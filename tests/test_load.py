@@ -0,0 +1,134 @@
+import ctypes
+import os
+import struct
+from wrappers import *
+
+FS_FILE = "./mypyfiles.fs"
+
+libc.fs_load.restype = ctypes.POINTER(FileSystem)
+libc.fs_load_threads.restype = ctypes.POINTER(FileSystem)
+
+# the image in the format from before the superblock had a magic number: a raw superblock
+# of num_blocks and free_blocks, the inodes without timestamps, then the data blocks
+LEGACY_INODE_SIZE = Inode.parent.offset + 4
+
+def legacy_image(data):
+    sb = DiskSuperblock.from_buffer_copy(data)
+    head = struct.pack("<II", sb.num_blocks, sb.free_blocks)
+    inodes = b"".join(data[sb.inodes + i * sb.inode_size:][:LEGACY_INODE_SIZE] for i in range(sb.num_blocks))
+    return head + data[sb.free_list:sb.inodes] + inodes + data[sb.data_blocks:sb.checksums]
+
+# sets the checksum of a changed superblock
+def seal(sb):
+    libc.crc32c.restype = ctypes.c_uint32
+    sb.crc = libc.crc32c(ctypes.c_uint32(0), bytes(sb)[:DiskSuperblock.crc.offset], ctypes.c_size_t(DiskSuperblock.crc.offset))
+    return bytes(sb)
+
+class Test_Load:
+    # an image read by several threads is the same as one read by a single thread
+    def test_load_threads(self):
+        fs = setup(10000)
+        # directories go to different allocation groups, so the data is spread over the image
+        for i in range(12):
+            libc.fs_mkdir(ctypes.byref(fs), path("/d%d" % i))
+            libc.fs_mkfile(ctypes.byref(fs), path("/d%d/f" % i))
+            libc.fs_writef(ctypes.byref(fs), path("/d%d/f" % i), path(LONG_DATA))
+        assert max(i for i in range(10000) if fs.free_list[i] == 0) > 5000
+        assert libc.fs_dump(ctypes.byref(fs), path(FS_FILE)) == 0
+
+        single = libc.fs_load_threads(path(FS_FILE), 1).contents
+        parallel = libc.fs_load_threads(path(FS_FILE), 4).contents
+        n = single.s_block.contents.num_blocks
+        assert ctypes.string_at(single.inodes, n * ctypes.sizeof(Inode)) == ctypes.string_at(parallel.inodes, n * ctypes.sizeof(Inode))
+        assert ctypes.string_at(single.data_blocks, n * ctypes.sizeof(DataBlock)) == ctypes.string_at(parallel.data_blocks, n * ctypes.sizeof(DataBlock))
+        assert libc.fs_verify(ctypes.byref(parallel)) == 0
+
+    # a damaged inode chunk in the slice of any thread fails the load
+    def test_load_threads_corrupt(self):
+        fs = setup(10000)
+        assert libc.fs_dump(ctypes.byref(fs), path(FS_FILE)) == 0
+        # the last inode, in the slice of the last thread
+        offset = read_superblock(FS_FILE).inodes + 9999 * ctypes.sizeof(Inode) + 10
+        with open(FS_FILE, "r+b") as f:
+            f.seek(offset)
+            f.write(b"\xff")
+        assert not libc.fs_load_threads(path(FS_FILE), 4)
+
+    # the superblock names the root, so it needn't be found by its name
+    def test_load_root_from_superblock(self):
+        fs = setup(20)
+        libc.fs_mkdir(ctypes.byref(fs), path("/dir"))
+        assert fs.s_block.contents.root_node == 0
+        fs.inodes[0].name = b"renamed"
+        assert libc.fs_dump(ctypes.byref(fs), path(FS_FILE)) == 0
+        loaded = libc.fs_load(path(FS_FILE)).contents
+        assert loaded.root_node == 0
+        libc.fs_list.restype = ctypes.c_char_p
+        assert libc.fs_list(ctypes.byref(loaded), path("/")) == b"DIR dir\n"
+
+    # the superblock describes the image
+    def test_image_superblock(self):
+        fs = setup(100)
+        sb = read_superblock(FS_FILE)
+        assert sb.magic == b"HA2FSIMG"
+        assert sb.version == 1
+        assert (sb.num_blocks, sb.free_blocks, sb.root_node) == (100, 100, 0)
+        assert (sb.block_size, sb.inode_size, sb.block_record_size) == (BLOCK_SIZE, ctypes.sizeof(Inode), ctypes.sizeof(DataBlock))
+        assert sb.free_list == ctypes.sizeof(DiskSuperblock)
+        assert sb.inodes == sb.free_list + 100
+        assert sb.image_size == os.path.getsize(FS_FILE)
+
+    # readers take the regions from the superblock, wherever they are
+    def test_load_moved_regions(self):
+        fs = setup(20)
+        libc.fs_mkfile(ctypes.byref(fs), path("/f"))
+        libc.fs_writef(ctypes.byref(fs), path("/f"), path(SHORT_DATA))
+        assert libc.fs_dump(ctypes.byref(fs), path(FS_FILE)) == 0
+        data = open(FS_FILE, "rb").read()
+        sb = DiskSuperblock.from_buffer_copy(data)
+        gap = 4096
+        for region in ("free_list", "inodes", "data_blocks", "checksums", "inode_checksums", "image_size"):
+            setattr(sb, region, getattr(sb, region) + gap)
+        open(FS_FILE, "wb").write(seal(sb) + bytes(gap) + data[ctypes.sizeof(DiskSuperblock):])
+        loaded = libc.fs_load(path(FS_FILE)).contents
+        libc.fs_readf.restype = ctypes.c_char_p
+        assert libc.fs_readf(ctypes.byref(loaded), path("/f"), ctypes.byref(ctypes.c_int())) == bytes(SHORT_DATA, "UTF-8")
+        assert libc.fs_verify(ctypes.byref(loaded)) == 0
+
+    # images of a newer version, with a damaged superblock or of no known format are refused
+    def test_load_refuses_unknown(self):
+        fs = setup(20)
+        data = open(FS_FILE, "rb").read()
+        sb = DiskSuperblock.from_buffer_copy(data)
+        sb.version = 2
+        open(FS_FILE, "wb").write(seal(sb) + data[ctypes.sizeof(DiskSuperblock):])
+        assert not libc.fs_load(path(FS_FILE))
+
+        damaged = bytearray(data)
+        damaged[DiskSuperblock.free_blocks.offset] ^= 1
+        open(FS_FILE, "wb").write(damaged)
+        assert not libc.fs_load(path(FS_FILE))
+
+        open(FS_FILE, "wb").write(b"not an image")
+        assert not libc.fs_load(path(FS_FILE))
+
+    # an image of the format before the magic number is converted and dumped in the current one,
+    # its root is found by its name
+    def test_load_legacy_image(self):
+        fs = setup(20)
+        libc.fs_mkdir(ctypes.byref(fs), path("/dir"))
+        libc.fs_mkfile(ctypes.byref(fs), path("/dir/f"))
+        libc.fs_writef(ctypes.byref(fs), path("/dir/f"), path(SHORT_DATA))
+        assert libc.fs_dump(ctypes.byref(fs), path(FS_FILE)) == 0
+        current = open(FS_FILE, "rb").read()
+        open(FS_FILE, "wb").write(legacy_image(current))
+        loaded = libc.fs_load(path(FS_FILE)).contents
+        assert loaded.root_node == 0
+        libc.fs_list.restype = ctypes.c_char_p
+        assert libc.fs_list(ctypes.byref(loaded), path("/")) == b"DIR dir\n"
+        os.remove(FS_FILE)
+        assert libc.fs_dump(ctypes.byref(loaded), path(FS_FILE)) == 0
+        reloaded = libc.fs_load(path(FS_FILE)).contents
+        assert libc.fs_verify(ctypes.byref(reloaded)) == 0
+        libc.fs_readf.restype = ctypes.c_char_p
+        assert libc.fs_readf(ctypes.byref(reloaded), path("/dir/f"), ctypes.byref(ctypes.c_int())) == bytes(SHORT_DATA, "UTF-8")
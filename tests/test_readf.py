@@ -61,3 +61,23 @@ class Test_Readf:
         assert file_length.value == 0
         assert retval == None
 
+
+    # fs_readf_into copies into the buffer of the caller and returns the whole size, even if it is cut off
+    def test_readf_into(self):
+        fs = setup(5)
+        fs = set_fil(name="fil1",inode=1,parent=0,parent_block=0,fs=fs)
+        fs = set_data_block_with_string(block_num=0,string_data=LONG_DATA[:1024],parent_inode=1,parent_block_num=0,fs=fs)
+        fs = set_data_block_with_string(block_num=1,string_data=LONG_DATA[1024:],parent_inode=1,parent_block_num=1,fs=fs)
+
+        buf = ctypes.create_string_buffer(len(LONG_DATA))
+        retval = libc.fs_readf_into(ctypes.byref(fs), ctypes.c_char_p(bytes("/fil1","utf-8")), buf, len(LONG_DATA))
+        assert retval == len(LONG_DATA)
+        assert buf.raw.decode("utf-8") == LONG_DATA
+
+        small = ctypes.create_string_buffer(b"#" * 16, 16)
+        retval = libc.fs_readf_into(ctypes.byref(fs), ctypes.c_char_p(bytes("/fil1","utf-8")), small, 10)
+        assert retval == len(LONG_DATA)
+        assert small.raw == bytes(LONG_DATA[:10],"utf-8") + b"#" * 6
+
+        retval = libc.fs_readf_into(ctypes.byref(fs), ctypes.c_char_p(bytes("/nofile","utf-8")), buf, len(LONG_DATA))
+        assert retval == -1
@@ -0,0 +1,42 @@
+import ctypes
+from wrappers import *
+
+class Test_Resize:
+    def test_resize_grow(self):
+        fs = setup(2)
+        libc.fs_mkfile(ctypes.byref(fs), ctypes.c_char_p(bytes("/fil1","UTF-8")))
+        retval = libc.fs_resize(ctypes.byref(fs), 6)
+        assert retval == 0
+        assert fs.s_block.contents.num_blocks == 6
+        assert libc.fs_free_blocks(ctypes.byref(fs)) == 6
+        assert fs.inodes[5].n_type == 3
+        assert fs.free_list[5] == 1
+        retval = libc.fs_writef(ctypes.byref(fs), ctypes.c_char_p(bytes("/fil1","UTF-8")),ctypes.c_char_p(bytes(LONG_DATA * 3,"utf-8")))
+        assert retval == len(LONG_DATA) * 3
+        assert read(fs, "/fil1") == LONG_DATA * 3
+
+    # the directory at inode 4 and the data in block 4 are moved into the remaining blocks
+    def test_resize_shrink_moves_tail(self):
+        fs = setup(6)
+        fs = set_dir(name="dir",inode=4,parent=0,parent_block=0,fs=fs)
+        fs = set_fil(name="fil",inode=1,parent=4,parent_block=0,fs=fs)
+        fs = set_data_block_with_string(block_num=4,string_data=SHORT_DATA,parent_inode=1,parent_block_num=0,fs=fs)
+        retval = libc.fs_resize(ctypes.byref(fs), 3)
+        assert retval == 0
+        assert fs.s_block.contents.num_blocks == 3
+        assert fs.inodes[2].name.decode("utf-8") == "dir"
+        assert fs.inodes[0].direct_blocks[0] == 2
+        assert fs.inodes[1].parent == 2
+        assert fs.inodes[1].direct_blocks[0] == 0
+        # both relocations count as a change of the inode
+        assert fs.inodes[2].ctime > 0 and fs.inodes[1].ctime > 0
+        assert libc.fs_free_blocks(ctypes.byref(fs)) == 2
+        assert read(fs, "/dir/fil") == SHORT_DATA
+
+    def test_resize_shrink_too_small(self):
+        fs = setup(4)
+        fs = set_fil(name="fil",inode=1,parent=0,parent_block=0,fs=fs)
+        fs = set_fil(name="fil2",inode=2,parent=0,parent_block=1,fs=fs)
+        assert libc.fs_resize(ctypes.byref(fs), 2) == -1
+        assert fs.s_block.contents.num_blocks == 4
+        assert fs.inodes[2].name.decode("utf-8") == "fil2"
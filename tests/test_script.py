@@ -0,0 +1,58 @@
+import ctypes
+import subprocess
+from wrappers import *
+
+FS_FILE = "./mypyfiles.fs"
+
+def run_ha2(args, script):
+    return subprocess.run(["./build/ha2"] + args, input=bytes(script, "UTF-8"), capture_output=True)
+
+class Test_Script:
+    # a script on stdin runs without a prompt, its output comes out in order and --dump saves the image
+    def test_script_stdin_dump(self):
+        result = run_ha2(["-c", FS_FILE, "50", "--dump"],
+                         "mkdir /dir\n"
+                         "mkfile /dir/fil\n"
+                         "\n"
+                         "# comments are skipped\n"
+                         "writef /dir/fil %s\n"
+                         "list /dir\n"
+                         "readf /dir/fil\n" % SHORT_DATA)
+        assert result.returncode == 0
+        assert result.stdout == bytes("FIL fil\n" + SHORT_DATA, "UTF-8")
+
+        libc.fs_load.restype = ctypes.POINTER(FileSystem)
+        loaded = libc.fs_load(ctypes.c_char_p(bytes(FS_FILE, "UTF-8"))).contents
+        libc.fs_readf.restype = ctypes.c_char_p
+        size = ctypes.c_int()
+        assert libc.fs_readf(ctypes.byref(loaded), ctypes.c_char_p(b"/dir/fil"), ctypes.byref(size)) == bytes(SHORT_DATA, "UTF-8")
+
+    # failing commands are reported with their line, the rest of the script still runs
+    def test_script_failures(self):
+        setup(20)
+        result = run_ha2(["-l", FS_FILE, "--batch"],
+                         "rm /missing\n"
+                         "mkfile /f\n"
+                         "nonsense\n"
+                         "writef /f abc\n"
+                         "readf /f\n"
+                         "exit\n"
+                         "mkfile /never\n")
+        assert result.returncode == 1
+        assert b"line 1: rm failed" in result.stderr
+        assert b"line 3: nonsense failed" in result.stderr
+        assert result.stdout == b"abc"
+
+    # without --dump the image on disk stays untouched
+    def test_script_no_dump(self):
+        setup(20)
+        assert run_ha2(["-l", FS_FILE, "-b"], "mkdir /dir\n").returncode == 0
+        result = run_ha2(["-l", FS_FILE, "-b"], "list /\n")
+        assert result.stdout == b""
+
+    # list -l prints type, inode, size and blocks of every entry
+    def test_script_long_list(self):
+        setup(20)
+        result = run_ha2(["-l", FS_FILE, "-b"], "mkdir /dir\nmkfile /f\nwritef /f abc\nlist -l /\n")
+        assert result.returncode == 0
+        assert result.stdout == b"DIR 1 0 0 dir\nFIL 2 3 1 f\n"
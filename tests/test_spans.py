@@ -0,0 +1,37 @@
+import ctypes
+import json
+from wrappers import *
+
+SPANS_FILE = "./spans_test.json"
+
+class Test_Spans:
+    # the slow paths show up as complete events of a valid Chrome trace, nested spans lie inside their parent
+    def test_spans_chrome_trace(self):
+        fs = setup(50)
+        external = create_temp_file()
+        libc.fs_mkdir(ctypes.byref(fs), path("/dir"))
+        libc.fs_mkfile(ctypes.byref(fs), path("/dir/fil"))
+        libc.fs_writef(ctypes.byref(fs), path("/dir/fil"), path(SHORT_DATA))
+
+        assert libc.fs_spans_start(path(SPANS_FILE)) == 0
+        libc.fs_import(ctypes.byref(fs), path("/imp"), path(external))
+        libc.fs_rm(ctypes.byref(fs), path("/dir"))
+        libc.fs_dump(ctypes.byref(fs), path("./mypyfiles.fs"))
+        libc.fs_spans_stop()
+        libc.fs_rm(ctypes.byref(fs), path("/imp"))
+        delete_temp_file()
+
+        with open(SPANS_FILE) as f:
+            events = json.load(f)
+        delete_temp_file(SPANS_FILE)
+        names = [e["name"] for e in events]
+        assert names.count("fs_import") == 1
+        assert names.count("remove_inode") == 2
+        assert names.count("fs_dump") == 1
+        assert {"dump.reclaim", "dump.checksums", "dump.write"} <= set(names)
+
+        spans = {e["name"]: e for e in events if e["ph"] == "X"}
+        dump = spans["fs_dump"]
+        write = spans["dump.write"]
+        assert dump["ts"] <= write["ts"] and write["ts"] + write["dur"] <= dump["ts"] + dump["dur"]
+        assert events[-1]["name"] == "dropped_spans" and events[-1]["args"]["count"] == 0
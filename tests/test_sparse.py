@@ -0,0 +1,58 @@
+import ctypes
+import os
+import resource
+import signal
+from wrappers import *
+
+FS_FILE = "./mypyfiles.fs"
+
+def allocated(path):
+    return os.stat(path).st_blocks * 512
+
+class Test_Sparse:
+    # 4096 blocks of 1KiB, but only the metadata is stored
+    def test_sparse_create(self):
+        setup(4096)
+        assert os.stat(FS_FILE).st_size > 4096 * BLOCK_SIZE
+        assert allocated(FS_FILE) < 1024 * BLOCK_SIZE
+
+    def test_sparse_dump_load_rm(self):
+        fs = setup(4096)
+        for i in range(8):
+            name = "/fil%d" % i
+            libc.fs_mkfile(ctypes.byref(fs), ctypes.c_char_p(bytes(name,"UTF-8")))
+            libc.fs_writef(ctypes.byref(fs), ctypes.c_char_p(bytes(name,"UTF-8")),ctypes.c_char_p(bytes(LONG_DATA * 8,"utf-8")))
+        libc.fs_dump(ctypes.byref(fs), ctypes.c_char_p(bytes(FS_FILE,"UTF-8")))
+        full = allocated(FS_FILE)
+
+        libc.fs_load.restype = ctypes.POINTER(FileSystem)
+        loaded = libc.fs_load(ctypes.c_char_p(bytes(FS_FILE,"UTF-8")))
+        assert read(loaded, "/fil3") == LONG_DATA * 8
+        assert libc.fs_verify(loaded) == 0
+
+        # the freed blocks are punched out of the image on the next dump
+        for i in range(8):
+            libc.fs_rm(loaded, ctypes.c_char_p(bytes("/fil%d" % i,"UTF-8")))
+        libc.fs_dump(loaded, ctypes.c_char_p(bytes(FS_FILE,"UTF-8")))
+        assert allocated(FS_FILE) < full - 64 * BLOCK_SIZE
+        reloaded = libc.fs_load(ctypes.c_char_p(bytes(FS_FILE,"UTF-8")))
+        assert libc.fs_verify(reloaded) == 0
+        assert reloaded.contents.inodes[0].direct_blocks[0] == -1
+
+    # a dump that can't write the whole image reports it instead of succeeding
+    def test_sparse_dump_write_error(self):
+        fs = setup(64)
+        libc.fs_mkfile(ctypes.byref(fs), ctypes.c_char_p(b"/fil"))
+        libc.fs_writef(ctypes.byref(fs), ctypes.c_char_p(b"/fil"), ctypes.c_char_p(bytes(LONG_DATA,"utf-8")))
+        assert libc.fs_dump(ctypes.byref(fs), ctypes.c_char_p(bytes(FS_FILE,"UTF-8"))) == 0
+
+        # the file size limit makes every write behind the first KiB fail with EFBIG,
+        # the size of the image itself doesn't change
+        pid = os.fork()
+        if pid == 0:
+            signal.signal(signal.SIGXFSZ, signal.SIG_IGN)
+            resource.setrlimit(resource.RLIMIT_FSIZE, (1024, 1024))
+            result = libc.fs_dump(ctypes.byref(fs), ctypes.c_char_p(bytes(FS_FILE,"UTF-8")))
+            os._exit(result & 0xff)
+        _, status = os.waitpid(pid, 0)
+        assert os.WEXITSTATUS(status) == 255
@@ -0,0 +1,82 @@
+import ctypes
+import threading
+from wrappers import *
+
+class Test_Stat:
+    def test_stat(self):
+        fs = setup(10)
+        libc.fs_mkdir(ctypes.byref(fs), path("/dir"))
+        libc.fs_mkfile(ctypes.byref(fs), path("/dir/fil"))
+        libc.fs_writef(ctypes.byref(fs), path("/dir/fil"), path(SHORT_DATA))
+        info = Inode()
+        assert libc.fs_stat(ctypes.byref(fs), path("/dir/fil"), ctypes.byref(info)) == 2
+        assert info.n_type == NodeType.reg_file
+        assert info.size == len(SHORT_DATA)
+        assert info.parent == 1
+        assert info.name == b"fil"
+        assert libc.fs_stat(ctypes.byref(fs), path("/dir"), ctypes.byref(info)) == 1
+        assert info.n_type == NodeType.directory
+        assert info.direct_blocks[0] == 2
+
+    def test_stat_missing(self):
+        fs = setup(5)
+        info = Inode()
+        assert libc.fs_stat(ctypes.byref(fs), path("/nothing"), ctypes.byref(info)) == -1
+        libc.fs_mkfile(ctypes.byref(fs), path("/fil"))
+        assert libc.fs_stat(ctypes.byref(fs), path("/fil/below"), ctypes.byref(info)) == -1
+
+    # listings taken while another thread creates and removes entries are never torn
+    def test_list_concurrent(self):
+        fs = setup(50)
+        libc.fs_mkdir(ctypes.byref(fs), path("/dir"))
+        libc.fs_list.restype = ctypes.c_void_p
+        names = ["entry%d" % i for i in range(8)]
+        done = threading.Event()
+
+        def writer():
+            for round in range(300):
+                for name in names:
+                    libc.fs_mkfile(ctypes.byref(fs), path("/dir/" + name))
+                for name in names:
+                    libc.fs_rm(ctypes.byref(fs), path("/dir/" + name))
+            done.set()
+
+        thread = threading.Thread(target=writer)
+        thread.start()
+        listings = 0
+        while not done.is_set():
+            result = libc.fs_list(ctypes.byref(fs), path("/dir"))
+            for line in ctypes.string_at(result).decode("utf-8").splitlines():
+                assert line in ["FIL " + name for name in names]
+            libc.free(ctypes.c_void_p(result))
+            listings += 1
+        thread.join()
+        assert listings > 0
+        assert fs.inodes[1].direct_blocks[0] == -1
+
+    # threads creating, writing and removing the same names never leave a name twice in a
+    # directory, and every inode and block is freed once
+    def test_create_remove_concurrent(self):
+        fs = setup(50)
+        libc.fs_mkdir(ctypes.byref(fs), path("/dir"))
+        names = ["entry%d" % i for i in range(4)]
+
+        def worker():
+            for round in range(200):
+                for name in names:
+                    libc.fs_mkfile(ctypes.byref(fs), path("/dir/" + name))
+                    libc.fs_writef(ctypes.byref(fs), path("/dir/" + name), path("data"))
+                for name in names:
+                    libc.fs_rm(ctypes.byref(fs), path("/dir/" + name))
+
+        threads = [threading.Thread(target=worker) for i in range(4)]
+        for thread in threads:
+            thread.start()
+        for thread in threads:
+            thread.join()
+        for name in names:
+            assert libc.fs_mkfile(ctypes.byref(fs), path("/dir/" + name)) == 0
+            assert libc.fs_mkfile(ctypes.byref(fs), path("/dir/" + name)) == -2
+        entries = [fs.inodes[1].direct_blocks[i] for i in range(DIRECT_BLOCKS_COUNT)]
+        assert sorted(fs.inodes[e].name.decode("utf-8") for e in entries if e != -1) == names
+        assert libc.fs_free_blocks(ctypes.byref(fs)) == 50
@@ -0,0 +1,71 @@
+import ctypes
+import threading
+from wrappers import *
+
+STATS_WALK_DEPTH = 8
+
+# parses the output of fs_stats_format into {name: {key: value}} and {counter: value}
+def snapshot():
+    libc.fs_stats_format.restype = ctypes.c_void_p
+    ptr = libc.fs_stats_format()
+    text = ctypes.string_at(ptr).decode()
+    libc.free(ctypes.c_void_p(ptr))
+    hists, counters = {}, {}
+    for line in text.splitlines():
+        words = line.split()
+        if "=" in words[1]:
+            hists[words[0]] = {k: int(v) for k, v in (w.split("=") for w in words[1:])}
+        else:
+            counters[words[0]] = int(words[1])
+    return hists, counters
+
+class Test_Stats:
+    # operations are counted with their latency, bytes and blocks only while recording is on
+    def test_stats_operations(self):
+        fs = setup(50)
+        libc.fs_stats_reset()
+        libc.fs_mkdir(ctypes.byref(fs), path("/dir"))
+        assert snapshot()[0]["mkdir"]["count"] == 0
+
+        libc.fs_stats_enable(1)
+        try:
+            libc.fs_mkdir(ctypes.byref(fs), path("/dir/sub"))
+            libc.fs_mkfile(ctypes.byref(fs), path("/dir/sub/fil"))
+            libc.fs_writef(ctypes.byref(fs), path("/dir/sub/fil"), path(LONG_DATA))
+            size = ctypes.c_int()
+            libc.fs_readf(ctypes.byref(fs), path("/dir/sub/fil"), ctypes.byref(size))
+            libc.fs_rm(ctypes.byref(fs), path("/dir"))
+            hists, counters = snapshot()
+        finally:
+            libc.fs_stats_enable(0)
+
+        for op in ["mkdir", "mkfile", "writef", "readf", "rm"]:
+            assert hists[op]["count"] == 1
+            assert hists[op]["p50"] <= hists[op]["max"]
+        assert hists["list"]["count"] == 0
+        assert hists["walk_depth"]["max"] == 2
+        assert counters["bytes_written"] == len(LONG_DATA)
+        assert counters["bytes_read"] == len(LONG_DATA)
+        assert counters["blocks_allocated"] == 2
+        assert counters["blocks_freed"] == 2
+
+    # the histogram keeps values to a few percent, the shards of all threads are summed
+    def test_stats_histogram(self):
+        libc.fs_stats_reset()
+        def record(values):
+            for v in values:
+                libc.stats_record(STATS_WALK_DEPTH, ctypes.c_uint64(v))
+        threads = [threading.Thread(target=record, args=(range(1 + i, 100001, 4),)) for i in range(4)]
+        for t in threads:
+            t.start()
+        for t in threads:
+            t.join()
+
+        h = snapshot()[0]["walk_depth"]
+        assert h["count"] == 100000
+        assert h["max"] == 100000
+        assert h["mean"] == 50000
+        for p, key in [(0.5, "p50"), (0.9, "p90"), (0.99, "p99")]:
+            assert p * 100000 <= h[key] <= p * 100000 * 1.07
+        libc.fs_stats_reset()
+        assert snapshot()[0]["walk_depth"]["count"] == 0
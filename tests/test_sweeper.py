@@ -0,0 +1,55 @@
+import ctypes
+from wrappers import *
+
+class Test_Sweeper:
+    # with a sweeper, rm detaches right away and the subtree is freed in the background
+    def test_sweeper_rm_tree(self):
+        fs = setup(200)
+        assert libc.fs_sweeper_start(ctypes.byref(fs), 4) == 0
+        libc.fs_mkdir(ctypes.byref(fs), ctypes.c_char_p(bytes("/top","UTF-8")))
+        for i in range(10):
+            libc.fs_mkdir(ctypes.byref(fs), ctypes.c_char_p(bytes("/top/d%d" % i,"UTF-8")))
+            for j in range(10):
+                path = "/top/d%d/f%d" % (i, j)
+                libc.fs_mkfile(ctypes.byref(fs), ctypes.c_char_p(bytes(path,"UTF-8")))
+                libc.fs_writef(ctypes.byref(fs), ctypes.c_char_p(bytes(path,"UTF-8")),ctypes.c_char_p(bytes(SHORT_DATA,"utf-8")))
+        assert libc.fs_free_blocks(ctypes.byref(fs)) == 100
+
+        retval = libc.fs_rm(ctypes.byref(fs), ctypes.c_char_p(bytes("/top","UTF-8")))
+        assert retval == 0
+        assert fs.inodes[0].direct_blocks[0] == -1
+        libc.fs_sweeper_drain(ctypes.byref(fs))
+        assert libc.fs_free_blocks(ctypes.byref(fs)) == 200
+        for i in range(1, 200):
+            assert fs.inodes[i].n_type == 3
+            assert fs.free_list[i] == 1
+        libc.fs_sweeper_stop(ctypes.byref(fs))
+
+    # rm keeps working synchronously once the sweeper is stopped
+    def test_sweeper_stopped(self):
+        fs = setup(5)
+        libc.fs_sweeper_start(ctypes.byref(fs), 2)
+        libc.fs_sweeper_stop(ctypes.byref(fs))
+        fs = set_fil(name="newFil",inode=1,parent=0,parent_block=0,fs=fs)
+        assert libc.fs_rm(ctypes.byref(fs), ctypes.c_char_p(bytes("/newFil","UTF-8"))) == 0
+        assert fs.inodes[1].n_type == 3
+
+    # a writer that found a file before the sweeper removed it can't append blocks nobody frees
+    def test_sweeper_rm_refuses_late_append(self):
+        fs = setup(50)
+        assert libc.fs_sweeper_start(ctypes.byref(fs), 2) == 0
+        libc.fs_mkfile(ctypes.byref(fs), ctypes.c_char_p(bytes("/fil","UTF-8")))
+        libc.fs_writef(ctypes.byref(fs), ctypes.c_char_p(bytes("/fil","UTF-8")), ctypes.c_char_p(bytes(SHORT_DATA,"utf-8")))
+        inode_num = fs.inodes[0].direct_blocks[0]
+
+        # the read side section stands for the writer, it keeps the inode from being reused
+        libc.fs_epoch_enter(ctypes.byref(fs))
+        assert libc.fs_rm(ctypes.byref(fs), ctypes.c_char_p(bytes("/fil","UTF-8"))) == 0
+        libc.fs_sweeper_drain(ctypes.byref(fs))
+        text = bytes(LONG_DATA, "utf-8")
+        assert libc.append_inode(ctypes.byref(fs), inode_num, ctypes.c_char_p(text), len(text)) == -1
+        libc.fs_epoch_exit(ctypes.byref(fs))
+
+        assert libc.fs_free_blocks(ctypes.byref(fs)) == 50
+        assert fs.inodes[inode_num].n_type == 3
+        libc.fs_sweeper_stop(ctypes.byref(fs))
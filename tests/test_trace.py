@@ -0,0 +1,88 @@
+import ctypes
+from wrappers import *
+
+TRACE_FILE = "./trace_test.tsv"
+STATS_BUCKETS = 608
+TRACE_OPS = 9
+
+class TraceReport(ctypes.Structure):
+    _fields_ = [
+        ("ops", ctypes.c_uint64),
+        ("mismatches", ctypes.c_uint64),
+        ("skipped", ctypes.c_uint64),
+        ("duration_ns", ctypes.c_uint64),
+        ("latency", ctypes.c_uint64 * ((3 + STATS_BUCKETS) * TRACE_OPS))
+    ]
+
+def entries():
+    with open(TRACE_FILE) as f:
+        return [line.rstrip("\n").split("\t") for line in f if not line.startswith("#")]
+
+class Test_Trace:
+    # every top level call is logged with its result and size, the calls inside fs_import are not
+    def test_trace_record(self):
+        fs = setup(50)
+        external = create_temp_file()
+        assert libc.fs_trace_start(path(TRACE_FILE)) == 0
+        libc.fs_mkdir(ctypes.byref(fs), path("/dir"))
+        libc.fs_mkfile(ctypes.byref(fs), path("/dir/fil"))
+        libc.fs_writef(ctypes.byref(fs), path("/dir/fil"), path(SHORT_DATA))
+        size = ctypes.c_int()
+        libc.fs_readf(ctypes.byref(fs), path("/dir/fil"), ctypes.byref(size))
+        libc.fs_import(ctypes.byref(fs), path("/imp"), path(external))
+        libc.fs_rm(ctypes.byref(fs), path("/missing"))
+        libc.fs_trace_stop()
+        libc.fs_mkdir(ctypes.byref(fs), path("/after"))
+        delete_temp_file()
+
+        lines = entries()
+        assert [(l[1], l[3], l[4], l[5], l[6]) for l in lines] == [
+            ("mkdir", "0", "0", "/dir", ""),
+            ("mkfile", "0", "0", "/dir/fil", ""),
+            ("writef", str(len(SHORT_DATA)), str(len(SHORT_DATA)), "/dir/fil", ""),
+            ("readf", str(len(SHORT_DATA)), str(len(SHORT_DATA)), "/dir/fil", ""),
+            ("import", "0", "0", "/imp", external),
+            ("rm", "-1", "0", "/missing", ""),
+        ]
+        starts = [int(l[0]) for l in lines]
+        assert starts == sorted(starts)
+        delete_temp_file(TRACE_FILE)
+
+    # a replay against a fresh image gets the recorded results back, broken lines are skipped
+    def test_trace_replay(self):
+        fs = setup(50)
+        libc.fs_trace_start(path(TRACE_FILE))
+        libc.fs_mkdir(ctypes.byref(fs), path("/dir"))
+        libc.fs_mkfile(ctypes.byref(fs), path("/dir/fil"))
+        libc.fs_writef(ctypes.byref(fs), path("/dir/fil"), path(LONG_DATA))
+        libc.fs_trace_stop()
+        with open(TRACE_FILE, "a") as f:
+            f.write("garbage line\n")
+
+        fresh = setup(50)
+        report = TraceReport()
+        assert libc.fs_trace_replay(ctypes.byref(fresh), path(TRACE_FILE), ctypes.c_double(0), ctypes.byref(report)) == 0
+        assert (report.ops, report.mismatches, report.skipped) == (3, 0, 1)
+        assert fresh.inodes[2].size == len(LONG_DATA)
+
+        # replayed on the same image again, mkdir and mkfile fail now
+        assert libc.fs_trace_replay(ctypes.byref(fresh), path(TRACE_FILE), ctypes.c_double(0), ctypes.byref(report)) == 0
+        assert report.mismatches == 2
+        assert libc.fs_trace_replay(ctypes.byref(fresh), path("./missing.tsv"), ctypes.c_double(0), ctypes.byref(report)) == -1
+        delete_temp_file(TRACE_FILE)
+
+    # a recorded readf of an empty file replays as size 0, not as a missing file
+    def test_trace_replay_empty_file(self):
+        fs = setup(50)
+        libc.fs_trace_start(path(TRACE_FILE))
+        libc.fs_mkfile(ctypes.byref(fs), path("/empty"))
+        size = ctypes.c_int()
+        libc.fs_readf(ctypes.byref(fs), path("/empty"), ctypes.byref(size))
+        libc.fs_trace_stop()
+        assert [(l[1], l[3]) for l in entries()] == [("mkfile", "0"), ("readf", "0")]
+
+        fresh = setup(50)
+        report = TraceReport()
+        assert libc.fs_trace_replay(ctypes.byref(fresh), path(TRACE_FILE), ctypes.c_double(0), ctypes.byref(report)) == 0
+        assert (report.ops, report.mismatches) == (2, 0)
+        delete_temp_file(TRACE_FILE)
@@ -33,16 +33,47 @@ class Inode(ctypes.Structure):
         ("size", ctypes.c_uint16),
         ("name", ctypes.c_char * NAME_MAX_LENGTH),
         ("direct_blocks", ctypes.c_int * DIRECT_BLOCKS_COUNT),
-        ("parent", ctypes.c_int)
+        ("parent", ctypes.c_int),
+        ("mtime", ctypes.c_uint64),
+        ("ctime", ctypes.c_uint64),
+        ("change_seq", ctypes.c_uint64)
     ]
 
 # Define the superblock structure
 class Superblock(ctypes.Structure):
     _fields_ = [
         ("num_blocks", ctypes.c_uint32),
-        ("free_blocks", ctypes.c_uint32)
+        ("free_blocks", ctypes.c_uint32),
+        ("root_node", ctypes.c_int32)
     ]
 
+# Define the superblock of an image file, fields are little-endian
+class DiskSuperblock(ctypes.LittleEndianStructure):
+    _fields_ = [
+        ("magic", ctypes.c_char * 8),
+        ("version", ctypes.c_uint32),
+        ("header_size", ctypes.c_uint32),
+        ("num_blocks", ctypes.c_uint32),
+        ("free_blocks", ctypes.c_uint32),
+        ("root_node", ctypes.c_int32),
+        ("block_size", ctypes.c_uint32),
+        ("inode_size", ctypes.c_uint32),
+        ("block_record_size", ctypes.c_uint32),
+        ("free_list", ctypes.c_uint64),
+        ("inodes", ctypes.c_uint64),
+        ("data_blocks", ctypes.c_uint64),
+        ("checksums", ctypes.c_uint64),
+        ("inode_checksums", ctypes.c_uint64),
+        ("image_size", ctypes.c_uint64),
+        ("reserved", ctypes.c_uint32),
+        ("crc", ctypes.c_uint32)
+    ]
+
+# reads the superblock of an image file
+def read_superblock(image_path):
+    with open(image_path, "rb") as f:
+        return DiskSuperblock.from_buffer_copy(f.read(ctypes.sizeof(DiskSuperblock)))
+
 # Define the file_system structure
 class FileSystem(ctypes.Structure):
     _fields_ = [
@@ -81,6 +112,26 @@ def set_fil(name: str, inode: int, parent: int, parent_block: int, fs):
     fs.inodes[parent].direct_blocks[parent_block] = inode
     return fs
 
+# path argument for the C functions
+def path(p):
+    return ctypes.c_char_p(bytes(p,"UTF-8"))
+
+# a fs_readf of its own, tests calling libc.fs_readf directly set its restype to c_char_p
+readf = libc["fs_readf"]
+readf.restype = ctypes.c_void_p
+
+# reads a whole file, fs is a filesystem or a pointer to one. None if the file can't be read
+def read(fs, file_path):
+    size = ctypes.c_int()
+    if not isinstance(fs, ctypes._Pointer):
+        fs = ctypes.byref(fs)
+    ptr = readf(fs, path(file_path), ctypes.byref(size))
+    if ptr is None:
+        return None
+    data = ctypes.string_at(ptr, size.value).decode("utf-8")
+    libc.free(ctypes.c_void_p(ptr))
+    return data
+
 #set (overwrites) data block with abitrary data
 
 #block_num addresses the location in the data_blocks array, whereas parent_block_num adresses the direct_blocks array in the parent inode